@@ -0,0 +1,23 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+// Results are printed as "BENCH <benchmark> <metric> <value> <unit>" lines,
+// which is what run.py picks up from the console.
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline void bench_report(const char *bench, const char *metric, double value, const char *unit)
+{
+    printf("BENCH %s %s %.3f %s\n", bench, metric, value, unit);
+    fflush(stdout);
+}
+
+#endif
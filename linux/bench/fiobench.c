@@ -0,0 +1,104 @@
+// File I/O: sequential write and read back of one file, then small file
+// create/unlink. Runs on whatever filesystem holds the directory given,
+// the initramfs by default or a virtio disk if mounted.
+//
+//   fiobench [dir] [size_kb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+#define CHUNK 4096
+#define SMALL_FILES 100
+
+static char chunk[CHUNK];
+
+static int bench_sequential(const char *path, size_t size)
+{
+    double t;
+    int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    t = bench_now();
+    for (size_t done = 0; done < size; done += CHUNK)
+    {
+        memset(chunk, (int)(done / CHUNK), CHUNK);
+        if (write(fd, chunk, CHUNK) != CHUNK)
+        {
+            perror("write");
+            close(fd);
+            return 1;
+        }
+    }
+    fsync(fd);
+    close(fd);
+    bench_report("fiobench", "seq_write", size / (bench_now() - t) / 1e6, "MB/s");
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+
+    t = bench_now();
+    for (size_t done = 0; done < size; done += CHUNK)
+    {
+        if (read(fd, chunk, CHUNK) != CHUNK || chunk[0] != (char)(done / CHUNK) || chunk[CHUNK - 1] != chunk[0])
+        {
+            printf("fiobench: read back mismatch at %u\n", (unsigned)done);
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+    bench_report("fiobench", "seq_read", size / (bench_now() - t) / 1e6, "MB/s");
+
+    unlink(path);
+    return 0;
+}
+
+static int bench_small_files(const char *dir)
+{
+    char path[256];
+
+    double t = bench_now();
+    for (int i = 0; i < SMALL_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/fiobench.%d", dir, i);
+        int fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+        if (fd < 0 || write(fd, chunk, 64) != 64)
+        {
+            perror(path);
+            return 1;
+        }
+        close(fd);
+    }
+    for (int i = 0; i < SMALL_FILES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/fiobench.%d", dir, i);
+        unlink(path);
+    }
+    bench_report("fiobench", "create_unlink", (bench_now() - t) / SMALL_FILES * 1e6, "us");
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *dir = argc > 1 ? argv[1] : "/tmp";
+    size_t size = (argc > 2 ? atoi(argv[2]) : 512) * 1024;
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/fiobench.dat", dir);
+    if (bench_sequential(path, size - size % CHUNK))
+        return 1;
+    return bench_small_files(dir);
+}
@@ -0,0 +1,112 @@
+// Memory bandwidth (read, write, copy) and load latency over a range of
+// working set sizes. The emulator's line cache and SRAM tier make the small
+// sizes fast, the large ones end up in PSRAM.
+//
+//   membench [max_kb]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "bench.h"
+
+// Bytes moved per measurement, independent of the working set size
+#define BW_TOTAL (1024 * 1024)
+// Dependent loads per latency measurement
+#define LAT_LOADS 200000
+
+// Spacing of the chased pointers, larger than an emulator cache line
+#define LAT_STRIDE 32
+
+static volatile uint32_t sink;
+
+static void report(size_t size, const char *what, double value, const char *unit)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%ukB_%s", (unsigned)(size / 1024), what);
+    bench_report("membench", name, value, unit);
+}
+
+static void bandwidth(uint32_t *buf, uint32_t *dst, size_t size)
+{
+    uint32_t reps = BW_TOTAL / size;
+    size_t words = size / 4;
+    double t;
+
+    t = bench_now();
+    for (uint32_t r = 0; r < reps; r++)
+        memset(buf, r, size);
+    report(size, "write", BW_TOTAL / (bench_now() - t) / 1e6, "MB/s");
+
+    t = bench_now();
+    uint32_t sum = 0;
+    for (uint32_t r = 0; r < reps; r++)
+        for (size_t i = 0; i < words; i++)
+            sum += buf[i];
+    sink = sum;
+    report(size, "read", BW_TOTAL / (bench_now() - t) / 1e6, "MB/s");
+
+    t = bench_now();
+    for (uint32_t r = 0; r < reps; r++)
+        memcpy(dst, buf, size);
+    report(size, "copy", BW_TOTAL / (bench_now() - t) / 1e6, "MB/s");
+}
+
+// Chase a random cyclic permutation so every load depends on the previous one
+static void latency(uint8_t *buf, size_t size)
+{
+    uint32_t n = size / LAT_STRIDE;
+    uint32_t *order = malloc(n * sizeof(uint32_t));
+    if (!order)
+        return;
+
+    for (uint32_t i = 0; i < n; i++)
+        order[i] = i;
+    srand(1);
+    for (uint32_t i = n - 1; i > 0; i--)
+    {
+        uint32_t j = rand() % (i + 1);
+        uint32_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+    for (uint32_t i = 0; i < n; i++)
+        *(void **)(buf + order[i] * LAT_STRIDE) = buf + order[(i + 1) % n] * LAT_STRIDE;
+    free(order);
+
+    void **p = (void **)buf;
+    double t = bench_now();
+    for (uint32_t i = 0; i < LAT_LOADS; i++)
+        p = *p;
+    t = bench_now() - t;
+    sink = (uintptr_t)p;
+
+    report(size, "latency", t / LAT_LOADS * 1e9, "ns");
+}
+
+int main(int argc, char **argv)
+{
+    size_t max = (argc > 1 ? atoi(argv[1]) : 1024) * 1024;
+
+    // No MMU, so large buffers need contiguous free memory
+    for (size_t size = 4096; size <= max; size *= 4)
+    {
+        uint32_t *buf = malloc(size), *dst = malloc(size);
+        if (!buf || !dst)
+        {
+            printf("membench: can't allocate %u bytes\n", (unsigned)size);
+            free(buf);
+            free(dst);
+            break;
+        }
+
+        bandwidth(buf, dst, size);
+        latency((uint8_t *)buf, size);
+
+        free(buf);
+        free(dst);
+    }
+
+    return 0;
+}
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+"""Boot an image in the host-native emulator, run the benchmark suite and
+write the scores as JSON.
+
+The guest clock is tied to the instruction count by default (-f), so guest
+side scores only change when the guest code or the emulated instruction
+stream does. Host wall time per benchmark tracks the speed of the emulator
+itself.
+
+    ./run.py -o results.json
+    ./run.py -o new.json --baseline results.json
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+REPO = os.path.normpath(os.path.join(HERE, "..", ".."))
+HOST_DIR = os.path.join(REPO, "pico-rv32ima", "host")
+HOST_EMU = os.path.join(HOST_DIR, "rv32ima-host")
+
+DEFAULT_BOOTARGS = "earlycon=uart8250,mmio,0x10000000,1000000 console=hvc0 bench"
+
+BENCH_RE = re.compile(r"^BENCH (\S+) (\S+) (\S+) (\S+)$")
+
+
+def git_revision():
+    try:
+        return subprocess.check_output(["git", "-C", REPO, "describe", "--always", "--dirty"],
+                                       text=True, stderr=subprocess.DEVNULL).strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def sha256(path):
+    h = hashlib.sha256()
+    with open(path, "rb") as f:
+        for block in iter(lambda: f.read(1 << 20), b""):
+            h.update(block)
+    return h.hexdigest()
+
+
+def run_suite(args):
+    subprocess.check_call(["make", "-s", "-C", HOST_DIR])
+
+    cmd = [HOST_EMU, "-i", args.image, "-b", args.bootargs, "-t", str(args.timeout)]
+    if not args.realtime:
+        cmd.append("-f")
+
+    results = {}
+    started = {}
+    finished = False
+    log = []
+
+    proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL, stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE, text=True, errors="replace")
+    for line in proc.stdout:
+        line = line.rstrip("\r\n")
+        log.append(line)
+        if args.verbose:
+            print(line, flush=True)
+
+        words = line.split()
+        if not words:
+            continue
+        if words[0] == "BENCH-START" and len(words) == 2:
+            started[words[1]] = time.monotonic()
+            results.setdefault(words[1], {"metrics": {}})
+        elif words[0] == "BENCH-DONE" and len(words) == 3:
+            bench = results.setdefault(words[1], {"metrics": {}})
+            bench["status"] = int(words[2])
+            if words[1] in started:
+                bench["wall_s"] = round(time.monotonic() - started[words[1]], 3)
+        elif words[0] == "BENCH-END":
+            finished = True
+        else:
+            m = BENCH_RE.match(line)
+            if m:
+                bench = results.setdefault(m.group(1), {"metrics": {}})
+                bench["metrics"][m.group(2)] = {"value": float(m.group(3)), "unit": m.group(4)}
+
+    stderr = proc.stderr.read()
+    proc.wait()
+
+    host = {"exit_code": proc.returncode}
+    m = re.search(r"host: cycles=(\d+) wall_us=(\d+)", stderr)
+    if m:
+        host["cycles"] = int(m.group(1))
+        host["wall_s"] = int(m.group(2)) / 1e6
+
+    if not finished:
+        sys.stderr.write("\n".join(log[-40:]) + "\n" + stderr)
+        sys.stderr.write("run.py: the suite did not finish\n")
+
+    return {
+        "revision": git_revision(),
+        "image": os.path.relpath(args.image, REPO),
+        "image_sha256": sha256(args.image),
+        "clock": "realtime" if args.realtime else "fixed",
+        "bootargs": args.bootargs,
+        "complete": finished,
+        "host": host,
+        "benchmarks": results,
+    }, finished
+
+
+def lower_is_better(unit):
+    return unit in ("s", "ms", "us", "ns")
+
+
+def compare(new, old, tolerance):
+    """Returns the list of regressions beyond tolerance (a fraction)"""
+    regressions = []
+    for name, bench in new["benchmarks"].items():
+        base = old.get("benchmarks", {}).get(name)
+        if not base:
+            continue
+
+        pairs = [(metric, m["value"], base["metrics"][metric]["value"], m["unit"])
+                 for metric, m in bench["metrics"].items() if metric in base.get("metrics", {})]
+        if "wall_s" in bench and "wall_s" in base:
+            pairs.append(("wall_s", bench["wall_s"], base["wall_s"], "s"))
+
+        for metric, value, ref, unit in pairs:
+            if not ref:
+                continue
+            change = (value - ref) / ref
+            worse = change > tolerance if lower_is_better(unit) else change < -tolerance
+            print("%-10s %-20s %12.3f %12.3f %+7.1f%% %s" % (name, metric, ref, value, change * 100,
+                                                            "REGRESSION" if worse else ""))
+            if worse:
+                regressions.append("%s/%s" % (name, metric))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-i", "--image", default=os.path.join(REPO, "linux", "buildroot", "output", "images", "Image"),
+                        help="kernel image with the suite in its initramfs")
+    parser.add_argument("-o", "--output", default="bench.json", help="JSON score file to write")
+    parser.add_argument("-b", "--bootargs", default=DEFAULT_BOOTARGS)
+    parser.add_argument("-t", "--timeout", type=int, default=3600, help="host seconds before giving up")
+    parser.add_argument("--realtime", action="store_true", help="use the host clock for the guest")
+    parser.add_argument("--baseline", help="previous score file to compare against")
+    parser.add_argument("--tolerance", type=float, default=0.05, help="allowed change before a regression is reported")
+    parser.add_argument("-v", "--verbose", action="store_true", help="echo the guest console")
+    args = parser.parse_args()
+
+    if not os.path.exists(args.image):
+        parser.error("no image at %s, build it with make in linux/" % args.image)
+
+    scores, finished = run_suite(args)
+    with open(args.output, "w") as f:
+        json.dump(scores, f, indent=2, sort_keys=True)
+        f.write("\n")
+    print("Wrote %s" % args.output)
+
+    failed = [name for name, bench in scores["benchmarks"].items() if bench.get("status", 1)]
+    if failed:
+        print("Failed: %s" % ", ".join(sorted(failed)))
+
+    regressions = []
+    if args.baseline:
+        with open(args.baseline) as f:
+            regressions = compare(scores, json.load(f), args.tolerance)
+
+    return 0 if finished and not failed and not regressions else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,107 @@
+// System call, process creation and pipe microbenchmarks. There is no MMU,
+// so processes are created with vfork().
+//
+//   sysbench [scale]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "bench.h"
+
+static void bench_syscall(int n)
+{
+    double t = bench_now();
+    for (int i = 0; i < n; i++)
+        getppid();
+    bench_report("sysbench", "getppid", (bench_now() - t) / n * 1e6, "us");
+}
+
+static void bench_vfork(int n)
+{
+    double t = bench_now();
+    for (int i = 0; i < n; i++)
+    {
+        pid_t pid = vfork();
+        if (pid == 0)
+            _exit(0);
+        if (pid < 0)
+        {
+            perror("vfork");
+            return;
+        }
+        waitpid(pid, NULL, 0);
+    }
+    bench_report("sysbench", "vfork_exit", (bench_now() - t) / n * 1e6, "us");
+}
+
+static void bench_exec(int n)
+{
+    static char *const argv[] = {"true", NULL};
+
+    double t = bench_now();
+    for (int i = 0; i < n; i++)
+    {
+        pid_t pid = vfork();
+        if (pid == 0)
+        {
+            execv("/bin/true", argv);
+            _exit(127);
+        }
+        if (pid < 0)
+        {
+            perror("vfork");
+            return;
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status))
+        {
+            printf("sysbench: /bin/true failed\n");
+            return;
+        }
+    }
+    bench_report("sysbench", "vfork_exec", (bench_now() - t) / n * 1e6, "us");
+}
+
+// A byte through a pipe and back out, within one process
+static void bench_pipe(int n)
+{
+    int fds[2];
+    char c = 0;
+
+    if (pipe(fds))
+    {
+        perror("pipe");
+        return;
+    }
+
+    double t = bench_now();
+    for (int i = 0; i < n; i++)
+    {
+        if (write(fds[1], &c, 1) != 1 || read(fds[0], &c, 1) != 1)
+        {
+            perror("pipe");
+            break;
+        }
+    }
+    bench_report("sysbench", "pipe_roundtrip", (bench_now() - t) / n * 1e6, "us");
+
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main(int argc, char **argv)
+{
+    int scale = argc > 1 ? atoi(argv[1]) : 1;
+    if (scale < 1)
+        scale = 1;
+
+    bench_syscall(20000 * scale);
+    bench_pipe(5000 * scale);
+    bench_vfork(200 * scale);
+    bench_exec(50 * scale);
+    return 0;
+}
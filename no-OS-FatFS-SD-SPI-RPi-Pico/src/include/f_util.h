@@ -12,6 +12,7 @@ CONDITIONS OF ANY KIND, either express or implied. See the License for the
 specific language governing permissions and limitations under the License.
 */
 #pragma once
+#include <stdbool.h>
 #include "ff.h"
 
 #ifdef __cplusplus
@@ -24,6 +25,7 @@ extern "C" {
         UINT sz_buff,   /* Size of path name buffer (items) */
         FILINFO* fno    /* Name read buffer */
     );
+    bool f_contiguous_lba(FIL *fp, LBA_t *lba);
 
 #ifdef __cplusplus
 }
@@ -43,9 +43,6 @@
 #define SDIO_D2 sd_card_p->sdio_if.D2_gpio
 #define SDIO_D3 sd_card_p->sdio_if.D3_gpio
 
-// Maximum number of 512 byte blocks to transfer in one request
-#define SDIO_MAX_BLOCKS 256
-
 typedef enum sdio_transfer_state_t { SDIO_IDLE, SDIO_RX, SDIO_TX, SDIO_TX_WAIT_IDLE} sdio_transfer_state_t;
 
 static struct {
@@ -58,6 +55,7 @@ static struct {
     sdio_transfer_state_t transfer_state;
     absolute_time_t transfer_timeout_time;
     uint32_t *data_buf;
+    uint32_t block_words; // Size of the blocks being received
     uint32_t blocks_done; // Number of blocks transferred so far
     uint32_t total_blocks; // Total number of blocks to transfer
     uint32_t blocks_checksumed; // Number of blocks that have had CRC calculated
@@ -378,26 +376,28 @@ sdio_status_t rp2040_sdio_command_R3(sd_card_t *sd_card_p, uint8_t command, uint
  * Data reception from SD card
  *******************************************************/
 
-sdio_status_t rp2040_sdio_rx_start(sd_card_t *sd_card_p, uint8_t *buffer, uint32_t num_blocks)
+sdio_status_t rp2040_sdio_rx_start(sd_card_t *sd_card_p, uint8_t *buffer, uint32_t num_blocks, uint32_t block_size)
 {
     // Buffer must be aligned
     assert(((uint32_t)buffer & 3) == 0 && num_blocks <= SDIO_MAX_BLOCKS);
+    assert((block_size & 3) == 0 && block_size <= SDIO_BLOCK_SIZE);
 
     g_sdio.transfer_state = SDIO_RX;
     // g_sdio.transfer_timeout_time = millis();
     g_sdio.transfer_timeout_time = make_timeout_time_ms(1000);
     g_sdio.data_buf = (uint32_t*)buffer;
+    g_sdio.block_words = block_size / sizeof(uint32_t);
     g_sdio.blocks_done = 0;
     g_sdio.total_blocks = num_blocks;
     g_sdio.blocks_checksumed = 0;
     g_sdio.checksum_errors = 0;
 
-    // Create DMA block descriptors to store each block of 512 bytes of data to buffer
+    // Create DMA block descriptors to store each block of data to buffer
     // and then 8 bytes to g_sdio.received_checksums.
     for (uint32_t i = 0; i < num_blocks; i++)
     {
-        g_sdio.dma_blocks[i * 2].write_addr = buffer + i * SDIO_BLOCK_SIZE;
-        g_sdio.dma_blocks[i * 2].transfer_count = SDIO_BLOCK_SIZE / sizeof(uint32_t);
+        g_sdio.dma_blocks[i * 2].write_addr = buffer + i * block_size;
+        g_sdio.dma_blocks[i * 2].transfer_count = g_sdio.block_words;
 
         g_sdio.dma_blocks[i * 2 + 1].write_addr = &g_sdio.received_checksums[i];
         g_sdio.dma_blocks[i * 2 + 1].transfer_count = 2;
@@ -429,7 +429,7 @@ sdio_status_t rp2040_sdio_rx_start(sd_card_t *sd_card_p, uint8_t *buffer, uint32
     pio_sm_set_consecutive_pindirs(SDIO_PIO, SDIO_DATA_SM, SDIO_D0, 4, false);
 
     // Write number of nibbles to receive to Y register
-    pio_sm_put(SDIO_PIO, SDIO_DATA_SM, SDIO_BLOCK_SIZE * 2 + 16 - 1);
+    pio_sm_put(SDIO_PIO, SDIO_DATA_SM, block_size * 2 + 16 - 1);
     pio_sm_exec(SDIO_PIO, SDIO_DATA_SM, pio_encode_out(pio_y, 32));
 
     // Enable RX FIFO join because we don't need the TX FIFO during transfer.
@@ -450,8 +450,8 @@ static void sdio_verify_rx_checksums(uint32_t maxcount)
     {
         // Calculate checksum from received data
         int blockidx = g_sdio.blocks_checksumed++;
-        uint64_t checksum = sdio_crc16_4bit_checksum(g_sdio.data_buf + blockidx * SDIO_WORDS_PER_BLOCK,
-                                                     SDIO_WORDS_PER_BLOCK);
+        uint64_t checksum = sdio_crc16_4bit_checksum(g_sdio.data_buf + blockidx * g_sdio.block_words,
+                                                     g_sdio.block_words);
 
         // Convert received checksum to little-endian format
         uint32_t top = __builtin_bswap32(g_sdio.received_checksums[blockidx].top);
@@ -467,7 +467,7 @@ static void sdio_verify_rx_checksums(uint32_t maxcount)
                 //       " calculated ", checksum, " expected ", expected);
                 printf("%s,%d SDIO checksum error in reception: block %d calculated 0x%llx expected 0x%llx\n",
                     __func__, __LINE__, blockidx, checksum, expected);
-                dump_bytes(SDIO_WORDS_PER_BLOCK, (uint8_t *)g_sdio.data_buf + blockidx * SDIO_WORDS_PER_BLOCK);
+                dump_bytes(g_sdio.block_words, (uint8_t *)(g_sdio.data_buf + blockidx * g_sdio.block_words));
             }
         }
     }
@@ -501,7 +501,7 @@ sdio_status_t rp2040_sdio_rx_poll(sd_card_t *sd_card_p, uint32_t *bytes_complete
 
     if (bytes_complete)
     {
-        *bytes_complete = g_sdio.blocks_done * SDIO_BLOCK_SIZE;
+        *bytes_complete = g_sdio.blocks_done * g_sdio.block_words * sizeof(uint32_t);
     }
 
     if (g_sdio.transfer_state == SDIO_IDLE)
@@ -515,7 +515,9 @@ sdio_status_t rp2040_sdio_rx_poll(sd_card_t *sd_card_p, uint32_t *bytes_complete
             return SDIO_ERR_DATA_CRC;
     }
     // else if ((uint32_t)(millis() - g_sdio.transfer_start_time) > 1000)
-    else if ((absolute_time_diff_us(get_absolute_time(), g_sdio.transfer_timeout_time) < 0))
+    // A transfer that finished while nobody polled (e.g. during a stream callback) isn't late
+    else if (g_sdio.blocks_done < g_sdio.total_blocks &&
+             absolute_time_diff_us(get_absolute_time(), g_sdio.transfer_timeout_time) < 0)
     {
         azdbg("rp2040_sdio_rx_poll() timeout, "
             "PIO PC: ", (int)pio_sm_get_pc(SDIO_PIO, SDIO_DATA_SM) - (int)g_sdio.pio_data_rx_offset,
@@ -798,7 +800,10 @@ sdio_status_t rp2040_sdio_stop(sd_card_t *sd_card_p)
 {
     dma_channel_abort(SDIO_DMA_CH);
     dma_channel_abort(SDIO_DMA_CHB);
-    dma_set_irq1_channel_mask_enabled(1 << SDIO_DMA_CHB, 0);
+    if (sd_card_p->sdio_if.DMA_IRQ_num == DMA_IRQ_0)
+        dma_set_irq0_channel_mask_enabled(1 << SDIO_DMA_CHB, 0);
+    else
+        dma_set_irq1_channel_mask_enabled(1 << SDIO_DMA_CHB, 0);
     pio_sm_set_enabled(SDIO_PIO, SDIO_DATA_SM, false);
     pio_sm_set_consecutive_pindirs(SDIO_PIO, SDIO_DATA_SM, SDIO_D0, 4, false);    
     g_sdio.transfer_state = SDIO_IDLE;
@@ -831,21 +836,23 @@ void rp2040_sdio_init(sd_card_t *sd_card_p, int clock_divider)
             sd_card_p->sdio_if.DMA_IRQ_num, rp2040_sdio_tx_irq,
             PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
 
+        // Load PIO programs. Only once, the PIO may be shared with other
+        // drivers, so its instruction memory is left alone on re-init
+        memset(&g_sdio, 0, sizeof(g_sdio));
+        g_sdio.pio_cmd_clk_offset = pio_add_program(SDIO_PIO, &sdio_cmd_clk_program);
+        g_sdio.pio_data_rx_offset = pio_add_program(SDIO_PIO, &sdio_data_rx_program);
+        g_sdio.pio_data_tx_offset = pio_add_program(SDIO_PIO, &sdio_data_tx_program);
+
         resources_claimed = true;
     }
 
-    memset(&g_sdio, 0, sizeof(g_sdio));
-
     dma_channel_abort(SDIO_DMA_CH);
     dma_channel_abort(SDIO_DMA_CHB);
     pio_sm_set_enabled(SDIO_PIO, SDIO_CMD_SM, false);
     pio_sm_set_enabled(SDIO_PIO, SDIO_DATA_SM, false);
-
-    // Load PIO programs
-    pio_clear_instruction_memory(SDIO_PIO);
+    g_sdio.transfer_state = SDIO_IDLE;
 
     // Command & clock state machine
-    g_sdio.pio_cmd_clk_offset = pio_add_program(SDIO_PIO, &sdio_cmd_clk_program);
     pio_sm_config cfg = sdio_cmd_clk_program_get_default_config(g_sdio.pio_cmd_clk_offset);
     sm_config_set_out_pins(&cfg, SDIO_CMD, 1);
     sm_config_set_in_pins(&cfg, SDIO_CMD);
@@ -862,7 +869,6 @@ void rp2040_sdio_init(sd_card_t *sd_card_p, int clock_divider)
     pio_sm_set_enabled(SDIO_PIO, SDIO_CMD_SM, true);
 
     // Data reception program
-    g_sdio.pio_data_rx_offset = pio_add_program(SDIO_PIO, &sdio_data_rx_program);
     g_sdio.pio_cfg_data_rx = sdio_data_rx_program_get_default_config(g_sdio.pio_data_rx_offset);
     sm_config_set_in_pins(&g_sdio.pio_cfg_data_rx, SDIO_D0);
     sm_config_set_in_shift(&g_sdio.pio_cfg_data_rx, false, true, 32);
@@ -870,7 +876,6 @@ void rp2040_sdio_init(sd_card_t *sd_card_p, int clock_divider)
     sm_config_set_clkdiv_int_frac(&g_sdio.pio_cfg_data_rx, clock_divider, 0);
 
     // Data transmission program
-    g_sdio.pio_data_tx_offset = pio_add_program(SDIO_PIO, &sdio_data_tx_program);
     g_sdio.pio_cfg_data_tx = sdio_data_tx_program_get_default_config(g_sdio.pio_data_tx_offset);
     sm_config_set_in_pins(&g_sdio.pio_cfg_data_tx, SDIO_D0);
     sm_config_set_set_pins(&g_sdio.pio_cfg_data_tx, SDIO_D0, 4);
@@ -887,12 +892,13 @@ void rp2040_sdio_init(sd_card_t *sd_card_p, int clock_divider)
                                  | (1 << SDIO_D0) | (1 << SDIO_D1) | (1 << SDIO_D2) | (1 << SDIO_D3);
 
     // Redirect GPIOs to PIO
-    gpio_set_function(SDIO_CMD, GPIO_FUNC_PIO1);
-    gpio_set_function(SDIO_CLK, GPIO_FUNC_PIO1);
-    gpio_set_function(SDIO_D0, GPIO_FUNC_PIO1);
-    gpio_set_function(SDIO_D1, GPIO_FUNC_PIO1);
-    gpio_set_function(SDIO_D2, GPIO_FUNC_PIO1);
-    gpio_set_function(SDIO_D3, GPIO_FUNC_PIO1);
+    enum gpio_function fn = pio_get_index(SDIO_PIO) ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0;
+    gpio_set_function(SDIO_CMD, fn);
+    gpio_set_function(SDIO_CLK, fn);
+    gpio_set_function(SDIO_D0, fn);
+    gpio_set_function(SDIO_D1, fn);
+    gpio_set_function(SDIO_D2, fn);
+    gpio_set_function(SDIO_D3, fn);
 
     irq_set_enabled(sd_card_p->sdio_if.DMA_IRQ_num, true);
 }
@@ -8,6 +8,7 @@
 #include "hardware/pio.h"
 #endif
 
+#define SDIO_CLK_CYCLES 4
 #define SDIO_CLK_PIN_D0_OFFSET 30
 
 // ------------ //
@@ -8,6 +8,7 @@
 #include <stdint.h>
 #include <string.h>
 //
+#include <hardware/clocks.h>
 #include <hardware/gpio.h>
 //
 #include "diskio.h"
@@ -35,6 +36,9 @@ static sdio_status_t g_sdio_error;
 static uint32_t g_sdio_dma_buf[128];
 static uint32_t g_sdio_sector_count;
 
+// Clock divider used to bring the card up
+#define SDIO_INIT_DIVIDER 50
+
 #define checkReturnOk(call) ((g_sdio_error = (call)) == SDIO_OK ? true : logSDError(__LINE__))
 
 static bool logSDError(int line)
@@ -80,13 +84,70 @@ static sd_callback_t get_stream_callback(const uint8_t *buf, uint32_t count, con
     return NULL;
 }
 
+static bool sd_sdio_switch_high_speed(sd_card_t *sd_card_p)
+{
+    uint8_t status[64];
+
+    if (!sd_sdio_cardCMD6(sd_card_p, CMD6_CHECK_HIGH_SPEED, status) ||
+        !(status[13] & 0x02) || (status[16] & 0x0F) != 1)
+    {
+        return false;
+    }
+    // The clock keeps running, so the 8 clocks before the new timing applies come for free
+    return sd_sdio_cardCMD6(sd_card_p, CMD6_SWITCH_HIGH_SPEED, status) && (status[16] & 0x0F) == 1;
+}
+
+static int sd_sdio_read_blocks(sd_card_t *sd_card_p, uint8_t *buffer, uint64_t ulSectorNumber,
+                               uint32_t ulSectorCount);
+
+// Smallest divider that keeps the SD clock at or below hz, but never below the configured one
+static uint sd_sdio_set_clock(sd_card_t *sd_card_p, uint hz)
+{
+    uint32_t sys_hz = clock_get_hz(clk_sys);
+    uint divider = (sys_hz + SDIO_CLK_CYCLES * hz - 1) / (SDIO_CLK_CYCLES * hz);
+    if (divider < sd_card_p->sdio_if.clock_divider)
+        divider = sd_card_p->sdio_if.clock_divider;
+    if (divider < 2)
+        divider = 2;
+    if (divider > SDIO_INIT_DIVIDER)
+        divider = SDIO_INIT_DIVIDER;
+
+    rp2040_sdio_init(sd_card_p, divider);
+    sd_card_p->clock_hz = sys_hz / SDIO_CLK_CYCLES / divider;
+    return sd_card_p->clock_hz;
+}
+
+static void sd_sdio_abort_read(sd_card_t *sd_card_p)
+{
+    sd_sdio_stopTransmission(sd_card_p, true);
+}
+
+static const sd_calibrate_ops_t sd_sdio_calibrate_ops = {
+    .set_clock = sd_sdio_set_clock,
+    .read_blocks = sd_sdio_read_blocks,
+    .abort = sd_sdio_abort_read,
+};
+
+// Start at the configured divider, or the fastest clock the card's speed mode
+// allows, and step down from there (see sd_calibrate_clock())
+static void sd_sdio_calibrate_clock(sd_card_t *sd_card_p)
+{
+    uint32_t sys_hz = clock_get_hz(clk_sys);
+    uint base_hz = sys_hz / SDIO_CLK_CYCLES / SDIO_INIT_DIVIDER;
+    uint max_hz = sd_card_p->high_speed ? SD_HIGH_SPEED_MAX_HZ : SD_DEFAULT_SPEED_MAX_HZ;
+    if (sd_card_p->sdio_if.clock_divider)
+        max_hz = sys_hz / SDIO_CLK_CYCLES / sd_card_p->sdio_if.clock_divider;
+
+    sd_calibrate_clock(sd_card_p, &sd_sdio_calibrate_ops, base_hz, max_hz);
+}
+
 bool sd_sdio_begin(sd_card_t *sd_card_p)
 {
     uint32_t reply;
     sdio_status_t status;
     
     // Initialize at 1 MHz clock speed
-    rp2040_sdio_init(sd_card_p, 50);
+    rp2040_sdio_init(sd_card_p, SDIO_INIT_DIVIDER);
 
     // Establish initial connection with the card
     for (int retries = 0; retries < 5; retries++)
@@ -151,6 +212,7 @@ bool sd_sdio_begin(sd_card_t *sd_card_p)
     }
 
     g_sdio_sector_count = sd_sdio_sectorCount(sd_card_p);
+    sd_card_p->sectors = g_sdio_sector_count;
 
     // Select card
     if (!checkReturnOk(rp2040_sdio_command_R1(sd_card_p, CMD7, g_sdio_rca, &reply)))
@@ -172,10 +234,9 @@ bool sd_sdio_begin(sd_card_t *sd_card_p)
         return false;
     }
 
-    // Increase to 25 MHz clock rate
-    // Actually, clk_sys / CLKDIV (from rp2040_sdio.pio),
-    // So, say, 125 MHz / 4 = 31.25 MHz
-    rp2040_sdio_init(sd_card_p, 2);
+    // Go as fast as the card and the wiring allow
+    sd_card_p->high_speed = sd_sdio_switch_high_speed(sd_card_p);
+    sd_sdio_calibrate_clock(sd_card_p);
 
     return true;
 }
@@ -203,7 +264,7 @@ bool sd_sdio_isBusy(sd_card_t *sd_card_p)
 
 uint32_t sd_sdio_kHzSdClk(sd_card_t *sd_card_p)
 {
-    return 0;
+    return sd_card_p->clock_hz / 1000;
 }
 
 bool sd_sdio_readCID(sd_card_t *sd_card_p, cid_t* cid)
@@ -332,8 +393,26 @@ bool sd_sdio_erase(sd_card_t *sd_card_p, uint32_t firstSector, uint32_t lastSect
 }
 
 bool sd_sdio_cardCMD6(sd_card_t *sd_card_p, uint32_t arg, uint8_t* status) {
-    azlog("sd_sdio_cardCMD6() not implemented");
-    return false;
+    // The 512 bit switch status comes back as a short data block
+    uint32_t reply;
+    if (!checkReturnOk(rp2040_sdio_rx_start(sd_card_p, (uint8_t*)g_sdio_dma_buf, 1, 64)) ||
+        !checkReturnOk(rp2040_sdio_command_R1(sd_card_p, CMD6, arg, &reply))) // SWITCH_FUNC
+    {
+        rp2040_sdio_stop(sd_card_p);
+        return false;
+    }
+
+    do {
+        g_sdio_error = rp2040_sdio_rx_poll(sd_card_p, NULL);
+    } while (g_sdio_error == SDIO_BUSY);
+
+    if (g_sdio_error != SDIO_OK)
+    {
+        return logSDError(__LINE__);
+    }
+
+    memcpy(status, g_sdio_dma_buf, 64);
+    return true;
 }
 
 bool sd_sdio_readSCR(sd_card_t *sd_card_p, scr_t* scr) {
@@ -443,7 +522,7 @@ bool sd_sdio_readSector(sd_card_t *sd_card_p, uint32_t sector, uint8_t* dst)
 
     uint32_t reply;
     if (/* !checkReturnOk(rp2040_sdio_command_R1(sd_card_p, 16, 512, &reply)) || // SET_BLOCKLEN */
-        !checkReturnOk(rp2040_sdio_rx_start(sd_card_p, dst, 1)) || // Prepare for reception
+        !checkReturnOk(rp2040_sdio_rx_start(sd_card_p, dst, 1, SDIO_BLOCK_SIZE)) || // Prepare for reception
         !checkReturnOk(rp2040_sdio_command_R1(sd_card_p, CMD17, sector, &reply))) // READ_SINGLE_BLOCK
     {
         return false;
@@ -493,7 +572,7 @@ bool sd_sdio_readSectors(sd_card_t *sd_card_p, uint32_t sector, uint8_t* dst, si
 
     uint32_t reply;
     if (/* !checkReturnOk(rp2040_sdio_command_R1(sd_card_p, 16, 512, &reply)) || // SET_BLOCKLEN */
-        !checkReturnOk(rp2040_sdio_rx_start(sd_card_p, dst, n)) || // Prepare for reception
+        !checkReturnOk(rp2040_sdio_rx_start(sd_card_p, dst, n, SDIO_BLOCK_SIZE)) || // Prepare for reception
         !checkReturnOk(rp2040_sdio_command_R1(sd_card_p, CMD18, sector, &reply))) // READ_MULTIPLE_BLOCK
     {
         return false;
@@ -558,6 +637,79 @@ static int sd_sdio_read_blocks(sd_card_t *sd_card_p, uint8_t *buffer, uint64_t u
         return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
 }
 
+static bool sd_sdio_burst_start(sd_card_t *sd_card_p, uint32_t sector, uint8_t *dst, uint32_t n)
+{
+    uint32_t reply;
+    if (!checkReturnOk(rp2040_sdio_rx_start(sd_card_p, dst, n, SDIO_BLOCK_SIZE)) || // Prepare for reception
+        !checkReturnOk(rp2040_sdio_command_R1(sd_card_p, CMD18, sector, &reply))) // READ_MULTIPLE_BLOCK
+    {
+        rp2040_sdio_stop(sd_card_p);
+        return false;
+    }
+    return true;
+}
+
+static sdio_status_t sd_sdio_burst_wait(sd_card_t *sd_card_p)
+{
+    sdio_status_t status;
+    do {
+        status = rp2040_sdio_rx_poll(sd_card_p, NULL);
+    } while (status == SDIO_BUSY);
+
+    // Stop the card even after an error, it keeps sending until told
+    if (!sd_sdio_stopTransmission(sd_card_p, true) && status == SDIO_OK)
+        status = SDIO_ERR_DATA_TIMEOUT;
+    return status;
+}
+
+// Read ahead in bursts of half the buffer. The SD clock can't be held while
+// the callback runs, so each burst is a CMD18 closed by CMD12, and the next
+// one is already on its way into the other half when the callback gets this one
+static int sd_sdio_read_stream(sd_card_t *sd_card_p, uint64_t ulSectorNumber, uint32_t ulSectorCount,
+                               uint8_t *buffer, uint32_t bufferBlocks, sd_stream_cb_t cb, void *ctx)
+{
+    // Unaligned buffers and the end of the card go through read_blocks instead
+    if (((uint32_t)buffer & 3) != 0 || ulSectorNumber + ulSectorCount >= g_sdio_sector_count)
+        return SD_BLOCK_DEVICE_ERROR_UNSUPPORTED;
+
+    uint32_t burst = bufferBlocks / 2 < SDIO_MAX_BLOCKS ? bufferBlocks / 2 : SDIO_MAX_BLOCKS;
+    uint8_t *half[2] = {buffer, buffer + burst * SDIO_BLOCK_SIZE};
+    uint32_t sector = ulSectorNumber;
+    uint32_t left = ulSectorCount;
+
+    uint32_t n = left < burst ? left : burst;
+    if (n && !sd_sdio_burst_start(sd_card_p, sector, half[0], n))
+        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+
+    for (int i = 0; left; i ^= 1)
+    {
+        sdio_status_t status = sd_sdio_burst_wait(sd_card_p);
+        if (status != SDIO_OK)
+        {
+            printf("%s,%d burst at %lu failed: %d\n", __func__, __LINE__, sector, status);
+            return status == SDIO_ERR_DATA_CRC ? SD_BLOCK_DEVICE_ERROR_CRC : SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        }
+
+        uint32_t done = n;
+        sector += done;
+        left -= done;
+        n = left < burst ? left : burst;
+        if (n && !sd_sdio_burst_start(sd_card_p, sector, half[i ^ 1], n))
+            return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+
+        if (!cb(ctx, half[i], done))
+        {
+            if (n)
+            {
+                rp2040_sdio_stop(sd_card_p);
+                sd_sdio_stopTransmission(sd_card_p, true);
+            }
+            break;
+        }
+    }
+    return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
 // Helper function to configure whole GPIO in one line
 static void gpio_conf(uint gpio, enum gpio_function fn, bool pullup, bool pulldown, bool output, bool initial_state, bool fast_slew)
 {
@@ -588,16 +740,21 @@ void sd_sdio_ctor(sd_card_t *sd_card_p) {
     sd_card_p->init = sd_sdio_init;
     sd_card_p->write_blocks = sd_sdio_write_blocks;
     sd_card_p->read_blocks = sd_sdio_read_blocks;
+    sd_card_p->read_stream = sd_sdio_read_stream;
     sd_card_p->get_num_sectors = sd_sdio_sectorCount;
     sd_card_p->sd_readCID = sd_sdio_readCID;
 
-    //        pin                          function        pup   pdown  out    state fast
-    gpio_conf(sd_card_p->sdio_if.CLK_gpio, GPIO_FUNC_PIO1, true, false, true,  true, true);
-    gpio_conf(sd_card_p->sdio_if.CMD_gpio, GPIO_FUNC_PIO1, true, false, true,  true, true);
-    gpio_conf(sd_card_p->sdio_if.D0_gpio,  GPIO_FUNC_PIO1, true, false, false, true, true);
-    gpio_conf(sd_card_p->sdio_if.D1_gpio,  GPIO_FUNC_PIO1, true, false, false, true, true);
-    gpio_conf(sd_card_p->sdio_if.D2_gpio,  GPIO_FUNC_PIO1, true, false, false, true, true);
-    gpio_conf(sd_card_p->sdio_if.D3_gpio,  GPIO_FUNC_PIO1, true, false, false, true, true);
+    if (!sd_card_p->sdio_if.SDIO_PIO)
+        sd_card_p->sdio_if.SDIO_PIO = pio0;
+    enum gpio_function fn = pio_get_index(sd_card_p->sdio_if.SDIO_PIO) ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0;
+
+    //        pin                          function pup   pdown  out    state fast
+    gpio_conf(sd_card_p->sdio_if.CLK_gpio, fn,      true, false, true,  true, true);
+    gpio_conf(sd_card_p->sdio_if.CMD_gpio, fn,      true, false, true,  true, true);
+    gpio_conf(sd_card_p->sdio_if.D0_gpio,  fn,      true, false, false, true, true);
+    gpio_conf(sd_card_p->sdio_if.D1_gpio,  fn,      true, false, false, true, true);
+    gpio_conf(sd_card_p->sdio_if.D2_gpio,  fn,      true, false, false, true, true);
+    gpio_conf(sd_card_p->sdio_if.D3_gpio,  fn,      true, false, false, true, true);
 
     if (sd_card_p->use_card_detect) {
         gpio_init(sd_card_p->card_detect_gpio);
@@ -718,37 +718,64 @@ static int sd_read_bytes(sd_card_t *sd_card_p, uint8_t *buffer, uint32_t length)
 
     return 0;
 }
-static int sd_read_block(sd_card_t *sd_card_p, uint8_t *buffer, uint32_t length) {
-    uint16_t crc;
+// Bytes clocked in after a block's CRC while looking for the next start token.
+// During CMD18 most cards send it within a few bytes, so it (and the first data
+// bytes) are usually already in the RX FIFO when the block's DMA ends.
+#define SD_READ_LOOKAHEAD (SPI_FIFO_DEPTH - 2)
+
+// Receive blockCnt data blocks after CMD17/CMD18. Each block is one DMA
+// transfer that carries on through its CRC and into the gap before the next
+// block, with the DMA sniffer computing the CRC16 as the data comes in. Byte by
+// byte token polling is only needed when the card takes longer than that.
+static int sd_read_block_stream(sd_card_t *sd_card_p, uint8_t *buffer, uint32_t blockCnt) {
+    uint8_t tail[2 + SD_READ_LOOKAHEAD];
+    bool token = false;  // Start token of the current block already seen
+    size_t have = 0;     // Bytes of the current block that came with it
 
-    // read until start byte (0xFE)
-    if (false == sd_wait_token(sd_card_p, SPI_START_BLOCK)) {
-        DBG_PRINTF("%s:%d Read timeout\r\n", __FILE__, __LINE__);
-        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
-    }
-    // read data
-    // bool spi_transfer(const uint8_t *tx, uint8_t *rx, size_t length)
-    if (!sd_spi_transfer(sd_card_p, NULL, buffer, length)) {
-        return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
-    }
-    // Read the CRC16 checksum for the data block
-    crc = (sd_spi_write(sd_card_p, SPI_FILL_CHAR) << 8);
-    crc |= sd_spi_write(sd_card_p, SPI_FILL_CHAR);
+    while (blockCnt) {
+        // read until start byte (0xFE)
+        if (!token && !sd_wait_token(sd_card_p, SPI_START_BLOCK)) {
+            DBG_PRINTF("%s:%d Read timeout\r\n", __FILE__, __LINE__);
+            return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        }
+        uint16_t seed = 0;
+#if SD_CRC_ENABLED
+        if (have)
+            seed = crc16((void *)buffer, have);
+#endif
+        size_t tail_len = blockCnt > 1 ? sizeof tail : 2;
+        uint16_t crc_result;
+        sd_spi_read_start(sd_card_p, buffer + have, _block_size - have, tail_len, seed);
+        if (!sd_spi_read_finish(sd_card_p, tail, tail_len, &crc_result)) {
+            return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+        }
 
 #if SD_CRC_ENABLED
-    if (crc_on) {
-        uint32_t crc_result;
-        // Compute and verify checksum
-        crc_result = crc16((void *)buffer, length);
-        if ((uint16_t)crc_result != crc) {
+        uint16_t crc = (tail[0] << 8) | tail[1];
+        if (crc_on && crc_result != crc) {
             DBG_PRINTF("%s: Invalid CRC received 0x%" PRIx16
                        " result of computation 0x%" PRIx16 "\r\n",
-                       __FUNCTION__, crc, (uint16_t)crc_result);
+                       __FUNCTION__, crc, crc_result);
             return SD_BLOCK_DEVICE_ERROR_CRC;
         }
-    }
 #endif
+        buffer += _block_size;
+        --blockCnt;
 
+        // Anything but fill bytes ahead of the next start token is an error token
+        token = false;
+        have = 0;
+        for (size_t i = 2; i < tail_len; i++) {
+            if (token) {
+                buffer[have++] = tail[i];
+            } else if (SPI_START_BLOCK == tail[i]) {
+                token = true;
+            } else if (SPI_FILL_CHAR != tail[i]) {
+                DBG_PRINTF("%s: Data error token 0x%02hhx\r\n", __FUNCTION__, tail[i]);
+                return SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
+            }
+        }
+    }
     return SD_BLOCK_DEVICE_ERROR_NONE;
 }
 
@@ -780,16 +807,8 @@ static int in_sd_read_blocks(sd_card_t *sd_card_p, uint8_t *buffer,
     if (SD_BLOCK_DEVICE_ERROR_NONE != status) {
         return status;
     }
-    // receive the data : one block at a time
-    int rd_status = 0;
-    while (blockCnt) {
-        if (0 != sd_read_block(sd_card_p, buffer, _block_size)) {
-            rd_status = SD_BLOCK_DEVICE_ERROR_NO_RESPONSE;
-            break;
-        }
-        buffer += _block_size;
-        --blockCnt;
-    }
+    // receive the data
+    int rd_status = sd_read_block_stream(sd_card_p, buffer, blockCnt);
     // Send CMD12(0x00000000) to stop the transmission for multi-block transfer
     if (ulSectorCount > 1) {
         status = sd_cmd(sd_card_p, CMD12_STOP_TRANSMISSION, 0x0, false, 0);
@@ -1061,6 +1080,56 @@ static int sd_init_medium(sd_card_t *sd_card_p) {
     return status;
 }
 
+// Switch the card to high speed mode if it has one. CMD6 returns a 512 bit
+// status block: group 1 support is in bits 415:400, the function that is (or
+// would be) selected in bits 379:376.
+static bool sd_switch_high_speed(sd_card_t *sd_card_p) {
+    uint8_t status[64];
+
+    if (sd_cmd(sd_card_p, CMD6_SWITCH_FUNC, CMD6_CHECK_HIGH_SPEED, false, 0) != 0 ||
+        sd_read_bytes(sd_card_p, status, sizeof status) != 0) {
+        DBG_PRINTF("%s: CMD6 not supported\r\n", __FUNCTION__);
+        return false;
+    }
+    if (!(status[13] & 0x02) || (status[16] & 0x0F) != 1) {
+        DBG_PRINTF("%s: No high speed mode\r\n", __FUNCTION__);
+        return false;
+    }
+    if (sd_cmd(sd_card_p, CMD6_SWITCH_FUNC, CMD6_SWITCH_HIGH_SPEED, false, 0) != 0 ||
+        sd_read_bytes(sd_card_p, status, sizeof status) != 0 ||
+        (status[16] & 0x0F) != 1) {
+        DBG_PRINTF("%s: Switch failed\r\n", __FUNCTION__);
+        return false;
+    }
+    // The new timing applies 8 clocks after the status block
+    sd_spi_write(sd_card_p, SPI_FILL_CHAR);
+    return true;
+}
+
+static void sd_abort_read(sd_card_t *sd_card_p) {
+    sd_cmd(sd_card_p, CMD12_STOP_TRANSMISSION, 0x0, false, 0);
+}
+
+static const sd_calibrate_ops_t sd_calibrate_ops = {
+    .set_clock = sd_spi_set_frequency,
+    .read_blocks = in_sd_read_blocks,
+    .abort = sd_abort_read,
+};
+
+// Raise SCK as far as the card and the wiring allow, starting from the
+// configured clock (see sd_calibrate_clock())
+static void sd_raise_clock(sd_card_t *sd_card_p) {
+    uint max = sd_card_p->spi_if.max_baud_rate;
+
+    sd_card_p->high_speed = sd_switch_high_speed(sd_card_p);
+    if (!sd_card_p->high_speed && max > SD_DEFAULT_SPEED_MAX_HZ)
+        max = SD_DEFAULT_SPEED_MAX_HZ;
+
+    uint hz = sd_calibrate_clock(sd_card_p, &sd_calibrate_ops, sd_card_p->clock_hz, max);
+    DBG_PRINTF("%s: SCK %u Hz%s\r\n", __FUNCTION__, hz,
+               sd_card_p->high_speed ? " (high speed)" : "");
+}
+
 int sd_spi_init(sd_card_t *sd_card_p) {
     TRACE_PRINTF("> %s\r\n", __FUNCTION__);
 
@@ -1084,6 +1153,8 @@ int sd_spi_init(sd_card_t *sd_card_p) {
     }
     // Initialize the member variables
     sd_card_p->card_type = SDCARD_NONE;
+    sd_card_p->high_speed = false;
+    sd_card_p->clock_hz = 0;
 
     sd_spi_acquire(sd_card_p);
 
@@ -1115,6 +1186,9 @@ int sd_spi_init(sd_card_t *sd_card_p) {
     // The card is now initialized
     sd_card_p->m_Status &= ~STA_NOINIT;
 
+    if (sd_card_p->spi_if.max_baud_rate > sd_card_p->clock_hz)
+        sd_raise_clock(sd_card_p);
+
     sd_spi_release(sd_card_p);
     sd_unlock(sd_card_p);
 
@@ -31,8 +31,16 @@ specific language governing permissions and limitations under the License.
 #pragma GCC diagnostic ignored "-Wunused-variable"
 void sd_spi_go_high_frequency(sd_card_t *sd_card_p) {
     uint actual = spi_set_baudrate(sd_card_p->spi_if.spi->hw_inst, sd_card_p->spi_if.spi->baud_rate);
+    sd_card_p->clock_hz = actual;
     TRACE_PRINTF("%s: Actual frequency: %lu\n", __FUNCTION__, (long)actual);
 }
+// Returns the actual frequency, the closest the SPI can do at or below hz
+uint sd_spi_set_frequency(sd_card_t *sd_card_p, uint hz) {
+    uint actual = spi_set_baudrate(sd_card_p->spi_if.spi->hw_inst, hz);
+    sd_card_p->clock_hz = actual;
+    TRACE_PRINTF("%s: Actual frequency: %lu\n", __FUNCTION__, (long)actual);
+    return actual;
+}
 void sd_spi_go_low_frequency(sd_card_t *sd_card_p) {
     uint actual = spi_set_baudrate(sd_card_p->spi_if.spi->hw_inst, 400 * 1000); // Actual frequency: 398089
     TRACE_PRINTF("%s: Actual frequency: %lu\n", __FUNCTION__, (long)actual);
@@ -91,16 +99,22 @@ bool sd_spi_transfer(sd_card_t *sd_card_p, const uint8_t *tx, uint8_t *rx,
     return spi_transfer(sd_card_p->spi_if.spi, tx, rx, length);
 }
 
+void sd_spi_read_start(sd_card_t *sd_card_p, uint8_t *rx, size_t length, size_t tail,
+                       uint16_t crc_seed) {
+    spi_rx_start(sd_card_p->spi_if.spi, rx, length, tail, crc_seed);
+}
+
+bool sd_spi_read_finish(sd_card_t *sd_card_p, uint8_t *tail, size_t tail_len, uint16_t *crc) {
+    return spi_rx_wait(sd_card_p->spi_if.spi, tail, tail_len, crc);
+}
+
+// Single bytes (commands, token and busy polling) are polled: setting up two
+// DMA channels and waiting for their interrupt costs far more than the byte.
 uint8_t sd_spi_write(sd_card_t *sd_card_p, const uint8_t value) {
     // TRACE_PRINTF("%s\n", __FUNCTION__);
     uint8_t received = SPI_FILL_CHAR;
-#if 0
     int num = spi_write_read_blocking(sd_card_p->spi_if.spi->hw_inst, &value, &received, 1);    
     myASSERT(1 == num);
-#else
-    bool success = spi_transfer(sd_card_p->spi_if.spi, &value, &received, 1);
-    myASSERT(success);
-#endif
     return received;
 }
 
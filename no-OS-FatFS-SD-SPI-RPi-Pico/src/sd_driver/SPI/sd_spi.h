@@ -22,11 +22,16 @@ specific language governing permissions and limitations under the License.
 tx or rx can be NULL if not important. */
 bool sd_spi_transfer(sd_card_t *sd_card_p, const uint8_t *tx, uint8_t *rx, size_t length);
 uint8_t sd_spi_write(sd_card_t *sd_card_p, const uint8_t value);
+/* Receive length bytes by DMA, then tail more (at most SPI_FIFO_DEPTH) that
+sd_spi_read_finish hands back. The data CRC16 is computed on the way. */
+void sd_spi_read_start(sd_card_t *sd_card_p, uint8_t *rx, size_t length, size_t tail, uint16_t crc_seed);
+bool sd_spi_read_finish(sd_card_t *sd_card_p, uint8_t *tail, size_t tail_len, uint16_t *crc);
 void sd_spi_deselect_pulse(sd_card_t *sd_card_p);
 void sd_spi_acquire(sd_card_t *sd_card_p);
 void sd_spi_release(sd_card_t *sd_card_p);
 void sd_spi_go_low_frequency(sd_card_t *this);
 void sd_spi_go_high_frequency(sd_card_t *this);
+uint sd_spi_set_frequency(sd_card_t *this, uint hz);
 
 /* 
 After power up, the host starts the clock and sends the initializing sequence on the CMD line. 
@@ -76,8 +76,11 @@ bool spi_transfer(spi_t *spi_p, const uint8_t *tx, uint8_t *rx, size_t length) {
         rx = &dummy;
         channel_config_set_write_increment(&spi_p->rx_dma_cfg, false);
     }
+    channel_config_set_sniff_enable(&spi_p->rx_dma_cfg, false);
     // Clear the interrupt request.
     dma_hw->ints0 = 1u << spi_p->rx_dma;
+    // spi_rx_wait polls, so its transfers leave a notification behind
+    sem_reset(&spi_p->sem, 0);
 
     dma_channel_configure(spi_p->tx_dma, &spi_p->tx_dma_cfg,
                           &spi_get_hw(spi_p->hw_inst)->dr,  // write address
@@ -116,6 +119,56 @@ bool spi_transfer(spi_t *spi_p, const uint8_t *tx, uint8_t *rx, size_t length) {
     return true;
 }
 
+// Receive length bytes into rx by DMA while sending fill bytes, without waiting.
+// tail more bytes are clocked in after them and left in the RX FIFO for
+// spi_rx_wait. The DMA sniffer runs a CRC16 (CCITT, as used by SD cards) over
+// the received data, starting from crc_seed.
+void spi_rx_start(spi_t *spi_p, uint8_t *rx, size_t length, size_t tail, uint16_t crc_seed) {
+    myASSERT(tail <= SPI_FIFO_DEPTH);
+    static const uint8_t dummy = SPI_FILL_CHAR;
+
+    channel_config_set_read_increment(&spi_p->tx_dma_cfg, false);
+    channel_config_set_write_increment(&spi_p->rx_dma_cfg, true);
+    channel_config_set_sniff_enable(&spi_p->rx_dma_cfg, true);
+    dma_sniffer_enable(spi_p->rx_dma, DMA_SNIFF_CTRL_CALC_VALUE_CRC16, false);
+    dma_hw->sniff_data = crc_seed;
+
+    dma_channel_configure(spi_p->tx_dma, &spi_p->tx_dma_cfg,
+                          &spi_get_hw(spi_p->hw_inst)->dr, &dummy,
+                          length + tail, false);
+    dma_channel_configure(spi_p->rx_dma, &spi_p->rx_dma_cfg,
+                          rx, &spi_get_hw(spi_p->hw_inst)->dr,
+                          length, false);
+    dma_start_channel_mask((1u << spi_p->tx_dma) | (1u << spi_p->rx_dma));
+}
+
+// Wait for spi_rx_start to finish and collect the tail bytes and the CRC.
+// Polls rather than waiting for the DMA interrupt: a block is over long
+// before a semaphore wake-up would pay off.
+bool spi_rx_wait(spi_t *spi_p, uint8_t *tail, size_t tail_len, uint16_t *crc) {
+    spi_inst_t *spi = spi_p->hw_inst;
+    absolute_time_t timeout_time = make_timeout_time_ms(1000);
+    while (dma_channel_is_busy(spi_p->rx_dma) || dma_channel_is_busy(spi_p->tx_dma)) {
+        if (absolute_time_diff_us(get_absolute_time(), timeout_time) <= 0) {
+            DBG_PRINTF("DMA wait timed out in %s\n", __FUNCTION__);
+            dma_channel_abort(spi_p->tx_dma);
+            dma_channel_abort(spi_p->rx_dma);
+            dma_sniffer_disable();
+            while (spi_is_busy(spi) || spi_is_readable(spi))
+                (void)spi_get_hw(spi)->dr;
+            return false;
+        }
+    }
+    for (size_t i = 0; i < tail_len; i++) {
+        while (!spi_is_readable(spi))
+            tight_loop_contents();
+        tail[i] = (uint8_t)spi_get_hw(spi)->dr;
+    }
+    *crc = (uint16_t)dma_hw->sniff_data;
+    dma_sniffer_disable();
+    return true;
+}
+
 void spi_lock(spi_t *spi_p) {
     myASSERT(mutex_is_initialized(&spi_p->mutex));
     mutex_enter_blocking(&spi_p->mutex);
@@ -26,6 +26,7 @@ specific language governing permissions and limitations under the License.
 #include "pico/types.h"
 
 #define SPI_FILL_CHAR (0xFF)
+#define SPI_FIFO_DEPTH 8
 
 // "Class" representing SPIs
 typedef struct {
@@ -62,6 +63,8 @@ extern "C" {
 // void __not_in_flash_func(spi_irq_handler)();
   
 bool __not_in_flash_func(spi_transfer)(spi_t *pSPI, const uint8_t *tx, uint8_t *rx, size_t length);  
+void spi_rx_start(spi_t *pSPI, uint8_t *rx, size_t length, size_t tail, uint16_t crc_seed);
+bool spi_rx_wait(spi_t *pSPI, uint8_t *tail, size_t tail_len, uint16_t *crc);
 void spi_lock(spi_t *pSPI);
 void spi_unlock(spi_t *pSPI);
 bool my_spi_init(spi_t *pSPI);
@@ -14,6 +14,7 @@ specific language governing permissions and limitations under the License.
 
 /* Standard includes. */
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 //
 #include "pico/mutex.h"
@@ -54,6 +55,92 @@ bool sd_card_detect(sd_card_t *sd_card_p) {
     }
 }
 
+/* Read ulSectorCount blocks, handing them to cb a chunk at a time. Drivers
+   that can read ahead overlap the next chunk with cb, otherwise (or when they
+   can't take this request) the whole buffer is filled and handed over in turn. */
+int sd_read_stream(sd_card_t *sd_card_p, uint64_t ulSectorNumber, uint32_t ulSectorCount,
+                   uint8_t *buffer, uint32_t bufferBlocks, sd_stream_cb_t cb, void *ctx) {
+    if (sd_card_p->read_stream && bufferBlocks >= 2) {
+        int rc = sd_card_p->read_stream(sd_card_p, ulSectorNumber, ulSectorCount,
+                                        buffer, bufferBlocks, cb, ctx);
+        if (rc != SD_BLOCK_DEVICE_ERROR_UNSUPPORTED)
+            return rc;
+    }
+    while (ulSectorCount) {
+        uint32_t n = ulSectorCount < bufferBlocks ? ulSectorCount : bufferBlocks;
+        int rc = sd_card_p->read_blocks(sd_card_p, buffer, ulSectorNumber, n);
+        if (rc != SD_BLOCK_DEVICE_ERROR_NONE)
+            return rc;
+        if (!cb(ctx, buffer, n))
+            break;
+        ulSectorNumber += n;
+        ulSectorCount -= n;
+    }
+    return SD_BLOCK_DEVICE_ERROR_NONE;
+}
+
+// Blocks read in each calibration pass, from the start and the middle of the card
+#define SD_CALIBRATE_BLOCKS 8
+#define SD_CALIBRATE_PASSES 8
+
+static uint32_t sd_calibrate_hash(const uint8_t *data, size_t length) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    while (length--)
+        hash = (hash ^ *data++) * 16777619u;
+    return hash;
+}
+
+static bool sd_calibrate_read(sd_card_t *sd_card_p, const sd_calibrate_ops_t *ops,
+                              uint8_t *buffer, uint32_t hash[2]) {
+    const uint64_t where[2] = {0, sd_card_p->sectors / 2};
+    for (int i = 0; i < 2; i++) {
+        if (ops->read_blocks(sd_card_p, buffer, where[i], SD_CALIBRATE_BLOCKS) != 0)
+            return false;
+        hash[i] = sd_calibrate_hash(buffer, SD_CALIBRATE_BLOCKS * _block_size);
+    }
+    return true;
+}
+
+/* Raise the data clock from base_hz (set by the caller, and known to work) as
+   far as max_hz. Blocks are read at base_hz first; a faster clock is kept only
+   if every pass reads them back the same. Failed clocks step down to the next
+   one the driver can make, all the way to base_hz. Returns the clock left set. */
+uint sd_calibrate_clock(sd_card_t *sd_card_p, const sd_calibrate_ops_t *ops, uint base_hz,
+                        uint max_hz) {
+    uint8_t *buffer = malloc(SD_CALIBRATE_BLOCKS * _block_size);
+    uint32_t ref[2], got[2];
+    if (!buffer || !sd_calibrate_read(sd_card_p, ops, buffer, ref)) {
+        free(buffer);
+        printf("%s: Test read failed, SD clock stays at %u kHz\r\n", __FUNCTION__, base_hz / 1000);
+        return ops->set_clock(sd_card_p, base_hz);
+    }
+
+    uint best = base_hz;
+    uint hz = max_hz;
+    while (hz > base_hz) {
+        uint actual = ops->set_clock(sd_card_p, hz);
+        if (actual <= base_hz)
+            break;
+        bool ok = true;
+        for (int pass = 0; ok && pass < SD_CALIBRATE_PASSES; pass++)
+            ok = sd_calibrate_read(sd_card_p, ops, buffer, got) && got[0] == ref[0] && got[1] == ref[1];
+        if (ok) {
+            best = actual;
+            break;
+        }
+        // Make sure a garbled read isn't still running before going on
+        ops->set_clock(sd_card_p, base_hz);
+        ops->abort(sd_card_p);
+        hz = actual - 1;
+    }
+    free(buffer);
+
+    if (best == base_hz && max_hz > base_hz)
+        printf("%s: No SD clock above %u kHz reads reliably, check the wiring\r\n", __FUNCTION__,
+               base_hz / 1000);
+    return ops->set_clock(sd_card_p, best);
+}
+
 bool sd_init_driver() {
     static bool initialized;
     auto_init_mutex(initialized_mutex);
@@ -48,6 +48,10 @@ typedef struct sd_spi_t {
     // GPIO_DRIVE_STRENGTH_12MA = 3 }
     bool set_drive_strength;
     enum gpio_drive_strength ss_gpio_drive_strength;
+    // Fastest SCK to try after switching the card to high speed mode (CMD6).
+    // Each step down from here is checked by reading blocks back, the first
+    // one that holds is kept. 0 (or not above spi->baud_rate) skips this.
+    uint max_baud_rate;
 } sd_spi_t;
 
 typedef struct sd_sdio_t {
@@ -60,6 +64,10 @@ typedef struct sd_sdio_t {
     uint D3_gpio;      // Must be D0 + 3
     PIO SDIO_PIO;      // either pio0 or pio1
     uint DMA_IRQ_num;  // DMA_IRQ_0 or DMA_IRQ_1
+    // Fastest PIO clock divider to try, SD clock = clk_sys / SDIO_CLK_CYCLES / divider.
+    // Each step up from here is checked by reading blocks back, the first
+    // one that holds is kept. 0 starts at the fastest clock the card allows.
+    uint clock_divider;
 
     /* The following fields are not part of the configuration. They are dynamically assigned. */
     int SDIO_DMA_CH;
@@ -70,6 +78,27 @@ typedef struct sd_sdio_t {
 
 typedef struct sd_card_t sd_card_t;
 
+// Gets each chunk of a streamed read in order, while the next one is read in.
+// Returning false ends the stream early.
+typedef bool (*sd_stream_cb_t)(void *ctx, const uint8_t *data, uint32_t blocks);
+
+// CMD6 function group 1 (access mode), function 1 is high speed (up to 50 MHz)
+#define CMD6_CHECK_HIGH_SPEED (0x00FFFFF1)
+#define CMD6_SWITCH_HIGH_SPEED (0x80FFFFF1)
+#define SD_DEFAULT_SPEED_MAX_HZ (25 * 1000 * 1000)
+#define SD_HIGH_SPEED_MAX_HZ (50 * 1000 * 1000)
+
+// Driver hooks for sd_calibrate_clock()
+typedef struct {
+    // Sets the fastest data clock the driver can make at or below hz, returns it
+    uint (*set_clock)(sd_card_t *sd_card_p, uint hz);
+    // Reads blocks at whatever clock is set, like read_blocks but without locking
+    int (*read_blocks)(sd_card_t *sd_card_p, uint8_t *buffer, uint64_t ulSectorNumber,
+                       uint32_t ulSectorCount);
+    // Ends a read that went wrong, called once the clock is back at the base clock
+    void (*abort)(sd_card_t *sd_card_p);
+} sd_calibrate_ops_t;
+
 // "Class" representing SD Cards
 struct sd_card_t {
     const char *pcName;
@@ -86,6 +115,8 @@ struct sd_card_t {
     int m_Status;                                    // Card status
     uint64_t sectors;                                // Assigned dynamically
     int card_type;                                   // Assigned dynamically
+    bool high_speed;                                 // Card switched to high speed mode
+    uint clock_hz;                                   // Data transfer clock in use
     mutex_t mutex;
     FATFS fatfs;
     bool mounted;
@@ -95,11 +126,19 @@ struct sd_card_t {
                     uint64_t ulSectorNumber, uint32_t blockCnt);
     int (*read_blocks)(sd_card_t *sd_card_p, uint8_t *buffer, uint64_t ulSectorNumber,
                     uint32_t ulSectorCount);    
+    // Optional: read ahead into halves of buffer (4 byte aligned), handing
+    // each one to cb. sd_read_stream() covers drivers without it
+    int (*read_stream)(sd_card_t *sd_card_p, uint64_t ulSectorNumber, uint32_t ulSectorCount,
+                    uint8_t *buffer, uint32_t bufferBlocks, sd_stream_cb_t cb, void *ctx);
     uint64_t (*get_num_sectors)(sd_card_t *sd_card_p);
     bool (*sd_readCID)(sd_card_t *sd_card_p, cid_t *cid);
 };
 bool sd_init_driver();
 bool sd_card_detect(sd_card_t *sd_card_p);
+int sd_read_stream(sd_card_t *sd_card_p, uint64_t ulSectorNumber, uint32_t ulSectorCount,
+                   uint8_t *buffer, uint32_t bufferBlocks, sd_stream_cb_t cb, void *ctx);
+uint sd_calibrate_clock(sd_card_t *sd_card_p, const sd_calibrate_ops_t *ops, uint base_hz,
+                        uint max_hz);
 
 #ifdef __cplusplus
 }
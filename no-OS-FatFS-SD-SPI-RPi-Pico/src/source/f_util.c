@@ -11,7 +11,7 @@ under the License is distributed on an AS IS BASIS, WITHOUT WARRANTIES OR
 CONDITIONS OF ANY KIND, either express or implied. See the License for the 
 specific language governing permissions and limitations under the License.
 */
-#include "ff.h"
+#include "f_util.h"
 
 const char *FRESULT_str(FRESULT i) {
     switch (i) {
@@ -103,3 +103,22 @@ FRESULT delete_node (
     if (fr == FR_OK) fr = f_unlink(path);  /* Delete the empty sub-directory */
     return fr;
 }
+
+/* Find the first sector of a file that is stored in one contiguous run of
+ * clusters, so it can be read from the card without going through FatFs.
+ * Needs FF_USE_FASTSEEK. Returns false for fragmented (or empty) files. */
+bool f_contiguous_lba(FIL *fp, LBA_t *lba) {
+    DWORD clmt[8];
+    fp->cltbl = clmt;
+    clmt[0] = sizeof clmt / sizeof clmt[0];
+    FRESULT fr = f_lseek(fp, CREATE_LINKMAP);
+    fp->cltbl = NULL;
+
+    /* One fragment: {size, length, start cluster, 0} */
+    if (FR_OK != fr || clmt[1] == 0 || clmt[3] != 0)
+        return false;
+
+    FATFS *fs = fp->obj.fs;
+    *lba = fs->database + (LBA_t)(clmt[2] - 2) * fs->csize;
+    return true;
+}
@@ -5,6 +5,7 @@
 #include "gfx.h"
 #include "font.h"
 #include "gfxfont.h"
+#include "st7735.h"
 
 #include "hardware/dma.h"
 
@@ -26,6 +27,19 @@ static bool gfx_dma_init = false;
 uint16_t *gfxFramebuffer = NULL;
 static bool gfxFbUpdated = false;
 
+// Dirty x range of every row (x0 > x1 when clean), and the ranges the running flush is sending
+static int16_t *gfxDirtyX0, *gfxDirtyX1;
+static int16_t *gfxFlushX0, *gfxFlushX1;
+static int16_t gfxFlushRow = -1; // Next row to send, -1 when no flush is running
+
+// With hardware scrolling the framebuffer is a ring, gfxTop is the row shown at the top
+static bool gfxRing = false;
+static bool gfxScrolled = false;
+static int16_t gfxTop = 0;
+
+// The classic font transposed to one mask per pixel row (bit n = column n), built on first use
+static uint8_t *gfxFontRows = NULL;
+
 extern uint16_t _width;	 ///< Display width as modified by current rotation
 extern uint16_t _height; ///< Display height as modified by current rotation
 
@@ -71,7 +85,13 @@ void GFX_drawPixel(int16_t x, int16_t y, uint16_t color)
 	{
 		if ((x < 0) || (y < 0) || (x >= _width) || (y >= _height))
 			return;
+		if (gfxRing && (y += gfxTop) >= _height)
+			y -= _height;
 		gfxFramebuffer[x + y * _width] = color; //(color >> 8) | (color << 8);
+		if (x < gfxDirtyX0[y])
+			gfxDirtyX0[y] = x;
+		if (x > gfxDirtyX1[y])
+			gfxDirtyX1[y] = x;
 		gfxFbUpdated = true;
 	}
 	else
@@ -155,10 +175,64 @@ void GFX_drawRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t color)
 	GFX_drawFastVLine(x + w - 1, y, h, color);
 }
 
+static bool GFX_initFontRows()
+{
+	if (gfxFontRows == NULL)
+	{
+		gfxFontRows = calloc(256 * 8, 1);
+		if (gfxFontRows == NULL)
+			return false;
+		for (int c = 0; c < 256; c++)
+		{
+			int g = c >= 176 ? c + 1 : c; // 'classic' charset behavior
+			if (g > 255)
+				continue;
+			for (int i = 0; i < 5; i++)
+				for (int j = 0; j < 8; j++)
+					if (font[g * 5 + i] & (1 << j))
+						gfxFontRows[c * 8 + j] |= 1 << i;
+		}
+	}
+	return true;
+}
+
+// Opaque 6x8 character straight into the framebuffer, two pixels per word store.
+// x has to be even so every pair is word aligned.
+static void GFX_blitChar(int16_t x, int16_t y, unsigned char c, uint16_t color, uint16_t bg)
+{
+	const uint32_t pairs[4] = {
+		bg | (uint32_t)bg << 16,
+		color | (uint32_t)bg << 16,
+		bg | (uint32_t)color << 16,
+		color | (uint32_t)color << 16};
+	const uint8_t *rows = gfxFontRows + c * 8;
+
+	if (gfxRing && (y += gfxTop) >= _height)
+		y -= _height;
+	for (int j = 0; j < 8; j++, y++)
+	{
+		if (y == _height)
+			y = 0;
+		uint32_t *p = (uint32_t *)(gfxFramebuffer + y * _width + x);
+		uint8_t m = rows[j];
+		p[0] = pairs[m & 3];
+		p[1] = pairs[(m >> 2) & 3];
+		p[2] = pairs[(m >> 4) & 3];
+		if (x < gfxDirtyX0[y])
+			gfxDirtyX0[y] = x;
+		if (x + 5 > gfxDirtyX1[y])
+			gfxDirtyX1[y] = x + 5;
+	}
+	gfxFbUpdated = true;
+}
+
 void GFX_drawChar(int16_t x, int16_t y, unsigned char c, uint16_t color,
 				  uint16_t bg, uint8_t size_x, uint8_t size_y)
 {
-	if (!gfxFont)
+	if (!gfxFont && gfxFramebuffer != NULL && size_x == 1 && size_y == 1 && bg != color &&
+		!(x & 1) && x >= 0 && y >= 0 && x + 6 <= _width && y + 8 <= _height && GFX_initFontRows())
+		GFX_blitChar(x, y, c, color, bg);
+	else if (!gfxFont)
 	{
 		if ((x >= _width) ||			  // Clip right
 			(y >= _height) ||			  // Clip bottom
@@ -447,28 +521,116 @@ void GFX_printf(const char *format, ...)
 	va_end(args);
 }
 
+// Queue rows y..y+h-1 to be sent in full on the next update
+void GFX_markDirty(int16_t y, int16_t h)
+{
+	for (int16_t i = y; i < y + h; i++)
+	{
+		gfxDirtyX0[i] = 0;
+		gfxDirtyX1[i] = _width - 1;
+	}
+	gfxFbUpdated = true;
+}
+
 void GFX_createFramebuf()
 {
 	gfxFramebuffer = malloc(_width * _height * sizeof(uint16_t));
+	gfxDirtyX0 = malloc(4 * _height * sizeof(int16_t));
+	gfxDirtyX1 = gfxDirtyX0 + _height;
+	gfxFlushX0 = gfxDirtyX1 + _height;
+	gfxFlushX1 = gfxFlushX0 + _height;
+	gfxFlushRow = -1;
+	gfxRing = false;
+	gfxTop = 0;
+	GFX_markDirty(0, _height);
+}
+
+uint16_t *GFX_getFramebuffer()
+{
+	return gfxFramebuffer;
+}
+
+// Scroll by moving the display's start row instead of the pixels, if the display can
+bool GFX_enableHwScroll()
+{
+	if (gfxFramebuffer == NULL || !LCD_initScroll())
+		return false;
+	gfxRing = true;
+	gfxTop = 0;
+	return true;
 }
 void GFX_destroyFramebuf()
 {
+	LCD_waitIdle();
 	free(gfxFramebuffer);
+	free(gfxDirtyX0);
 	gfxFramebuffer = NULL;
+	gfxDirtyX0 = gfxDirtyX1 = gfxFlushX0 = gfxFlushX1 = NULL;
+}
+
+// Sends the next piece of a running flush once the display is free. A run of
+// whole dirty rows is contiguous in the framebuffer and goes out in one
+// transfer, other rows go out one at a time, covering just their dirty range.
+static void GFX_pump()
+{
+	if (gfxFlushRow < 0 || LCD_busy())
+		return;
+
+	int16_t y = gfxFlushRow;
+	while (y < _height && gfxFlushX0[y] > gfxFlushX1[y])
+		y++;
+	if (y >= _height)
+	{
+		gfxFlushRow = -1;
+		return;
+	}
+
+	if (gfxFlushX0[y] == 0 && gfxFlushX1[y] == _width - 1)
+	{
+		int16_t end = y + 1;
+		while (end < _height && gfxFlushX0[end] == 0 && gfxFlushX1[end] == _width - 1)
+			end++;
+		LCD_WriteBitmapAsync(0, y, _width, end - y, gfxFramebuffer + y * _width);
+		gfxFlushRow = end;
+	}
+	else
+	{
+		int16_t x = gfxFlushX0[y];
+		LCD_WriteBitmapAsync(x, y, gfxFlushX1[y] - x + 1, 1, gfxFramebuffer + y * _width + x);
+		gfxFlushRow = y + 1;
+	}
 }
 
+// Starts sending whatever changed since the last flush and returns, GFX_Update()
+// carries it on (anything drawn after the start goes out with the next flush)
 void GFX_flush()
 {
-	if (gfxFramebuffer != NULL)
+	if (gfxFramebuffer == NULL || gfxFlushRow >= 0)
+		return;
+
+	for (int16_t y = 0; y < _height; y++)
+	{
+		gfxFlushX0[y] = gfxDirtyX0[y];
+		gfxFlushX1[y] = gfxDirtyX1[y];
+		gfxDirtyX0[y] = _width;
+		gfxDirtyX1[y] = -1;
+	}
+	gfxFbUpdated = false;
+	gfxFlushRow = 0;
+
+	if (gfxScrolled)
 	{
-		LCD_WriteBitmap(0, 0, _width, _height, gfxFramebuffer);
-		gfxFbUpdated = false;
+		LCD_scrollTo(gfxTop);
+		gfxScrolled = false;
 	}
+	GFX_pump();
 }
 
+// Call often, moves a running flush along and starts a new one when something changed
 void GFX_Update()
 {
-	if(gfxFbUpdated)
+	GFX_pump();
+	if (gfxFbUpdated && gfxFlushRow < 0 && !LCD_busy())
 		GFX_flush();
 }
 
@@ -531,7 +693,24 @@ void dma_memcpy(void *dest, void *src, size_t num)
 
 void GFX_scrollUp(int n)
 {	
-	if (gfxFramebuffer)
+	if (gfxFramebuffer && gfxRing)
+	{
+		if (n > _height)
+			n = _height;
+
+		// The rows leaving the top come back in at the bottom, cleared
+		for (int i = 0; i < n; i++)
+		{
+			int16_t row = (gfxTop + i) % _height;
+			dma_memset(gfxFramebuffer + row * _width, 0, 2 * _width);
+			gfxDirtyX0[row] = 0;
+			gfxDirtyX1[row] = _width - 1;
+		}
+		gfxTop = (gfxTop + n) % _height;
+		gfxScrolled = true;
+		gfxFbUpdated = true;
+	}
+	else if (gfxFramebuffer)
 	{
 		if(n > _height)
 			n = _height;
@@ -541,6 +720,7 @@ void GFX_scrollUp(int n)
 	
 		dma_memcpy(gfxFramebuffer, src, 2* linesCopy);
 		dma_memset(gfxFramebuffer+linesCopy, 0, 2* linesFill);
+		GFX_markDirty(0, _height);
 
 	}
 }
\ No newline at end of file
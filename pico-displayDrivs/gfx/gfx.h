@@ -9,6 +9,8 @@
 
 void GFX_createFramebuf();
 void GFX_destroyFramebuf();
+uint16_t *GFX_getFramebuffer();
+void GFX_markDirty(int16_t y, int16_t h);
 
 void GFX_drawPixel(int16_t x, int16_t y, uint16_t color);
 
@@ -37,6 +39,7 @@ void GFX_printf(const char *format, ...);
 void GFX_flush();
 void GFX_Update();
 void GFX_scrollUp(int n);
+bool GFX_enableHwScroll();
 
 uint GFX_getWidth();
 uint GFX_getHeight();
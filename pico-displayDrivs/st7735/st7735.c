@@ -1,6 +1,10 @@
 #include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
 
 #include "st7735.h"
+#include "st7735_spi.pio.h"
 
 uint16_t _colstart = 0, _rowstart = 0, _colstart2 = 0, _rowstart2 = 0;
 
@@ -13,6 +17,11 @@ int16_t _xstart = 0; ///< Internal framebuffer X offset
 int16_t _ystart = 0; ///< Internal framebuffer Y offset
 
 uint8_t rotation;
+static uint8_t lcd_madctl;
+
+// Frame memory lines, hardware scrolling works on these rather than on the visible rows
+#define ST7735_MEMORY_LINES 162
+static int16_t lcd_scroll_tfa = -1; // Top fixed area, -1 while not scrolling
 
 uint16_t st7735_pinCS;
 uint16_t st7735_pinDC;
@@ -160,27 +169,47 @@ const uint8_t Bcmd[] = {			  // Init commands for 7735B screens
 		ST77XX_DISPON, ST_CMD_DELAY,												//  4: Main screen turn on, no args w/delay
 		100};																		//    10 ms delay
 
-#define lcd_spi_set_mosi(value) gpio_put(st7735_pinTX, value)
+// The SPI lines are driven by a PIO state machine, pixel data is fed to it by DMA
+static PIO lcd_pio;
+static uint lcd_sm;
+static int lcd_dma;
+static uint lcd_bits = 8;		 // Current autopull threshold
+static bool lcd_dma_pending;	 // A bitmap transfer was started and not yet finished
+
+// True once every queued bit is out on the wire
+static bool lcd_pio_idle(void)
+{
+	uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + lcd_sm);
+	return pio_sm_is_tx_fifo_empty(lcd_pio, lcd_sm) && (lcd_pio->fdebug & stall);
+}
 
-#define lcd_spi_pulse_sck()                \
-    {                                  \
-        asm("nop");                    \
-        gpio_put(st7735_pinSCK, 1); \
-        asm("nop");                    \
-        gpio_put(st7735_pinSCK, 0); \
-    }
+static void lcd_pio_wait_idle(void)
+{
+	uint32_t stall = 1u << (PIO_FDEBUG_TXSTALL_LSB + lcd_sm);
+	lcd_pio->fdebug = stall;
+	while (!lcd_pio_idle())
+		tight_loop_contents();
+}
+
+// Autopull threshold, only changed while the state machine is idle. The
+// stalled out would otherwise compare its leftover shift count against the new
+// threshold and send stale bits, so the restart empties the OSR first
+static void lcd_set_bits(uint bits)
+{
+	if (bits == lcd_bits)
+		return;
+	lcd_pio_wait_idle();
+	hw_write_masked(&lcd_pio->sm[lcd_sm].shiftctrl, (bits & 0x1f) << PIO_SM0_SHIFTCTRL_PULL_THRESH_LSB,
+					PIO_SM0_SHIFTCTRL_PULL_THRESH_BITS);
+	pio_sm_restart(lcd_pio, lcd_sm);
+	lcd_bits = bits;
+}
 
 void lcd_spi_tx_array(const uint8_t *data, size_t size)
 {
-    for (size_t i = 0; i < size; i++)
-    {
-        uint8_t byte = data[i];
-        for (int j = 7; j >= 0; j--)
-        {
-            lcd_spi_set_mosi((byte >> j) & 0x01);
-            lcd_spi_pulse_sck();
-        }
-    }
+	lcd_set_bits(8);
+	for (size_t i = 0; i < size; i++)
+		pio_sm_put_blocking(lcd_pio, lcd_sm, (uint32_t)data[i] << 24);
 }
 
 void LCD_setPins(uint16_t dc, uint16_t cs, int16_t rst, uint16_t sck, uint16_t tx)
@@ -194,16 +223,24 @@ void LCD_setPins(uint16_t dc, uint16_t cs, int16_t rst, uint16_t sck, uint16_t t
 
 void initSPI()
 {
-	// spi_init(st7735_spi, 1000 * 50000);
-	// spi_set_format(st7735_spi, 16, SPI_CPOL_1, SPI_CPOL_1, SPI_MSB_FIRST);
-	// gpio_set_function(st7735_pinTX, GPIO_FUNC_SPI);
-	// gpio_set_function(st7735_pinSCK, GPIO_FUNC_SPI);
-
-	gpio_init(st7735_pinTX);
-    gpio_init(st7735_pinSCK);
-
-	gpio_set_dir(st7735_pinTX, GPIO_OUT);
-    gpio_set_dir(st7735_pinSCK, GPIO_OUT);
+	lcd_pio = pio0;
+	if (!pio_can_add_program(lcd_pio, &st7735_spi_program))
+		lcd_pio = pio1;
+	uint offset = pio_add_program(lcd_pio, &st7735_spi_program);
+	lcd_sm = pio_claim_unused_sm(lcd_pio, true);
+
+	// Two PIO cycles per bit
+	float div = (float)clock_get_hz(clk_sys) / (2 * 1000 * 1000 * ST7735_SPI_MHZ);
+	st7735_spi_program_init(lcd_pio, lcd_sm, offset, st7735_pinTX, st7735_pinSCK, div < 1 ? 1 : div);
+
+	// 16 bit pixels, written to the FIFO as a halfword the DMA repeats in both halves
+	lcd_dma = dma_claim_unused_channel(true);
+	dma_channel_config c = dma_channel_get_default_config(lcd_dma);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_dreq(&c, pio_get_dreq(lcd_pio, lcd_sm, true));
+	dma_channel_configure(lcd_dma, &c, &lcd_pio->txf[lcd_sm], NULL, 0, false);
 
 	gpio_init(st7735_pinCS);
 	gpio_set_dir(st7735_pinCS, GPIO_OUT);
@@ -231,23 +268,45 @@ void ST7735_Reset()
 	}
 }
 
+// Wait for a bitmap started with LCD_WriteBitmapAsync to finish and release the bus
+void LCD_waitIdle()
+{
+	if (!lcd_dma_pending)
+		return;
+	dma_channel_wait_for_finish_blocking(lcd_dma);
+	lcd_pio_wait_idle();
+	gpio_put(st7735_pinCS, 1);
+	lcd_dma_pending = false;
+}
+
+bool LCD_busy()
+{
+	if (lcd_dma_pending && !dma_channel_is_busy(lcd_dma) && lcd_pio_idle())
+		LCD_waitIdle();
+	return lcd_dma_pending;
+}
+
 void ST7735_Select()
 {
+	LCD_waitIdle();
 	gpio_put(st7735_pinCS, 0);
 }
 
 void ST7735_DeSelect()
 {
+	lcd_pio_wait_idle();
 	gpio_put(st7735_pinCS, 1);
 }
 
 void ST7735_RegCommand()
 {
+	lcd_pio_wait_idle();
 	gpio_put(st7735_pinDC, 0);
 }
 
 void ST7735_RegData()
 {
+	lcd_pio_wait_idle();
 	gpio_put(st7735_pinDC, 1);
 }
 
@@ -431,6 +490,43 @@ void LCD_setRotation(uint8_t m)
 		break;
 	}
 	ST7735_SendCommand(ST77XX_MADCTL, &madctl, 1);
+	lcd_madctl = madctl;
+
+	// Back to normal mode, the scroll area no longer matches
+	if (lcd_scroll_tfa >= 0)
+	{
+		ST7735_SendCommand(ST77XX_NORON, NULL, 0);
+		lcd_scroll_tfa = -1;
+	}
+}
+
+// Vertical scrolling moves along the frame memory lines, which are the rows of the
+// portrait rotations (0 and 2). Only 160 row panels are handled. With MY set the
+// rows are stored bottom up, so the scroll area sits at the other end of the memory.
+bool LCD_initScroll()
+{
+	if ((lcd_madctl & ST77XX_MADCTL_MV) || _height != ST7735_TFTHEIGHT_160)
+		return false;
+
+	uint16_t tfa = (lcd_madctl & ST77XX_MADCTL_MY) ? ST7735_MEMORY_LINES - _ystart - _height : _ystart;
+	uint16_t bfa = ST7735_MEMORY_LINES - tfa - _height;
+	uint8_t data[6] = {tfa >> 8, tfa, _height >> 8, _height, bfa >> 8, bfa};
+	ST7735_SendCommand(ST77XX_VSCRDEF, data, sizeof(data));
+	lcd_scroll_tfa = tfa;
+
+	LCD_scrollTo(0);
+	return true;
+}
+
+// Show row top of the frame at the top of the screen, the rows below it wrap around
+void LCD_scrollTo(uint16_t top)
+{
+	if (lcd_scroll_tfa < 0)
+		return;
+
+	uint16_t ssa = lcd_scroll_tfa + ((lcd_madctl & ST77XX_MADCTL_MY) ? (_height - top) % _height : top);
+	uint8_t data[2] = {ssa >> 8, ssa};
+	ST7735_SendCommand(ST77XX_VSCRSADD, data, sizeof(data));
 }
 
 void LCD_initDisplay(uint8_t options)
@@ -516,23 +612,23 @@ void ST7735_setAddrWindow(uint16_t x, uint16_t y, uint16_t w, uint16_t h)
 	ST7735_WriteCommand(ST77XX_RAMWR);
 }
 
-void LCD_WriteBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t *bitmap)
+// Starts sending the bitmap and returns, it must stay untouched until LCD_busy() is false
+void LCD_WriteBitmapAsync(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t *bitmap)
 {
 	ST7735_Select();
 	ST7735_setAddrWindow(x, y, w, h); // Clipped area
 	ST7735_RegData();
-	
-	for (size_t i = 0; i < w * h; i++)
-    {
-        uint16_t byte = bitmap[i];
-        for (int j = 15; j >= 0; j--)
-        {
-            lcd_spi_set_mosi((byte >> j) & 0x01);
-            lcd_spi_pulse_sck();
-        }
-    }
-	
-	ST7735_DeSelect();
+
+	lcd_set_bits(16);
+	lcd_pio->fdebug = 1u << (PIO_FDEBUG_TXSTALL_LSB + lcd_sm);
+	dma_channel_transfer_from_buffer_now(lcd_dma, bitmap, w * h);
+	lcd_dma_pending = true;
+}
+
+void LCD_WriteBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t *bitmap)
+{
+	LCD_WriteBitmapAsync(x, y, w, h, bitmap);
+	LCD_waitIdle();
 }
 
 void LCD_WritePixel(int x, int y, uint16_t col)
@@ -540,12 +636,8 @@ void LCD_WritePixel(int x, int y, uint16_t col)
 	ST7735_Select();
 	ST7735_setAddrWindow(x, y, 1, 1); // Clipped area
 	ST7735_RegData();
-	
-	uint16_t byte = col;
-	for (int j = 15; j >= 0; j--)
-	{
-		lcd_spi_set_mosi((byte >> j) & 0x01);
-		lcd_spi_pulse_sck();
-	}
+
+	lcd_set_bits(16);
+	pio_sm_put_blocking(lcd_pio, lcd_sm, (uint32_t)col << 16);
 	ST7735_DeSelect();
-}
\ No newline at end of file
+}
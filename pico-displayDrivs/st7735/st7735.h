@@ -2,6 +2,11 @@
 #define ST7735_H
 #include "pico/stdlib.h"
 
+// SPI clock for the display (in MHz), the ST7735 is specified up to 15 but most run far faster
+#ifndef ST7735_SPI_MHZ
+#define ST7735_SPI_MHZ 31
+#endif
+
 #define ST7735_TFTWIDTH_128 128  // for 1.44 and mini
 #define ST7735_TFTWIDTH_80 80    // for mini
 #define ST7735_TFTHEIGHT_128 128 // for 1.44" display
@@ -62,9 +67,11 @@
 #define ST77XX_RAMRD 0x2E
 
 #define ST77XX_PTLAR 0x30
+#define ST77XX_VSCRDEF 0x33
 #define ST77XX_TEOFF 0x34
 #define ST77XX_TEON 0x35
 #define ST77XX_MADCTL 0x36
+#define ST77XX_VSCRSADD 0x37
 #define ST77XX_COLMOD 0x3A
 
 #define ST77XX_MADCTL_MY 0x80
@@ -93,7 +100,12 @@ void LCD_setPins(uint16_t dc, uint16_t cs, int16_t rst, uint16_t sck, uint16_t t
 void LCD_initDisplay(uint8_t options);
 
 void LCD_setRotation(uint8_t m);
+bool LCD_initScroll();
+void LCD_scrollTo(uint16_t top);
 
 void LCD_WriteBitmap(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t *bitmap);
+void LCD_WriteBitmapAsync(uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint16_t *bitmap);
+bool LCD_busy();
+void LCD_waitIdle();
 void LCD_WritePixel(int x, int y, uint16_t col);
 #endif
@@ -2,28 +2,68 @@
 #include "pico/stdlib.h"
 
 #include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
 
-#define BUFFER_SIZE 45
+#include "ps2_rx.pio.h"
 
+// PIO sample rate, slow enough to ride out ringing on the clock edges
+#define PS2_PIO_HZ 1000000
+
+// Scancodes (set 2)
+#define SC_EXTENDED 0xE0
+#define SC_PAUSE 0xE1
+#define SC_BREAK 0xF0
+#define SC_ACK 0xFA
+#define SC_RESEND 0xFE
+#define SC_BAT_OK 0xAA
+
+#define SC_LSHIFT 0x12
+#define SC_RSHIFT 0x59
+#define SC_CTRL 0x14
+#define SC_ALT 0x11
+#define SC_CAPSLOCK 0x58
+#define SC_NUMLOCK 0x77
+#define SC_SCROLLLOCK 0x7E
+
+// Commands to the keyboard
+#define CMD_SET_LEDS 0xED
+
+// Receiver state
 #define BREAK 0x01
-#define MODIFIER 0x02
-#define SHIFT_L 0x04
-#define SHIFT_R 0x08
-#define ALTGR 0x10
+#define EXTENDED 0x02
+
+// Held modifiers
+#define SHIFT_L 0x01
+#define SHIFT_R 0x02
+#define CTRL_L 0x04
+#define CTRL_R 0x08
+#define ALT_L 0x10
+#define ALTGR 0x20
 
 int ps2DataPin;
 int ps2ClkPin;
 
-volatile uint8_t buffer[BUFFER_SIZE];
-volatile uint8_t head = 0, tail = 0;
-uint8_t CharBuffer = 0;
-uint8_t UTF8next = 0;
-PS2Keymap_t *keymap = &PS2Keymap_US;
+static PIO ps2_pio;
+static uint ps2_sm;
+
+static uint8_t state = 0;
+static uint8_t modifiers = 0;
+static uint8_t locks = 0; // PS2_LOCK_* bits, which is also the LED command byte
+static uint8_t pauseSkip = 0;
+static bool capsHeld = false, numHeld = false, scrollHeld = false;
+
+// LED update in flight: 1 after CMD_SET_LEDS, 2 after the LED byte
+static uint8_t ledStage = 0;
+static uint8_t lastSent;
+
+static int pendingKey = -1;
+PS2Keymap_t *keymap = (PS2Keymap_t *)&PS2Keymap_US;
 
 const PS2Keymap_t PS2Keymap_US = {
 	// without shift
-	{0, PS2_F9, 0, PS2_F5, PS2_F3, PS2_F1, PS2_F2, PS2_F12,
-	 0, PS2_F10, PS2_F8, PS2_F6, PS2_F4, PS2_TAB, '`', 0,
+	{0, 0 /*F9*/, 0, 0 /*F5*/, 0 /*F3*/, 0 /*F1*/, 0 /*F2*/, 0 /*F12*/,
+	 0, 0 /*F10*/, 0 /*F8*/, 0 /*F6*/, 0 /*F4*/, PS2_TAB, '`', 0,
 	 0, 0 /*Lalt*/, 0 /*Lshift*/, 0, 0 /*Lctrl*/, 'q', '1', 0,
 	 0, 0, 'z', 's', 'a', 'w', '2', 0,
 	 0, 'c', 'x', 'd', 'e', '4', '3', 0,
@@ -37,11 +77,11 @@ const PS2Keymap_t PS2Keymap_US = {
 	 0, 0, 0, 0, 0, 0, PS2_BACKSPACE, 0,
 	 0, '1', 0, '4', '7', 0, 0, 0,
 	 '0', '.', '2', '5', '6', '8', PS2_ESC, 0 /*NumLock*/,
-	 PS2_F11, '+', '3', '-', '*', '9', PS2_SCROLL, 0,
-	 0, 0, 0, PS2_F7},
+	 0 /*F11*/, '+', '3', '-', '*', '9', 0 /*ScrollLock*/, 0,
+	 0, 0, 0, 0 /*F7*/},
 	// with shift
-	{0, PS2_F9, 0, PS2_F5, PS2_F3, PS2_F1, PS2_F2, PS2_F12,
-	 0, PS2_F10, PS2_F8, PS2_F6, PS2_F4, PS2_SHIFT_TAB, '~', 0,
+	{0, 0 /*F9*/, 0, 0 /*F5*/, 0 /*F3*/, 0 /*F1*/, 0 /*F2*/, 0 /*F12*/,
+	 0, 0 /*F10*/, 0 /*F8*/, 0 /*F6*/, 0 /*F4*/, PS2_TAB, '~', 0,
 	 0, 0 /*Lalt*/, 0 /*Lshift*/, 0, 0 /*Lctrl*/, 'Q', '!', 0,
 	 0, 0, 'Z', 'S', 'A', 'W', '@', 0,
 	 0, 'C', 'X', 'D', 'E', '$', '#', 0,
@@ -55,228 +95,302 @@ const PS2Keymap_t PS2Keymap_US = {
 	 0, 0, 0, 0, 0, 0, PS2_BACKSPACE, 0,
 	 0, '1', 0, '4', '7', 0, 0, 0,
 	 '0', '.', '2', '5', '6', '8', PS2_ESC, 0 /*NumLock*/,
-	 PS2_F11, '+', '3', '-', '*', '9', PS2_SCROLL, 0,
-	 0, 0, 0, PS2_F7},
+	 0 /*F11*/, '+', '3', '-', '*', '9', 0 /*ScrollLock*/, 0,
+	 0, 0, 0, 0 /*F7*/},
 	0};
 
-void ps2_gpio_callback(uint gpio, uint32_t events)
+static bool ps2_wait(uint pin, bool level, uint32_t timeout_us)
 {
-	if (gpio == ps2ClkPin)
-	{
-		static uint8_t bitcount = 0;
-		static uint8_t incoming = 0;
-		static uint32_t prev_ms = 0;
-		uint32_t now_ms;
-		uint8_t n, val;
+	uint32_t start = time_us_32();
+	while (gpio_get(pin) != level)
+		if (time_us_32() - start > timeout_us)
+			return false;
+	return true;
+}
 
-		val = gpio_get(ps2DataPin);
+static inline void ps2_drive(uint pin, bool level)
+{
+	// Open drain: pull low or let the pull-up have it
+	gpio_set_dir(pin, level ? GPIO_IN : GPIO_OUT);
+}
 
-		now_ms = to_ms_since_boot(get_absolute_time());
+// Host to keyboard transfer, bit-banged with the receiver stopped. Takes
+// about a millisecond, the keyboard answers through the receiver.
+static bool ps2_send(uint8_t b)
+{
+	bool ok = false;
+	uint8_t parity = 1;
 
-		if (now_ms - prev_ms > 250)
-		{
-			bitcount = 0;
-			incoming = 0;
-		}
-		prev_ms = now_ms;
+	lastSent = b;
+	pio_sm_set_enabled(ps2_pio, ps2_sm, false);
 
-		n = bitcount - 1;
-		if (n <= 7)
-		{
-			incoming |= (val << n);
-		}
-		bitcount++;
-		if (bitcount == 11)
-		{
-			uint8_t i = head + 1;
-			if (i >= BUFFER_SIZE)
-				i = 0;
-			if (i != tail)
-			{
-				buffer[i] = incoming;
-				head = i;
-			}
-			bitcount = 0;
-			incoming = 0;
-		}
+	// Inhibit, then request to send: DATA low (the start bit) and release the clock
+	ps2_drive(ps2ClkPin, false);
+	sleep_us(120);
+	ps2_drive(ps2DataPin, false);
+	ps2_drive(ps2ClkPin, true);
+
+	// The keyboard reads each bit on the rising edge, the next one goes out while the clock is low
+	if (!ps2_wait(ps2ClkPin, 0, 15000))
+		goto done;
+	for (int i = 0; i < 10; i++)
+	{
+		bool bit = i < 8 ? (b >> i) & 1 : i == 8 ? parity : 1;
+		parity ^= i < 8 ? bit : 0;
+		ps2_drive(ps2DataPin, bit);
+		if (!ps2_wait(ps2ClkPin, 1, 2000) || !ps2_wait(ps2ClkPin, 0, 2000))
+			goto done;
 	}
+
+	// The keyboard acknowledges by holding DATA low for one clock
+	ok = ps2_wait(ps2DataPin, 0, 2000) && ps2_wait(ps2ClkPin, 1, 2000) && ps2_wait(ps2DataPin, 1, 2000);
+
+done:
+	ps2_drive(ps2DataPin, true);
+	ps2_drive(ps2ClkPin, true);
+	pio_sm_restart(ps2_pio, ps2_sm);
+	pio_sm_set_enabled(ps2_pio, ps2_sm, true);
+	return ok;
 }
 
-uint8_t get_scan_code(void)
+static void ps2_updateLeds(void)
 {
-	uint8_t c, i;
-
-	i = tail;
-	if (i == head)
-		return 0;
-	i++;
-	if (i >= BUFFER_SIZE)
-		i = 0;
-	c = buffer[i];
-	tail = i;
-	return c;
+	ledStage = ps2_send(CMD_SET_LEDS) ? 1 : 0;
 }
 
-char get_iso8859_code(void)
+// Replies to our own commands, true if the byte was one
+static bool ps2_reply(uint8_t s)
 {
-	static uint8_t state = 0;
-	uint8_t s;
-	char c;
+	if (s == SC_ACK && ledStage == 1)
+	{
+		ledStage = ps2_send(locks) ? 2 : 0;
+		return true;
+	}
+	if (s == SC_ACK)
+	{
+		ledStage = 0;
+		return true;
+	}
+	if (s == SC_RESEND && ledStage)
+	{
+		if (!ps2_send(lastSent))
+			ledStage = 0;
+		return true;
+	}
+	if (s == SC_BAT_OK)
+	{
+		// Keyboard (re)connected, it comes up with its LEDs off
+		if (locks)
+			ps2_updateLeds();
+		return true;
+	}
+	return false;
+}
 
-	while (1)
+// Keys that move the cursor, extended or on the keypad with NumLock off
+static int ps2_navKey(uint8_t s)
+{
+	switch (s)
 	{
-		s = get_scan_code();
-		if (!s)
-			return 0;
-		if (s == 0xF0)
-		{
-			state |= BREAK;
-		}
-		else if (s == 0xE0)
-		{
-			state |= MODIFIER;
-		}
-		else
-		{
-			if (state & BREAK)
-			{
-				if (s == 0x12)
-				{
-					state &= ~SHIFT_L;
-				}
-				else if (s == 0x59)
-				{
-					state &= ~SHIFT_R;
-				}
-				else if (s == 0x11 && (state & MODIFIER))
-				{
-					state &= ~ALTGR;
-				}
-				// CTRL, ALT & WIN keys could be added
-				// but is that really worth the overhead?
-				state &= ~(BREAK | MODIFIER);
-				continue;
-			}
-			if (s == 0x12)
-			{
-				state |= SHIFT_L;
-				continue;
-			}
-			else if (s == 0x59)
-			{
-				state |= SHIFT_R;
-				continue;
-			}
-			else if (s == 0x11 && (state & MODIFIER))
-			{
-				state |= ALTGR;
-			}
-			c = 0;
-			if (state & MODIFIER)
-			{
-				switch (s)
-				{
-				case 0x70:
-					c = PS2_INSERT;
-					break;
-				case 0x6C:
-					c = PS2_HOME;
-					break;
-				case 0x7D:
-					c = PS2_PAGEUP;
-					break;
-				case 0x71:
-					c = PS2_DELETE;
-					break;
-				case 0x69:
-					c = PS2_END;
-					break;
-				case 0x7A:
-					c = PS2_PAGEDOWN;
-					break;
-				case 0x75:
-					c = PS2_UPARROW;
-					break;
-				case 0x6B:
-					c = PS2_LEFTARROW;
-					break;
-				case 0x72:
-					c = PS2_DOWNARROW;
-					break;
-				case 0x74:
-					c = PS2_RIGHTARROW;
-					break;
-				case 0x4A:
-					c = '/';
-					break;
-				case 0x5A:
-					c = PS2_ENTER;
-					break;
-				default:
-					break;
-				}
-			}
-			else if ((state & ALTGR) && keymap->uses_altgr)
-			{
-				if (s < PS2_KEYMAP_SIZE)
-					c = keymap->altgr[s]; // pgm_read_byte(keymap->altgr + s);
-			}
-			else if (state & (SHIFT_L | SHIFT_R))
-			{
-				if (s < PS2_KEYMAP_SIZE)
-					c = keymap->shift[s]; // pgm_read_byte(keymap->shift + s);
-			}
-			else
-			{
-				if (s < PS2_KEYMAP_SIZE)
-					c = keymap->noshift[s]; // pgm_read_byte(keymap->noshift + s);
-			}
-			state &= ~(BREAK | MODIFIER);
-			if (c)
-				return c;
-		}
+	case 0x75:
+		return PS2_KEY_UP;
+	case 0x72:
+		return PS2_KEY_DOWN;
+	case 0x74:
+		return PS2_KEY_RIGHT;
+	case 0x6B:
+		return PS2_KEY_LEFT;
+	case 0x6C:
+		return PS2_KEY_HOME;
+	case 0x69:
+		return PS2_KEY_END;
+	case 0x70:
+		return PS2_KEY_INSERT;
+	case 0x71:
+		return PS2_KEY_DELETE;
+	case 0x7D:
+		return PS2_KEY_PAGEUP;
+	case 0x7A:
+		return PS2_KEY_PAGEDOWN;
 	}
+	return 0;
 }
 
-uint8_t PS2_keyAvailable(void)
+static int ps2_functionKey(uint8_t s)
 {
-	if (CharBuffer || UTF8next)
-		return 1;
-	CharBuffer = get_iso8859_code();
-	if (CharBuffer)
-		return 1;
+	static const uint8_t codes[12] = {0x05, 0x06, 0x04, 0x0C, 0x03, 0x0B, 0x83, 0x0A, 0x01, 0x09, 0x78, 0x07};
+	for (int i = 0; i < 12; i++)
+		if (codes[i] == s)
+			return PS2_KEY_F1 + i;
 	return 0;
 }
 
-int PS2_readKey()
+static int ps2_modFlags(void)
 {
-	uint8_t result;
+	return (modifiers & (SHIFT_L | SHIFT_R) ? PS2_MOD_SHIFT : 0) |
+		   (modifiers & (CTRL_L | CTRL_R) ? PS2_MOD_CTRL : 0) |
+		   (modifiers & ALT_L ? PS2_MOD_ALT : 0);
+}
 
-	result = UTF8next;
-	if (result)
+// Runs one scancode through the keyboard state machine, returns the key or -1
+static int ps2_scancode(uint8_t s)
+{
+	if (pauseSkip)
 	{
-		UTF8next = 0;
+		// Pause sends E1 14 77 E1 F0 14 F0 77 and no break
+		pauseSkip--;
+		return -1;
 	}
-	else
+	if (ps2_reply(s))
+		return -1;
+	if (s == SC_PAUSE)
 	{
-		result = CharBuffer;
-		if (result)
-		{
-			CharBuffer = 0;
-		}
-		else
+		pauseSkip = 7;
+		return -1;
+	}
+	if (s == SC_EXTENDED)
+	{
+		state |= EXTENDED;
+		return -1;
+	}
+	if (s == SC_BREAK)
+	{
+		state |= BREAK;
+		return -1;
+	}
+
+	bool make = !(state & BREAK);
+	bool extended = state & EXTENDED;
+	state = 0;
+
+	// Modifiers and locks
+	uint8_t mod = 0;
+	if (s == SC_LSHIFT && !extended)
+		mod = SHIFT_L;
+	else if (s == SC_RSHIFT && !extended)
+		mod = SHIFT_R;
+	else if (s == SC_CTRL)
+		mod = extended ? CTRL_R : CTRL_L;
+	else if (s == SC_ALT)
+		mod = extended ? ALTGR : ALT_L;
+	else if (s == SC_LSHIFT || s == SC_RSHIFT)
+		return -1; // Fake shifts around the extended keys
+	if (mod)
+	{
+		modifiers = make ? modifiers | mod : modifiers & ~mod;
+		return -1;
+	}
+
+	bool *held = s == SC_CAPSLOCK ? &capsHeld : s == SC_NUMLOCK && !extended ? &numHeld : s == SC_SCROLLLOCK ? &scrollHeld : NULL;
+	if (held)
+	{
+		// Toggle once per press, not on every typematic repeat
+		if (make && !*held)
 		{
-			result = get_iso8859_code();
+			locks ^= s == SC_CAPSLOCK ? PS2_LOCK_CAPS : s == SC_NUMLOCK ? PS2_LOCK_NUM : PS2_LOCK_SCROLL;
+			ps2_updateLeds();
 		}
-		if (result >= 128)
+		*held = make;
+		return -1;
+	}
+
+	if (!make)
+		return -1;
+
+	int flags = ps2_modFlags();
+	int key = ps2_functionKey(s);
+	if (key)
+		return key | flags;
+
+	if (extended)
+	{
+		if (s == 0x4A)
+			return '/' | flags;
+		if (s == 0x5A)
+			return PS2_ENTER | flags;
+		key = ps2_navKey(s);
+		return key ? key | flags : -1;
+	}
+
+	// The keypad moves the cursor with NumLock off (its 5 does nothing then)
+	if (!(locks & PS2_LOCK_NUM) && (ps2_navKey(s) || s == 0x73))
+	{
+		key = ps2_navKey(s);
+		return key ? key | flags : -1;
+	}
+
+	if (s >= PS2_KEYMAP_SIZE)
+		return -1;
+
+	uint8_t c;
+	bool shift = modifiers & (SHIFT_L | SHIFT_R);
+	if ((modifiers & ALTGR) && keymap->uses_altgr)
+		c = keymap->altgr[s];
+	else
+		c = shift ? keymap->shift[s] : keymap->noshift[s];
+	if (!c)
+		return -1;
+
+	// CapsLock flips the case of letters only
+	if ((locks & PS2_LOCK_CAPS) && ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')))
+		c ^= 0x20;
+
+	if (modifiers & (CTRL_L | CTRL_R))
+	{
+		if ((c >= '@' && c <= '_') || (c >= 'a' && c <= 'z'))
+			c &= 0x1F;
+		else if (c == ' ' || c == '2')
+			c = 0;
+		else if (c == '/' || c == '-')
+			c = 0x1F;
+		else if (c == '6')
+			c = 0x1E;
+	}
+
+	return c | flags;
+}
+
+// Frames the PIO has collected, checked for start, stop and odd parity
+static int ps2_decode(void)
+{
+	while (!pio_sm_is_rx_fifo_empty(ps2_pio, ps2_sm))
+	{
+		uint32_t frame = pio_sm_get(ps2_pio, ps2_sm) >> (32 - PS2_FRAME_BITS);
+		uint8_t s = frame >> 1;
+
+		if ((frame & 1) || !(frame >> 10) || !(__builtin_popcount(frame & 0x3FE) & 1))
 		{
-			UTF8next = (result & 0x3F) | 0x80;
-			result = ((result >> 6) & 0x1F) | 0xC0;
+			// Out of step with the keyboard, start over at the next frame and drop the half-seen key
+			pio_sm_restart(ps2_pio, ps2_sm);
+			state = 0;
+			continue;
 		}
+
+		int key = ps2_scancode(s);
+		if (key >= 0)
+			return key;
 	}
-	if (!result)
-		return -1;
-	return result;
+	return -1;
+}
+
+uint8_t PS2_keyAvailable(void)
+{
+	if (pendingKey < 0)
+		pendingKey = ps2_decode();
+	return pendingKey >= 0;
+}
+
+int PS2_readKey()
+{
+	PS2_keyAvailable();
+	int key = pendingKey;
+	pendingKey = -1;
+	return key;
+}
+
+uint8_t PS2_getLocks(void)
+{
+	return locks;
 }
 
 void PS2_init(int d, int c)
@@ -284,13 +398,23 @@ void PS2_init(int d, int c)
 	ps2DataPin = d;
 	ps2ClkPin = c;
 
+	// Both lines are read by the PIO and only ever pulled low by us (to talk to the keyboard)
 	gpio_init(ps2DataPin);
-	gpio_set_dir(ps2DataPin, GPIO_IN);
+	gpio_init(ps2ClkPin);
+	gpio_pull_up(ps2DataPin);
+	gpio_pull_up(ps2ClkPin);
+	gpio_put(ps2DataPin, 0);
+	gpio_put(ps2ClkPin, 0);
 
-	gpio_set_irq_enabled_with_callback(ps2ClkPin, GPIO_IRQ_EDGE_FALL, true, &ps2_gpio_callback);
+	ps2_pio = pio0;
+	if (!pio_can_add_program(ps2_pio, &ps2_rx_program))
+		ps2_pio = pio1;
+	uint offset = pio_add_program(ps2_pio, &ps2_rx_program);
+	ps2_sm = pio_claim_unused_sm(ps2_pio, true);
+	ps2_rx_program_init(ps2_pio, ps2_sm, offset, ps2DataPin, ps2ClkPin, (float)clock_get_hz(clk_sys) / PS2_PIO_HZ);
 }
 
 void PS2_selectKeyMap(PS2Keymap_t *km)
 {
 	keymap = km;
-}
\ No newline at end of file
+}
@@ -4,35 +4,36 @@
 #include "pico/stdlib.h"
 
 #define PS2_TAB 9
-#define PS2_SHIFT_TAB 12
 #define PS2_ENTER 13
 #define PS2_BACKSPACE 127
 #define PS2_ESC 27
-#define PS2_INSERT 0
-#define PS2_DELETE 127
-#define PS2_HOME 0
-#define PS2_END 0
-#define PS2_PAGEUP 25
-#define PS2_PAGEDOWN 26
-#define PS2_UPARROW 11
-#define PS2_LEFTARROW 8
-#define PS2_DOWNARROW 10
-#define PS2_RIGHTARROW 21
-#define PS2_F1 0
-#define PS2_F2 0
-#define PS2_F3 0
-#define PS2_F4 0
-#define PS2_F5 0
-#define PS2_F6 0
-#define PS2_F7 0
-#define PS2_F8 0
-#define PS2_F9 0
-#define PS2_F10 0
-#define PS2_F11 0
-#define PS2_F12 0
-#define PS2_SCROLL 0
 #define PS2_EURO_SIGN 0
 
+// Keys without a character, PS2_readKey returns them above 0xFF
+#define PS2_KEY_UP 0x100
+#define PS2_KEY_DOWN 0x101
+#define PS2_KEY_RIGHT 0x102
+#define PS2_KEY_LEFT 0x103
+#define PS2_KEY_HOME 0x104
+#define PS2_KEY_INSERT 0x105
+#define PS2_KEY_DELETE 0x106
+#define PS2_KEY_END 0x107
+#define PS2_KEY_PAGEUP 0x108
+#define PS2_KEY_PAGEDOWN 0x109
+#define PS2_KEY_F1 0x10A // Up to PS2_KEY_F1 + 11 for F12
+
+// Modifiers held down, or'd into every key. Shift, AltGr and Ctrl are already
+// applied to characters, Ctrl+letter gives the control character.
+#define PS2_MOD_SHIFT 0x1000
+#define PS2_MOD_ALT 0x2000
+#define PS2_MOD_CTRL 0x4000
+#define PS2_KEY_MASK 0x0FFF
+
+// PS2_getLocks bits, as shown on the keyboard's LEDs
+#define PS2_LOCK_SCROLL 0x01
+#define PS2_LOCK_NUM 0x02
+#define PS2_LOCK_CAPS 0x04
+
 #define PS2_INVERTED_EXCLAMATION 161	// ¡
 #define PS2_CENT_SIGN 162				// ¢
 #define PS2_POUND_SIGN 163				// £
@@ -146,5 +147,6 @@ void PS2_selectKeyMap(PS2Keymap_t *km);
 
 uint8_t PS2_keyAvailable(void);
 int PS2_readKey();
+uint8_t PS2_getLocks(void);
 
 #endif
@@ -1,8 +1,11 @@
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
 
 #include "cache.h"
+#include "xip.h"
 #include "../psram/psram.h"
+#include "../config/rv32_config.h"
 
 #define psram_write(ofs, p, sz) accessPSRAM(ofs, sz, true, p)
 #define psram_read(ofs, p, sz) accessPSRAM(ofs, sz, false, p)
@@ -41,8 +44,289 @@ cacheline_t cache[4096][2];
 
 uint64_t hits, misses;
 
+// Look up the line holding addr without touching the LRU state
+static cacheline_t *cache_lookup(uint32_t addr)
+{
+    uint16_t index = INDEX(addr);
+    uint8_t tag = TAG(addr);
+
+    for (int way = 0; way < 2; way++)
+    {
+        cacheline_t *line = &cache[index][way];
+        if (IS_VALID(line) && LINE_TAG(line) == tag)
+            return line;
+    }
+    return NULL;
+}
+
+// Bulk transfers go straight to PSRAM, split on PSRAM page boundaries
+#define PSRAM_PAGE_SIZE 1024
+
+static void psram_bulk(uint32_t addr, uint8_t *buf, uint32_t len, bool write)
+{
+    while (len)
+    {
+        uint32_t chunk = PSRAM_PAGE_SIZE - (addr & (PSRAM_PAGE_SIZE - 1));
+        if (chunk > len)
+            chunk = len;
+        accessPSRAM(addr, chunk, write, buf);
+        addr += chunk;
+        buf += chunk;
+        len -= chunk;
+    }
+}
+
+#if CACHE_ZERO_PAGES
+
+// Pages the guest has never written and that are known to read as zero. They
+// are not read from PSRAM, zero stores to them are dropped and the first
+// other store clears the page in PSRAM before it is used normally.
+#define ZERO_PAGE_BITS 12
+#define ZERO_PAGE_SIZE (1u << ZERO_PAGE_BITS)
+#define ZERO_PAGES ((EMULATOR_RAM_MB * 1024 * 1024) >> ZERO_PAGE_BITS)
+
+static uint32_t zero_pages[ZERO_PAGES / 32];
+
+uint64_t zero_fills, zero_drops;
+
+static inline bool is_zero_page(uint32_t addr)
+{
+    uint32_t page = addr >> ZERO_PAGE_BITS;
+    return page < ZERO_PAGES && (zero_pages[page / 32] & (1u << (page % 32)));
+}
+
+// Give a zero page real backing in PSRAM
+static void zero_materialize(uint32_t addr)
+{
+    static const uint8_t zeros[PSRAM_PAGE_SIZE];
+    uint32_t page = addr >> ZERO_PAGE_BITS;
+
+    zero_pages[page / 32] &= ~(1u << (page % 32));
+    for (uint32_t ofs = 0; ofs < ZERO_PAGE_SIZE; ofs += PSRAM_PAGE_SIZE)
+        accessPSRAM((page << ZERO_PAGE_BITS) + ofs, PSRAM_PAGE_SIZE, true, (void *)zeros);
+}
+
+// Mark the whole pages inside [addr, addr + len) as zero
+void cache_mark_zero(uint32_t addr, uint32_t len)
+{
+    uint32_t first = (addr + ZERO_PAGE_SIZE - 1) >> ZERO_PAGE_BITS;
+    uint32_t end = (addr + len) >> ZERO_PAGE_BITS;
+
+    for (uint32_t page = first; page < end && page < ZERO_PAGES; page++)
+        zero_pages[page / 32] |= 1u << (page % 32);
+}
+
+#else
+
+void cache_mark_zero(uint32_t addr, uint32_t len) {}
+
+#endif
+
+// Fetch a line or tier page (never crossing a zero page)
+static inline void psram_fill(uint32_t addr, uint8_t *buf, uint32_t len)
+{
+#if CACHE_ZERO_PAGES
+    if (is_zero_page(addr))
+    {
+        memset(buf, 0, len);
+        zero_fills++;
+        return;
+    }
+#endif
+    psram_bulk(addr, buf, len, false);
+}
+
+// Returns true if the store can be dropped
+static inline bool zero_store(uint32_t addr, const uint8_t *buf, uint32_t size)
+{
+#if CACHE_ZERO_PAGES
+    if (!is_zero_page(addr))
+        return false;
+
+    for (uint32_t i = 0; i < size; i++)
+    {
+        if (buf[i])
+        {
+            zero_materialize(addr);
+            return false;
+        }
+    }
+
+    zero_drops++;
+    return true;
+#else
+    return false;
+#endif
+}
+
+#if CACHE_SRAM_TIER
+
+// Page-granular tier in on-chip SRAM for the hottest guest pages. Each guest
+// page maps to one slot. Accesses that miss the tier are counted in a small
+// hashed heat table, a page replaces the resident of its slot once it is
+// clearly hotter than it.
+#define SRAM_PAGE_SIZE (1u << CACHE_SRAM_PAGE_BITS)
+#define SRAM_PAGE(addr) ((addr) >> CACHE_SRAM_PAGE_BITS)
+#define SRAM_SLOT(page) ((page) & (CACHE_SRAM_SLOTS - 1))
+#define SRAM_NO_PAGE 0xffffffff
+
+// Heat table entries (power of two)
+#define SRAM_HEAT_SIZE 256
+#define SRAM_HEAT(page) (&sram_heat[((page) ^ ((page) >> 8)) & (SRAM_HEAT_SIZE - 1)])
+
+// A candidate needs this many more accesses than the resident to take over
+#define SRAM_HYSTERESIS 32
+// Counters are halved after this many tier misses so old hot pages age out
+#define SRAM_DECAY_INTERVAL 65536
+
+#if CACHE_SRAM_SLOTS & (CACHE_SRAM_SLOTS - 1)
+#error "CACHE_SRAM_SLOTS must be a power of two"
+#endif
+// psram_fill() and sram_promote() look up one zero page per tier page
+#if CACHE_ZERO_PAGES && CACHE_SRAM_PAGE_BITS > ZERO_PAGE_BITS
+#error "CACHE_SRAM_PAGE_BITS must not exceed ZERO_PAGE_BITS"
+#endif
+
+typedef struct
+{
+    uint32_t page;
+    uint32_t count; // Accesses while resident
+    bool dirty;
+    uint8_t data[SRAM_PAGE_SIZE];
+} sram_slot_t;
+
+static sram_slot_t sram[CACHE_SRAM_SLOTS];
+static uint16_t sram_heat[SRAM_HEAT_SIZE];
+static uint32_t sram_ticks;
+
+uint64_t sram_hits, sram_misses;
+
+static void sram_reset(void)
+{
+    for (int i = 0; i < CACHE_SRAM_SLOTS; i++)
+    {
+        sram[i].page = SRAM_NO_PAGE;
+        sram[i].count = 0;
+        sram[i].dirty = false;
+    }
+    memset(sram_heat, 0, sizeof(sram_heat));
+    sram_ticks = 0;
+}
+
+static void sram_decay(void)
+{
+    for (int i = 0; i < CACHE_SRAM_SLOTS; i++)
+        sram[i].count >>= 1;
+    for (int i = 0; i < SRAM_HEAT_SIZE; i++)
+        sram_heat[i] >>= 1;
+}
+
+static void sram_promote(sram_slot_t *slot, uint32_t page, uint32_t heat)
+{
+    if (slot->page != SRAM_NO_PAGE && slot->dirty)
+        psram_bulk(slot->page << CACHE_SRAM_PAGE_BITS, slot->data, SRAM_PAGE_SIZE, true);
+
+    uint32_t base = page << CACHE_SRAM_PAGE_BITS;
+    psram_fill(base, slot->data, SRAM_PAGE_SIZE);
+    slot->dirty = false;
+
+    // The page is only accessed through the tier from now on, take over its cached lines
+    for (uint32_t ofs = 0; ofs < SRAM_PAGE_SIZE; ofs += CACHE_LINE_SIZE)
+    {
+        cacheline_t *line = cache_lookup(base + ofs);
+        if (!line)
+            continue;
+        memcpy(slot->data + ofs, line->data, CACHE_LINE_SIZE);
+        if (IS_DIRTY(line))
+            slot->dirty = true;
+        line->status = 0;
+    }
+
+    slot->page = page;
+    slot->count = heat;
+}
+
+// Returns the slot holding addr (promoting it if it just became hot), NULL otherwise
+static inline sram_slot_t *sram_access(uint32_t addr, uint8_t size)
+{
+    uint32_t page = SRAM_PAGE(addr);
+    sram_slot_t *slot = &sram[SRAM_SLOT(page)];
+
+    if (slot->page == page && page == SRAM_PAGE(addr + size - 1))
+    {
+        slot->count++;
+        sram_hits++;
+        return slot;
+    }
+
+    sram_misses++;
+    if (++sram_ticks == SRAM_DECAY_INTERVAL)
+    {
+        sram_ticks = 0;
+        sram_decay();
+    }
+
+    uint16_t *heat = SRAM_HEAT(page);
+    if (*heat < UINT16_MAX)
+        (*heat)++;
+
+    if (*heat > slot->count + SRAM_HYSTERESIS && page == SRAM_PAGE(addr + size - 1))
+    {
+        sram_promote(slot, page, *heat);
+        *heat = 0; // Counted by the slot while resident
+        return slot;
+    }
+
+    return NULL;
+}
+
+// Copy between buf and any resident pages overlapping [addr, addr + len)
+static void sram_overlay(uint32_t addr, uint8_t *buf, uint32_t len, bool to_sram)
+{
+    for (int i = 0; i < CACHE_SRAM_SLOTS; i++)
+    {
+        if (sram[i].page == SRAM_NO_PAGE)
+            continue;
+
+        uint32_t base = sram[i].page << CACHE_SRAM_PAGE_BITS;
+        uint32_t start = base < addr ? addr : base;
+        uint32_t end = base + SRAM_PAGE_SIZE < addr + len ? base + SRAM_PAGE_SIZE : addr + len;
+        if (start >= end)
+            continue;
+
+        if (to_sram)
+        {
+            memcpy(sram[i].data + (start - base), buf + (start - addr), end - start);
+            sram[i].dirty = true;
+        }
+        else
+            memcpy(buf + (start - addr), sram[i].data + (start - base), end - start);
+    }
+}
+
+#endif
+
 void cache_read(uint32_t addr, void *ptr, uint8_t size)
 {
+#if CACHE_SRAM_TIER
+    sram_slot_t *slot = sram_access(addr, size);
+    if (slot)
+    {
+        memcpy(ptr, slot->data + (addr & (SRAM_PAGE_SIZE - 1)), size);
+        return;
+    }
+#endif
+
+#if EMULATOR_XIP_FLASH
+    // Clean kernel image pages never enter the line cache
+    const uint8_t *flash = xip_lookup(addr, size);
+    if (flash)
+    {
+        memcpy(ptr, flash, size);
+        return;
+    }
+#endif
+
     uint16_t index = INDEX(addr);
     uint8_t tag = TAG(addr);
     uint8_t offset = OFFSET(addr);
@@ -91,7 +375,7 @@ void cache_read(uint32_t addr, void *ptr, uint8_t size)
 
         // get line from RAM
         uint32_t base = BASE(addr);
-        psram_read(base, line->data, CACHE_LINE_SIZE);
+        psram_fill(base, line->data, CACHE_LINE_SIZE);
 
         line->tag = tag; // set the tag of the line
         SET_VALID(line); // mark the line as valid
@@ -111,6 +395,23 @@ void cache_read(uint32_t addr, void *ptr, uint8_t size)
 
 void cache_write(uint32_t addr, void *ptr, uint8_t size)
 {
+#if EMULATOR_XIP_FLASH
+    xip_redirect(addr, size);
+#endif
+
+    if (zero_store(addr, ptr, size))
+        return;
+
+#if CACHE_SRAM_TIER
+    sram_slot_t *slot = sram_access(addr, size);
+    if (slot)
+    {
+        memcpy(slot->data + (addr & (SRAM_PAGE_SIZE - 1)), ptr, size);
+        slot->dirty = true;
+        return;
+    }
+#endif
+
     uint16_t index = INDEX(addr);
     uint8_t tag = TAG(addr);
     uint8_t offset = OFFSET(addr);
@@ -159,7 +460,7 @@ void cache_write(uint32_t addr, void *ptr, uint8_t size)
 
         // get line from RAM
         uint32_t base = BASE(addr);
-        psram_read(base, line->data, CACHE_LINE_SIZE);
+        psram_fill(base, line->data, CACHE_LINE_SIZE);
 
         line->tag = tag; // set the tag of the line
         SET_VALID(line); // mark the line as valid
@@ -174,4 +475,111 @@ void cache_write(uint32_t addr, void *ptr, uint8_t size)
     for (int i = 0; i < size; i++)
         line->data[offset + i] = ((uint8_t *)(ptr))[i];
     SET_DIRTY(line); // mark the line as dirty
-}
\ No newline at end of file
+}
+
+// Device reads of guest memory: fetch from PSRAM, then overlay cached lines
+void cache_dma_read(uint32_t addr, void *ptr, uint32_t len)
+{
+    uint8_t *buf = (uint8_t *)ptr;
+    psram_bulk(addr, buf, len, false);
+
+#if CACHE_ZERO_PAGES
+    for (uint32_t page = addr & ~(ZERO_PAGE_SIZE - 1); page < addr + len; page += ZERO_PAGE_SIZE)
+    {
+        if (!is_zero_page(page))
+            continue;
+
+        uint32_t start = page < addr ? addr : page;
+        uint32_t end = page + ZERO_PAGE_SIZE < addr + len ? page + ZERO_PAGE_SIZE : addr + len;
+        memset(buf + (start - addr), 0, end - start);
+    }
+#endif
+
+    for (uint32_t base = BASE(addr); base < addr + len; base += CACHE_LINE_SIZE)
+    {
+        cacheline_t *line = cache_lookup(base);
+        if (!line)
+            continue;
+
+        uint32_t start = base < addr ? addr : base;
+        uint32_t end = base + CACHE_LINE_SIZE < addr + len ? base + CACHE_LINE_SIZE : addr + len;
+        memcpy(buf + (start - addr), line->data + (start - base), end - start);
+    }
+
+#if CACHE_SRAM_TIER
+    sram_overlay(addr, buf, len, false);
+#endif
+}
+
+// Device writes to guest memory: write PSRAM, then update cached lines
+void cache_dma_write(uint32_t addr, const void *ptr, uint32_t len)
+{
+    const uint8_t *buf = (const uint8_t *)ptr;
+#if EMULATOR_XIP_FLASH
+    xip_redirect(addr, len);
+#endif
+#if CACHE_ZERO_PAGES
+    for (uint32_t page = addr & ~(ZERO_PAGE_SIZE - 1); page < addr + len; page += ZERO_PAGE_SIZE)
+        if (is_zero_page(page))
+            zero_materialize(page);
+#endif
+    psram_bulk(addr, (uint8_t *)buf, len, true);
+
+    for (uint32_t base = BASE(addr); base < addr + len; base += CACHE_LINE_SIZE)
+    {
+        cacheline_t *line = cache_lookup(base);
+        if (!line)
+            continue;
+
+        uint32_t start = base < addr ? addr : base;
+        uint32_t end = base + CACHE_LINE_SIZE < addr + len ? base + CACHE_LINE_SIZE : addr + len;
+        memcpy(line->data + (start - base), buf + (start - addr), end - start);
+    }
+
+#if CACHE_SRAM_TIER
+    sram_overlay(addr, (uint8_t *)buf, len, true);
+#endif
+}
+
+// Forget everything cached, used when guest RAM is reloaded
+void cache_reset(void)
+{
+    memset(cache, 0, sizeof(cache));
+    hits = misses = 0;
+
+#if CACHE_ZERO_PAGES
+    memset(zero_pages, 0, sizeof(zero_pages));
+    zero_fills = zero_drops = 0;
+#endif
+
+#if CACHE_SRAM_TIER
+    sram_reset();
+    sram_hits = sram_misses = 0;
+#endif
+}
+
+void cache_get_stat(uint64_t *phit, uint64_t *paccessed)
+{
+    *phit = hits;
+    *paccessed = hits + misses;
+}
+
+void cache_get_zero_stat(uint64_t *pfills, uint64_t *pdrops)
+{
+#if CACHE_ZERO_PAGES
+    *pfills = zero_fills;
+    *pdrops = zero_drops;
+#else
+    *pfills = *pdrops = 0;
+#endif
+}
+
+void cache_get_tier_stat(uint64_t *phit, uint64_t *paccessed)
+{
+#if CACHE_SRAM_TIER
+    *phit = sram_hits;
+    *paccessed = sram_hits + sram_misses;
+#else
+    *phit = *paccessed = 0;
+#endif
+}
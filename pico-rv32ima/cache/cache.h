@@ -6,4 +6,14 @@
 void cache_write(uint32_t ofs, void *buf, uint8_t size);
 void cache_read(uint32_t ofs, void *buf, uint8_t size);
 
+// Bulk, cache coherent access for emulated devices
+void cache_dma_read(uint32_t ofs, void *buf, uint32_t len);
+void cache_dma_write(uint32_t ofs, const void *buf, uint32_t len);
+
+void cache_reset(void);
+void cache_mark_zero(uint32_t ofs, uint32_t len);
+void cache_get_stat(uint64_t *hit, uint64_t *accessed);
+void cache_get_tier_stat(uint64_t *hit, uint64_t *accessed);
+void cache_get_zero_stat(uint64_t *fills, uint64_t *drops);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include <string.h>
+
+#include "xip.h"
+
+#if EMULATOR_XIP_FLASH
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/structs/ssi.h"
+
+#if XIP_FLASH_OFFSET % FLASH_SECTOR_SIZE || XIP_FLASH_SIZE % FLASH_SECTOR_SIZE
+#error "XIP flash partition must be sector aligned"
+#endif
+#if XIP_FLASH_OFFSET + XIP_FLASH_SIZE > PICO_FLASH_SIZE_BYTES
+#error "XIP flash partition doesn't fit in flash"
+#endif
+
+uint32_t xip_mapped;
+uint32_t xip_redirected[(XIP_PAGES + 31) / 32];
+
+// boot2 leaves the flash clocked for 125MHz, slow it down for the overclocked system clock
+static void xip_set_clock(void)
+{
+    ssi_hw->ssienr = 0;
+    ssi_hw->baudr = XIP_FLASH_CLKDIV;
+    ssi_hw->ssienr = 1;
+}
+
+void xip_init(void)
+{
+    xip_set_clock();
+    xip_map(0);
+}
+
+// Called with every sector of the kernel image as it is loaded, only rewrites what changed
+void xip_program(uint32_t addr, const uint8_t *buf, uint32_t len)
+{
+    if (addr % FLASH_SECTOR_SIZE || len != FLASH_SECTOR_SIZE || addr + len > XIP_FLASH_SIZE)
+        return;
+
+    if (!memcmp((const void *)(XIP_NOCACHE_NOALLOC_BASE + XIP_FLASH_OFFSET + addr), buf, len))
+        return;
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(XIP_FLASH_OFFSET + addr, FLASH_SECTOR_SIZE);
+    flash_range_program(XIP_FLASH_OFFSET + addr, buf, FLASH_SECTOR_SIZE);
+    xip_set_clock(); // The SDK restores XIP through boot2
+    restore_interrupts(ints);
+}
+
+// Serve [0, size) from flash until each page is first written
+void xip_map(uint32_t size)
+{
+    size &= ~((1u << XIP_PAGE_BITS) - 1);
+    xip_mapped = size < XIP_FLASH_SIZE ? size : XIP_FLASH_SIZE;
+    memset(xip_redirected, 0, sizeof(xip_redirected));
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef XIP_H
+#define XIP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../config/rv32_config.h"
+
+#if EMULATOR_XIP_FLASH
+
+#include "hardware/regs/addressmap.h"
+
+// Guest RAM pages served straight from the XIP flash window
+#define XIP_PAGE_BITS 12
+#define XIP_PAGES (XIP_FLASH_SIZE >> XIP_PAGE_BITS)
+
+extern uint32_t xip_mapped;
+extern uint32_t xip_redirected[(XIP_PAGES + 31) / 32];
+
+void xip_init(void);
+void xip_program(uint32_t addr, const uint8_t *buf, uint32_t len);
+void xip_map(uint32_t size);
+
+// Flash copy of a clean page, NULL once it has been written to (or isn't mapped)
+static inline const uint8_t *xip_lookup(uint32_t addr, uint32_t size)
+{
+    uint32_t page = addr >> XIP_PAGE_BITS;
+    if (addr + size > xip_mapped || page != (addr + size - 1) >> XIP_PAGE_BITS ||
+        (xip_redirected[page / 32] & (1u << (page % 32))))
+        return NULL;
+    return (const uint8_t *)(XIP_BASE + XIP_FLASH_OFFSET + addr);
+}
+
+// Copy on write: the PSRAM copy of the page is pristine, so just stop using flash for it
+static inline void xip_redirect(uint32_t addr, uint32_t len)
+{
+    if (addr >= xip_mapped)
+        return;
+
+    uint32_t last = addr + len - 1 < xip_mapped ? addr + len - 1 : xip_mapped - 1;
+    for (uint32_t page = addr >> XIP_PAGE_BITS; page <= last >> XIP_PAGE_BITS; page++)
+        xip_redirected[page / 32] |= 1u << (page % 32);
+}
+
+#endif
+
+#endif
@@ -17,8 +17,11 @@
 // Tie microsecond clock to instruction count
 #define EMULATOR_FIXED_UPDATE false
 
-// Sleep while WFI
-#define EMULATOR_WFI_SLEEP false
+// Sleep while WFI (until the next timer match or input)
+#define EMULATOR_WFI_SLEEP true
+
+// Longest single WFI sleep (in microseconds)
+#define EMULATOR_WFI_MAX_SLEEP_US 100000
 
 // Number of instructions per flip
 #define EMUALTOR_INSTR_FLIP 1024
@@ -26,6 +29,70 @@
 // Should Emulator fail on all faults?
 #define EMULAOTR_FAF false
 
+// Use the SIO hardware divider and a 16-bit split multiply for RV32M
+#define EMULATOR_FAST_RV32M 1
+
+// Decode RV32C compressed instructions (needed for kernels built with rv32imac)
+#define EMULATOR_RV32C 1
+
+// Decode the Zba/Zbb bit manipulation extensions
+#define EMULATOR_ZBA_ZBB 1
+
+// Record every guest memory access to a file on the SD card (slow, for tuning the cache)
+#define EMULATOR_TRACE 0
+
+#if EMULATOR_TRACE
+
+// Trace filename, see trace/trace.h for the format
+#define TRACE_FILENAME "0:trace.bin"
+
+#endif
+
+// Serve the start of the kernel image from a flash partition through XIP
+// (programmed on first boot, pages move to PSRAM when written)
+#define EMULATOR_XIP_FLASH 0
+
+#if EMULATOR_XIP_FLASH
+
+// Flash partition for the kernel image (must be clear of the firmware, sector aligned)
+#define XIP_FLASH_OFFSET (512 * 1024)
+#define XIP_FLASH_SIZE (1536 * 1024)
+
+// Flash clock divider (even), keeps the flash in spec at the overclocked system clock
+#define XIP_FLASH_CLKDIV 6
+
+#endif
+
+/******************/
+/* Device tree config
+/******************/
+
+// Kernel command line
+#define EMULATOR_BOOTARGS "earlycon=uart8250,mmio,0x10000000,1000000 console=hvc0"
+
+// CLINT timer frequency (in Hz), the emulated timer is scaled to tick at this rate
+#define EMULATOR_TIMEBASE_FREQ (1000000 / EMULATOR_TIME_DIV)
+
+// Number of harts described in the device tree (only a single hart is emulated)
+#define EMULATOR_HARTS 1
+
+// Optional "key=value" overrides for the generated device tree (bootargs, timebase)
+#define EMULATOR_DTB_OVERRIDES "0:dtb.cfg"
+
+/******************/
+/* virtio devices
+/******************/
+
+// virtio-blk disk backed by an image file on the SD card
+#define EMULATOR_VIRTIO_BLK 0
+
+// Disk image filename (raw, a multiple of 512 bytes)
+#define VIRTIO_BLK_IMAGE "0:rootfs.img"
+
+// virtio-console, output is handed over a whole buffer at a time
+// (shows up as the next hvc device, point console= in the bootargs at it)
+#define EMULATOR_VIRTIO_CONSOLE 0
+
 // Enable UART console
 #define CONSOLE_UART 1
 
@@ -35,6 +102,15 @@
 // Enable ST7735 LCD and PS/2 keyboard terminal
 #define CONSOLE_LCD 0
 
+// Output buffer for each of the UART and USB CDC consoles (in bytes, power of two)
+#define CONSOLE_OUT_BUFFER 8192
+
+// Output buffer for the LCD terminal (in bytes, power of two)
+#define CONSOLE_LCD_BUFFER 2048
+
+// When an output buffer is full: CONSOLE_OVERFLOW_BLOCK, _DROP or _COALESCE (see console/console.h)
+#define CONSOLE_OVERFLOW CONSOLE_OVERFLOW_BLOCK
+
 #if CONSOLE_UART
 
 /******************/
@@ -64,9 +140,25 @@
 
 // Hardware SPI instance to use for PSRAM
 #define PSRAM_SPI_INST spi1
-// PSRAM SPI speed (in MHz)
+// PSRAM SPI speed (in MHz), the slowest setting tried when calibrating
 #define PSRAM_SPI_SPEED 52
 
+// Find the fastest SPI clock and read command that pass a pattern test at boot
+#define PSRAM_CALIBRATE 1
+
+#if PSRAM_CALIBRATE
+
+// Fastest SPI clock to try (in MHz)
+#define PSRAM_CALIBRATE_MAX_MHZ 110
+// Pattern test passes each setting must survive
+#define PSRAM_CALIBRATE_PASSES 4
+// Keep the result in flash, later boots only check it with a single pass
+#define PSRAM_CALIBRATE_CACHE 1
+// Flash sector for the result (default: the last one, or the one below the XIP partition)
+// #define PSRAM_CALIBRATE_FLASH_OFFSET (2044 * 1024)
+
+#endif
+
 #endif
 // Pins for the PSRAM SPI interface
 #define PSRAM_SPI_PIN_CK 10
@@ -89,12 +181,35 @@
 // Use four PSRAM chips?
 #define PSRAM_FOUR_CHIPS  0
 
+/******************/
+/* Cache config
+/******************/
+
+// Track never-written guest RAM so it isn't read from PSRAM
+#define CACHE_ZERO_PAGES 1
+
+// Keep the hottest guest pages in on-chip SRAM, in front of the line cache
+#define CACHE_SRAM_TIER 1
+
+#if CACHE_SRAM_TIER
+
+// Page size (as a power of two) and number of pages held (power of two)
+#define CACHE_SRAM_PAGE_BITS 10
+#define CACHE_SRAM_SLOTS 8
+
+#endif
+
 /****************/
 /* SD card config
 /***************/
 
-// Set to 1 to use SDIO interface for the SD. Set to 0 to use SPI.
+// Set to 1 to use SDIO interface for the SD (4 bit, about 4x the bandwidth).
+// Set to 0 to use SPI. The default SDIO pins clash with the LCD, so SPI is used with CONSOLE_LCD
+#if CONSOLE_LCD
 #define SD_USE_SDIO 0
+#else
+#define SD_USE_SDIO 1
+#endif
 
 #if SD_USE_SDIO
 
@@ -104,8 +219,14 @@
 
 // Pins for the SDIO interface (if used)
 // CLK will be D0 - 2,  D1 = D0 + 1,  D2 = D0 + 2,  D3 = D0 + 3
-#define SDIO_PIN_CMD 18
-#define SDIO_PIN_D0 19
+// The defaults (CLK 15, CMD 16, D0-D3 17-20) keep clear of the PSRAM selects
+#define SDIO_PIN_CMD 16
+#define SDIO_PIN_D0 17
+
+// PIO clock divider for the fastest SD clock to try, clk_sys / 4 / divider.
+// Slower ones are stepped through until blocks read back correctly.
+// 0 picks the fastest in spec: 50 MHz in high speed mode, 25 MHz otherwise
+#define SDIO_CLK_DIV 0
 
 #else
 
@@ -121,6 +242,12 @@
 #define SD_SPI_PIN_MOSI 19
 #define SD_SPI_PIN_CLK 18
 #define SD_SPI_PIN_CS 20
+
+// SD SPI clock (in Hz), also the fallback when calibration finds nothing faster
+#define SD_SPI_BAUD_RATE (20 * 1000 * 1000)
+// Fastest SD SPI clock to try (in Hz). The card is switched to high speed mode
+// and the clock stepped down until blocks read back correctly. 0 disables this
+#define SD_SPI_MAX_BAUD_RATE (50 * 1000 * 1000)
 #endif
 
 // #if PSRAM_HARDWARE_SPI
@@ -136,6 +263,9 @@
 
 // LCD INITR code
 #define LCD_INITR INITR_GREENTAB
+// Rotation: 1 and 3 are landscape (26x16 characters), 0 and 2 portrait (21x20 characters).
+// Portrait scrolls in hardware, landscape has to move the whole framebuffer
+#define LCD_ROTATION 1
 // Pins for the LCD SPI interface (if used)
 #define LCD_PIN_DC 4
 #define LCD_PIN_CS 6
@@ -150,6 +280,17 @@
 #define PS2_PIN_DATA 7
 #define PS2_PIN_CK 8
 
+/*******************/
+/* Guest framebuffer
+/******************/
+
+// Expose the LCD to Linux as a simple-framebuffer (r5g6b5, see linux/configs/fb).
+// The terminal hands the screen over on the guest's first write, and scrolls
+// by moving pixels since the guest needs a flat framebuffer
+#define EMULATOR_FB 0
+// Physical address of the framebuffer, inside the MMIO window
+#define EMULATOR_FB_BASE 0x11800000
+
 #endif
 
 /*******************/
@@ -176,6 +317,36 @@
     #endif
 #endif
 
+#if !CONSOLE_LCD
+    #undef EMULATOR_FB
+    #define EMULATOR_FB 0
+#endif
+
+#if SD_USE_SDIO
+    #define SDIO_PIN_CLK ((SDIO_PIN_D0 + 30) % 32)
+    #define SDIO_PIN_USED(p) ((p) == SDIO_PIN_CLK || (p) == SDIO_PIN_CMD || ((p) >= SDIO_PIN_D0 && (p) <= SDIO_PIN_D0 + 3))
+
+    #if SDIO_PIN_USED(PSRAM_SPI_PIN_CK) || SDIO_PIN_USED(PSRAM_SPI_PIN_TX) || SDIO_PIN_USED(PSRAM_SPI_PIN_RX) || \
+        SDIO_PIN_USED(PSRAM_SPI_PIN_S1) || \
+        ((PSRAM_TWO_CHIPS || PSRAM_THREE_CHIPS || PSRAM_FOUR_CHIPS) && SDIO_PIN_USED(PSRAM_SPI_PIN_S2)) || \
+        ((PSRAM_THREE_CHIPS || PSRAM_FOUR_CHIPS) && SDIO_PIN_USED(PSRAM_SPI_PIN_S3)) || \
+        (PSRAM_FOUR_CHIPS && SDIO_PIN_USED(PSRAM_SPI_PIN_S4))
+        #error "SDIO pins clash with the PSRAM! Move the SDIO pins or use SD SPI"
+    #endif
+    #if CONSOLE_LCD && (SDIO_PIN_USED(LCD_PIN_DC) || SDIO_PIN_USED(LCD_PIN_CS) || SDIO_PIN_USED(LCD_PIN_RST) || \
+                        SDIO_PIN_USED(LCD_PIN_SCK) || SDIO_PIN_USED(LCD_PIN_TX) || \
+                        SDIO_PIN_USED(PS2_PIN_DATA) || SDIO_PIN_USED(PS2_PIN_CK))
+        #error "SDIO pins clash with the LCD or keyboard! Set SD_USE_SDIO to 0 with CONSOLE_LCD, or move the SDIO pins"
+    #endif
+#endif
+
+#if EMULATOR_HARTS != 1
+    #error "Only a single hart is emulated! EMULATOR_HARTS must be 1"
+#endif
+#if EMULATOR_TIMEBASE_FREQ == 0
+    #error "EMULATOR_TIMEBASE_FREQ must not be 0"
+#endif
+
 #if !PSRAM_TWO_CHIPS && !PSRAM_THREE_CHIPS && !PSRAM_FOUR_CHIPS && PSRAM_CHIP_SIZE < (EMULATOR_RAM_MB * 1024 * 1024)
     #error "RAM Size too Big! 8MB < RAM"
 #endif
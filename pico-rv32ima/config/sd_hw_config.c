@@ -13,7 +13,7 @@ static spi_t spis[] = {
      .set_drive_strength = true,
      .mosi_gpio_drive_strength = GPIO_DRIVE_STRENGTH_2MA,
      .sck_gpio_drive_strength = GPIO_DRIVE_STRENGTH_2MA,
-     .baud_rate = 20 * 1000 * 1000, // Actual frequency: 20833333.
+     .baud_rate = SD_SPI_BAUD_RATE,
      .DMA_IRQ_num = DMA_IRQ_1}};
 #endif
 
@@ -29,12 +29,14 @@ static sd_card_t sd_cards[] = {
             .CMD_gpio = SDIO_PIN_CMD,
             .D0_gpio = SDIO_PIN_D0,
             .SDIO_PIO = pio1,
-            .DMA_IRQ_num = DMA_IRQ_0},
+            .DMA_IRQ_num = DMA_IRQ_0,
+            .clock_divider = SDIO_CLK_DIV},
 
 #else
         .type = SD_IF_SPI,
         .spi_if.spi = &spis[0],          // Pointer to the SPI driving this card
         .spi_if.ss_gpio = SD_SPI_PIN_CS, // The SPI slave select GPIO for this SD card
+        .spi_if.max_baud_rate = SD_SPI_MAX_BAUD_RATE,
 
 #endif
         .use_card_detect = false,
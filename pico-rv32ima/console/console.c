@@ -3,9 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "console.h"
 #include "terminal.h"
+#include "ringbuf.h"
 
 #include "../config/rv32_config.h"
 
@@ -13,53 +15,91 @@
 #include "tusb.h"
 #endif
 
-queue_t ser_screen_queue, kb_queue;
+queue_t kb_queue;
+
+#if CONSOLE_UART
+#include "hardware/dma.h"
+
+static uint8_t uart_out_buf[CONSOLE_OUT_BUFFER];
+static ringbuf_t uart_out;
+static uint32_t uart_out_dropped;
+static int uart_dma;
+static uint32_t uart_dma_len; // Bytes the running transfer still holds in the ring
+#endif
 
 #if CONSOLE_CDC
+static uint8_t cdc_out_buf[CONSOLE_OUT_BUFFER];
+static ringbuf_t cdc_out;
+static uint32_t cdc_out_dropped;
 uint8_t cdc_buf[IO_QUEUE_LEN];
 #endif
 
+#if CONSOLE_LCD
+static uint32_t lcd_out_dropped;
+#endif
+
 void console_init(void)
 {
 #if CONSOLE_CDC
     tusb_init();
+    ringbuf_init(&cdc_out, cdc_out_buf, sizeof(cdc_out_buf));
 #endif
 
 #if CONSOLE_UART
     uart_init(UART_INSTANCE, UART_BAUD_RATE);
     gpio_set_function(UART_TX_PIN, GPIO_FUNC_UART);
     gpio_set_function(UART_RX_PIN, GPIO_FUNC_UART);
+
+    // Output goes from the ring to the TX FIFO by DMA
+    ringbuf_init(&uart_out, uart_out_buf, sizeof(uart_out_buf));
+    uart_dma = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(uart_dma);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, uart_get_dreq(UART_INSTANCE, true));
+    dma_channel_configure(uart_dma, &c, &uart_get_hw(UART_INSTANCE)->dr, NULL, 0, false);
 #endif
 
 #if CONSOLE_LCD
     initLCDTerm();
 #endif
 
-#if CONSOLE_CDC || CONSOLE_UART
-    queue_init(&ser_screen_queue, sizeof(char), IO_QUEUE_LEN);
-#endif
     queue_init(&kb_queue, sizeof(char), IO_QUEUE_LEN);
 }
 
 #if CONSOLE_CDC || CONSOLE_UART
 void ser_console_task(void)
 {
-    while (!queue_is_empty(&ser_screen_queue))
+#if CONSOLE_UART
+    // Once the last transfer is done, hand its bytes back and send the next span
+    if (!dma_channel_is_busy(uart_dma))
     {
-        uint8_t c;
-        queue_remove_blocking(&ser_screen_queue, &c);
+        uint8_t *p;
+        ringbuf_release(&uart_out, uart_dma_len);
+        uart_dma_len = ringbuf_span(&uart_out, &p);
+        if (uart_dma_len)
+            dma_channel_transfer_from_buffer_now(uart_dma, p, uart_dma_len);
+    }
+#endif
 
 #if CONSOLE_CDC
+    // Output is thrown away while nothing is connected
+    uint8_t *p;
+    uint32_t n;
+    while ((n = ringbuf_span(&cdc_out, &p)))
+    {
         if (tud_cdc_connected())
-            tud_cdc_write_char(c);
-#endif
-
-#if CONSOLE_UART
-        uart_putc_raw(UART_INSTANCE, c);
-#endif
+        {
+            uint32_t room = tud_cdc_write_available();
+            if (n > room)
+                n = room;
+            if (!n || !(n = tud_cdc_write(p, n)))
+                break;
+        }
+        ringbuf_release(&cdc_out, n);
     }
 
-#if CONSOLE_CDC
     if (tud_cdc_connected() && tud_cdc_available())
     {
         uint32_t count = tud_cdc_read(cdc_buf, sizeof(cdc_buf));
@@ -97,22 +137,61 @@ void console_task(void)
 #endif
 }
 
-void console_putc(char c)
+// Queue output for one sink, what happens when it is full depends on CONSOLE_OVERFLOW
+static void console_out(ringbuf_t *r, uint32_t *dropped, const char *buf, uint32_t len)
 {
-#if CONSOLE_CDC || CONSOLE_UART
-    queue_add_blocking(&ser_screen_queue, &c);
+#if CONSOLE_OVERFLOW == CONSOLE_OVERFLOW_COALESCE
+    if (*dropped)
+    {
+        char note[32];
+        int n = snprintf(note, sizeof(note), "\r\n[%lu bytes dropped]\r\n", (unsigned long)*dropped);
+        if (ringbuf_free(r) < n)
+        {
+            *dropped += len;
+            return;
+        }
+        ringbuf_put(r, note, n);
+        *dropped = 0;
+    }
 #endif
 
-#if CONSOLE_LCD
-    queue_add_blocking(&term_screen_queue, &c);
+    uint32_t done = ringbuf_put(r, buf, len);
+
+#if CONSOLE_OVERFLOW == CONSOLE_OVERFLOW_BLOCK
+    // The sinks are drained by core 0, so only the emulator core can wait for them
+    while (done < len && get_core_num() == 1)
+    {
+        tight_loop_contents();
+        done += ringbuf_put(r, buf + done, len - done);
+    }
 #endif
+
+    *dropped += len - done;
+}
+
+void console_putc(char c)
+{
+    console_write(&c, 1);
 }
 
 void console_puts(char s[])
 {
-    uint8_t n = strlen(s);
-    for (int i = 0; i < n; i++)
-        console_putc(s[i]);
+    console_write(s, strlen(s));
+}
+
+void console_write(const char *buf, uint32_t len)
+{
+#if CONSOLE_UART
+    console_out(&uart_out, &uart_out_dropped, buf, len);
+#endif
+
+#if CONSOLE_CDC
+    console_out(&cdc_out, &cdc_out_dropped, buf, len);
+#endif
+
+#if CONSOLE_LCD
+    console_out(&term_screen_ring, &lcd_out_dropped, buf, len);
+#endif
 }
 
 char termPrintBuf[100];
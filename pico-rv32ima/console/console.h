@@ -3,15 +3,22 @@
 
 #include "pico/util/queue.h"
 
+// Keyboard input queue length
 #define IO_QUEUE_LEN 15
 
-extern queue_t ser_screen_queue, kb_queue;
+// CONSOLE_OVERFLOW policies, for when an output buffer is full
+#define CONSOLE_OVERFLOW_BLOCK 0    // Wait for room (on the emulator core, drop elsewhere)
+#define CONSOLE_OVERFLOW_DROP 1     // Discard what doesn't fit
+#define CONSOLE_OVERFLOW_COALESCE 2 // Discard, then print one note with the count once there is room
+
+extern queue_t kb_queue;
 
 void console_init(void);
 void console_task(void);
 
 void console_putc(char c);
 void console_puts(char s[]);
+void console_write(const char *buf, uint32_t len);
 void console_printf(const char *format, ...);
 void console_panic(const char *format, ...);
 
@@ -0,0 +1,94 @@
+#ifndef _RINGBUF_H
+#define _RINGBUF_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+
+// Lock-free single producer, single consumer byte ring between the two cores.
+// head is only written by the producer and tail only by the consumer, both run
+// freely and are masked on use. The consumer can hand out contiguous spans
+// (for DMA) and release them once they have been sent.
+
+typedef struct
+{
+    uint8_t *buf;
+    uint32_t size; // Power of two
+    volatile uint32_t head, tail;
+} ringbuf_t;
+
+static inline void ringbuf_init(ringbuf_t *r, uint8_t *buf, uint32_t size)
+{
+    r->buf = buf;
+    r->size = size;
+    r->head = r->tail = 0;
+}
+
+static inline uint32_t ringbuf_used(const ringbuf_t *r)
+{
+    return r->head - r->tail;
+}
+
+static inline uint32_t ringbuf_free(const ringbuf_t *r)
+{
+    return r->size - ringbuf_used(r);
+}
+
+// Producer side, copies as much as fits and returns how much that was
+static inline uint32_t ringbuf_put(ringbuf_t *r, const void *src, uint32_t len)
+{
+    uint32_t head = r->head;
+    uint32_t space = r->size - (head - r->tail);
+    if (len > space)
+        len = space;
+
+    uint32_t ofs = head & (r->size - 1);
+    uint32_t first = r->size - ofs < len ? r->size - ofs : len;
+    memcpy(r->buf + ofs, src, first);
+    memcpy(r->buf, (const uint8_t *)src + first, len - first);
+
+    __dmb(); // Data before the index
+    r->head = head + len;
+    return len;
+}
+
+// Consumer side, the readable bytes up to the end of the buffer
+static inline uint32_t ringbuf_span(ringbuf_t *r, uint8_t **ptr)
+{
+    uint32_t tail = r->tail;
+    uint32_t used = r->head - tail;
+    uint32_t ofs = tail & (r->size - 1);
+
+    __dmb(); // Index before the data
+    *ptr = r->buf + ofs;
+    return r->size - ofs < used ? r->size - ofs : used;
+}
+
+static inline void ringbuf_release(ringbuf_t *r, uint32_t len)
+{
+    __dmb(); // Done with the data before the producer can reuse it
+    r->tail += len;
+}
+
+static inline bool ringbuf_get(ringbuf_t *r, uint8_t *c)
+{
+    uint8_t *p;
+    if (!ringbuf_span(r, &p))
+        return false;
+    *c = *p;
+    ringbuf_release(r, 1);
+    return true;
+}
+
+static inline bool ringbuf_peek(ringbuf_t *r, uint8_t *c)
+{
+    uint8_t *p;
+    if (!ringbuf_span(r, &p))
+        return false;
+    *c = *p;
+    return true;
+}
+
+#endif
@@ -3,252 +3,796 @@
 
 #include "pico/stdlib.h"
 #include <stdlib.h>
+#include <stdio.h>
 
-#include <ctype.h>
 #include <string.h>
 
 #include "console.h"
+#include "terminal.h"
 
 #include "st7735.h"
 #include "gfx.h"
 
 #include "ps2.h"
 
+#if EMULATOR_FB
+#include "../emulator/fb.h"
+#endif
+
 #define ESC 0x1B
 #define CSI '['
 
-queue_t term_screen_queue;
+static uint8_t term_screen_buf[CONSOLE_LCD_BUFFER];
+ringbuf_t term_screen_ring;
 
 uint fontWidth = 6;
 uint fontHeight = 8;
 
-uint termWidth, termHeight;
+uint termWidth, termHeight; // termHeight is the last row
 
 uint termCursX = 0;
 uint termCursY = 0;
 
-uint16_t termFgColor = ST77XX_WHITE;
-uint16_t termBgColor = ST77XX_BLACK;
+// The screen is kept as a grid of cells: the character in bits 0-7, the
+// foreground and background palette indices in bits 8-15 and 16-23 and flags
+// in bits 24-31. termShown is what the framebuffer holds, only cells that
+// differ from it get drawn.
+typedef uint32_t term_cell_t;
 
-void initLCDTerm(void)
+#define TERM_CELL(c, fg, bg, flags) ((uint8_t)(c) | (fg) << 8 | (bg) << 16 | (uint32_t)(flags) << 24)
+#define TERM_FLAG_UNDERLINE 0x01
+#define TERM_FLAG_CURSOR 0x02
+#define TERM_BLANK TERM_CELL(' ', 7, 0, 0) // What a cleared framebuffer row looks like
+
+static term_cell_t *termCells, *termShown, *termSaved;
+static bool *termRowDirty;
+static bool termCursOn = false;
+static uint termShownCursY = 0;
+
+static uint16_t termPalette[256];
+
+// Graphic rendition
+static uint8_t termFg = 7, termBg = 0;
+static bool termBold, termUnderline, termReverse;
+
+// Modes
+static bool termWrapPending;
+static bool termAutoWrap = true;
+static bool termInsert;
+static bool termCursVisible = true;
+static bool termAppCursor;
+static bool termAltScreen;
+
+// Scroll region, rows inclusive
+static uint termTop, termBottom;
+
+static struct
 {
-    LCD_setPins(LCD_PIN_DC, LCD_PIN_CS, LCD_PIN_RST, LCD_PIN_SCK, LCD_PIN_TX);
-    LCD_initDisplay(LCD_INITR);
-    LCD_setRotation(1);
-    GFX_createFramebuf();
+    uint x, y;
+    uint8_t fg, bg;
+    bool bold, underline, reverse;
+} termSavedCurs;
 
-    PS2_init(PS2_PIN_DATA, PS2_PIN_CK);
+// Escape sequence parser, after the DEC ANSI parser state diagram
+enum
+{
+    TERM_GROUND,
+    TERM_ESCAPE,
+    TERM_ESCAPE_INTER,
+    TERM_CSI_PARAM,
+    TERM_CSI_INTER,
+    TERM_CSI_IGNORE,
+    TERM_STRING, // OSC, DCS, SOS, PM and APC, all ignored
+};
+
+#define TERM_MAX_PARAMS 16
+
+static uint8_t termState = TERM_GROUND;
+static uint16_t termParams[TERM_MAX_PARAMS];
+static uint termParamCount;
+static char termPrivate, termInter;
+
+// The panel takes red in the low bits, like the colour table the terminal always had
+#define TERM_RGB(r, g, b) GFX_RGB565(b, g, r)
+
+static void termInitPalette()
+{
+    static const uint16_t base[8] = {ST77XX_BLACK, ST77XX_BLUE, ST77XX_GREEN, ST77XX_CYAN,
+                                     ST77XX_RED, ST77XX_MAGENTA, ST77XX_YELLOW, ST77XX_WHITE};
+    static const uint8_t levels[6] = {0, 95, 135, 175, 215, 255};
+
+    // The first eight keep their old colours, the bright ones are lighter
+    for (int i = 0; i < 8; i++)
+    {
+        termPalette[i] = base[i];
+        termPalette[i + 8] = TERM_RGB(i & 1 ? 255 : 85, i & 2 ? 255 : 85, i & 4 ? 255 : 85);
+    }
 
-    queue_init(&term_screen_queue, sizeof(char), IO_QUEUE_LEN);
+    for (int i = 0; i < 216; i++)
+        termPalette[16 + i] = TERM_RGB(levels[i / 36], levels[i / 6 % 6], levels[i % 6]);
+    for (int i = 0; i < 24; i++)
+        termPalette[232 + i] = TERM_RGB(8 + 10 * i, 8 + 10 * i, 8 + 10 * i);
+}
 
-    termWidth = GFX_getWidth() / fontWidth;
-    termHeight = GFX_getHeight() / fontHeight - 1;
+// Nearest entry of the 6x6x6 colour cube
+static uint8_t termRGBIndex(uint r, uint g, uint b)
+{
+#define TERM_CUBE(v) ((v) < 48 ? 0 : (v) < 115 ? 1 : ((v) - 35) / 40)
+    return 16 + 36 * TERM_CUBE(r) + 6 * TERM_CUBE(g) + TERM_CUBE(b);
+#undef TERM_CUBE
+}
 
-    GFX_clearScreen();
-    GFX_flush();
+static term_cell_t termBlank()
+{
+    return TERM_CELL(' ', termFg, termBg, 0);
 }
 
-void term_move_cursor(int x, int y)
+static void termDirtyRows(uint y, uint y2)
 {
-    termCursX = x;
-    termCursY = y;
+    for (; y <= y2; y++)
+        termRowDirty[y] = true;
 }
 
-void term_clear_screen()
+static void termFill(uint x, uint y, uint n, term_cell_t cell)
 {
-    GFX_clearScreen();
+    term_cell_t *p = termCells + y * termWidth + x;
+    while (n--)
+        *p++ = cell;
 }
 
-void termNewLine()
+// Clears from (x, y) up to, not including, (x2, y2)
+static void termErase(uint x, uint y, uint x2, uint y2)
 {
-    termCursY++;
-    if (termCursY > termHeight)
+    uint from = y * termWidth + x, to = y2 * termWidth + x2;
+    if (to > from)
     {
-        termCursY--;
-        GFX_scrollUp(fontHeight);
+        termFill(x, y, to - from, termBlank());
+        termDirtyRows(y, y2 < termHeight ? y2 : termHeight);
     }
 }
 
-void termCR()
+static void term_clear_screen()
+{
+    termErase(0, 0, 0, termHeight + 1);
+}
+
+// Moves the grid up with the framebuffer, so rows already drawn stay drawn
+static void termHwScroll()
 {
-    termCursX = 0;
+    uint rowCells = termWidth * termHeight;
+    memmove(termCells, termCells + termWidth, rowCells * sizeof(term_cell_t));
+    memmove(termShown, termShown + termWidth, rowCells * sizeof(term_cell_t));
+    memmove(termRowDirty, termRowDirty + 1, termHeight * sizeof(bool));
+    termFill(0, termHeight, termWidth, termBlank());
+    for (uint i = 0; i < termWidth; i++)
+        termShown[rowCells + i] = TERM_BLANK; // The framebuffer cleared it to black
+    termRowDirty[termHeight] = true;
+    if (termShownCursY > 0)
+        termShownCursY--;
+
+    GFX_scrollUp(fontHeight);
 }
 
-void termPrintChar(char c)
+// Scrolls rows top to bottom up by n, the framebuffer follows for the whole screen
+static void termScrollUp(uint top, uint bottom, uint n)
 {
-    if (c == '\n')
-        termNewLine();
-    else if (c == '\r')
-        termCR();
-    else if (c == '\b')
+    if (n > bottom - top + 1)
+        n = bottom - top + 1;
+
+    if (top == 0 && bottom == termHeight)
     {
-        if (termCursX == 0)
-        {
-            termCursX = termWidth - 1;
-            if (termCursY > 0)
-                termCursY--;
-        }
-        else
-            termCursX--;
+        while (n--)
+            termHwScroll();
+        return;
     }
-    else
+
+    memmove(termCells + top * termWidth, termCells + (top + n) * termWidth,
+            (bottom + 1 - top - n) * termWidth * sizeof(term_cell_t));
+    termFill(0, bottom + 1 - n, n * termWidth, termBlank());
+    termDirtyRows(top, bottom);
+}
+
+static void termScrollDown(uint top, uint bottom, uint n)
+{
+    if (n > bottom - top + 1)
+        n = bottom - top + 1;
+
+    memmove(termCells + (top + n) * termWidth, termCells + top * termWidth,
+            (bottom + 1 - top - n) * termWidth * sizeof(term_cell_t));
+    termFill(0, top, n * termWidth, termBlank());
+    termDirtyRows(top, bottom);
+}
+
+static void termMoveTo(int x, int y)
+{
+    termCursX = x < 0 ? 0 : x >= termWidth ? termWidth - 1 : x;
+    termCursY = y < 0 ? 0 : y > termHeight ? termHeight : y;
+    termWrapPending = false;
+}
+
+static void termLineFeed()
+{
+    if (termCursY == termBottom)
+        termScrollUp(termTop, termBottom, 1);
+    else if (termCursY < termHeight)
+        termCursY++;
+    termWrapPending = false;
+}
+
+static void termReverseIndex()
+{
+    if (termCursY == termTop)
+        termScrollDown(termTop, termBottom, 1);
+    else if (termCursY > 0)
+        termCursY--;
+    termWrapPending = false;
+}
+
+static void termPrint(uint8_t c)
+{
+    if (termWrapPending)
     {
-        GFX_drawChar(termCursX * fontWidth, termCursY * fontHeight, c, termFgColor, termBgColor, 1, 1);
-        termCursX++;
-        if (termCursX >= termWidth)
-        {
-            termNewLine();
-            termCR();
-        }
+        termCursX = 0;
+        termLineFeed();
+    }
+
+    term_cell_t *row = termCells + termCursY * termWidth;
+    if (termInsert)
+        memmove(row + termCursX + 1, row + termCursX, (termWidth - 1 - termCursX) * sizeof(term_cell_t));
+
+    uint8_t fg = termBold && termFg < 8 ? termFg + 8 : termFg;
+    uint8_t bg = termBg;
+    if (termReverse)
+    {
+        bg = fg;
+        fg = termBg;
     }
+    row[termCursX] = TERM_CELL(c, fg, bg, termUnderline ? TERM_FLAG_UNDERLINE : 0);
+    termRowDirty[termCursY] = true;
+
+    // The cursor stays on the last column until the next character, like a VT100
+    if (termCursX + 1 < termWidth)
+        termCursX++;
+    else if (termAutoWrap)
+        termWrapPending = true;
+}
+
+static void termReply(const char *s)
+{
+    while (*s)
+        queue_try_add(&kb_queue, s++);
 }
 
-bool termCharAvailable()
+static void termSaveCursor()
 {
-    return !queue_is_empty(&term_screen_queue);
+    termSavedCurs.x = termCursX;
+    termSavedCurs.y = termCursY;
+    termSavedCurs.fg = termFg;
+    termSavedCurs.bg = termBg;
+    termSavedCurs.bold = termBold;
+    termSavedCurs.underline = termUnderline;
+    termSavedCurs.reverse = termReverse;
 }
 
-char termGetChar()
+static void termRestoreCursor()
 {
-    char c;
-    queue_remove_blocking(&term_screen_queue, &c);
-    return c;
+    termMoveTo(termSavedCurs.x, termSavedCurs.y);
+    termFg = termSavedCurs.fg;
+    termBg = termSavedCurs.bg;
+    termBold = termSavedCurs.bold;
+    termUnderline = termSavedCurs.underline;
+    termReverse = termSavedCurs.reverse;
+}
+
+// The alternate screen shares the grid, the main screen is kept in termSaved meanwhile
+static void termSetAltScreen(bool alt)
+{
+    if (alt == termAltScreen)
+        return;
+
+    uint cells = termWidth * (termHeight + 1);
+    if (alt)
+    {
+        memcpy(termSaved, termCells, cells * sizeof(term_cell_t));
+        termAltScreen = true;
+        term_clear_screen();
+    }
+    else
+    {
+        memcpy(termCells, termSaved, cells * sizeof(term_cell_t));
+        termAltScreen = false;
+        termDirtyRows(0, termHeight);
+    }
 }
 
-char termPeekChar()
+static void termReset()
 {
-    char c;
-    queue_peek_blocking(&term_screen_queue, &c);
-    return c;
+    termFg = 7;
+    termBg = 0;
+    termBold = termUnderline = termReverse = false;
+    termAutoWrap = termCursVisible = true;
+    termInsert = termAppCursor = false;
+    termSetAltScreen(false);
+    termTop = 0;
+    termBottom = termHeight;
+    termMoveTo(0, 0);
+    termSaveCursor();
+    term_clear_screen();
 }
 
-const uint16_t termColors[] = {ST77XX_BLACK, ST77XX_BLUE, ST77XX_GREEN, ST77XX_CYAN, ST77XX_RED, ST77XX_MAGENTA, ST77XX_YELLOW, ST77XX_WHITE};
+static uint termParam(uint i, uint def)
+{
+    return i < termParamCount && termParams[i] ? termParams[i] : def;
+}
 
-void runCSI(char csi, uint *param, uint paramCount)
+static void termSGR()
 {
-    // Clear screen
-    if (csi == 'J')
+    if (termParamCount == 0)
     {
-        // Clear everything
-        if (paramCount && param[0] == 2)
-            term_clear_screen();
+        termParamCount = 1;
+        termParams[0] = 0;
+    }
 
-        // Clear everything after cursor
-        else if (paramCount == 0)
+    for (uint i = 0; i < termParamCount; i++)
+    {
+        uint p = termParams[i];
+
+        if (p == 0)
+        {
+            termFg = 7;
+            termBg = 0;
+            termBold = termUnderline = termReverse = false;
+        }
+        else if (p == 1)
+            termBold = true;
+        else if (p == 22)
+            termBold = false;
+        else if (p == 4)
+            termUnderline = true;
+        else if (p == 24)
+            termUnderline = false;
+        else if (p == 7)
+            termReverse = true;
+        else if (p == 27)
+            termReverse = false;
+        else if (p >= 30 && p <= 37)
+            termFg = p - 30;
+        else if (p == 39)
+            termFg = 7;
+        else if (p >= 40 && p <= 47)
+            termBg = p - 40;
+        else if (p == 49)
+            termBg = 0;
+        else if (p >= 90 && p <= 97)
+            termFg = p - 90 + 8;
+        else if (p >= 100 && p <= 107)
+            termBg = p - 100 + 8;
+        else if (p == 38 || p == 48)
         {
-            uint fillPosX = termCursX * fontWidth;
-            uint fillPosY = termCursY * fontHeight;
-            GFX_fillRect(fillPosX, fillPosY, GFX_getWidth() - fillPosX, fontHeight, ST77XX_BLACK);
-            if (termCursY < termHeight)
+            // 256 colours (5;n) or direct colour (2;r;g;b), the latter mapped onto the palette
+            int color = -1;
+            if (termParam(i + 1, 0) == 5 && i + 2 < termParamCount)
             {
-                fillPosY = (termCursY + 1) * fontHeight;
-                GFX_fillRect(0, fillPosY, GFX_getWidth(), GFX_getHeight() - fillPosY, ST77XX_BLACK);
+                color = termParams[i + 2] & 0xFF;
+                i += 2;
             }
-        }
-    }
+            else if (termParam(i + 1, 0) == 2 && i + 4 < termParamCount)
+            {
+                color = termRGBIndex(termParams[i + 2] & 0xFF, termParams[i + 3] & 0xFF, termParams[i + 4] & 0xFF);
+                i += 4;
+            }
+            else
+                i = termParamCount; // Can't tell where it ends
 
-    // Clear in line
-    else if (csi == 'K')
-    {
-        // Clear from cursor to end of line
-        if (paramCount == 0)
-        {
-            uint fillPosX = termCursX * fontWidth;
-            uint fillPosY = termCursY * fontHeight;
-            GFX_fillRect(fillPosX, fillPosY, GFX_getWidth() - fillPosX, fontHeight, ST77XX_BLACK);
+            if (color >= 0 && p == 38)
+                termFg = color;
+            else if (color >= 0)
+                termBg = color;
         }
     }
+}
 
-    // Cursor movement
-    else if (csi == 'H')
+static void termSetMode(bool set)
+{
+    for (uint i = 0; i < termParamCount; i++)
     {
-        // Move to top left corner
-        if (paramCount == 0)
-            term_move_cursor(0, 0);
-        else if (paramCount == 2)
-            term_move_cursor(param[1], param[0]);
-    }
+        uint p = termParams[i];
 
-    // Graphic rendition parameters
-    else if (csi == 'm')
-    {
-        // Reset parameters
-        if (paramCount == 0)
+        if (termPrivate == 0)
         {
-            termFgColor = ST77XX_WHITE;
-            termBgColor = ST77XX_BLACK;
+            if (p == 4)
+                termInsert = set;
         }
-        else
-            for (int i = 0; i < paramCount; i++)
+        else if (termPrivate == '?')
+        {
+            if (p == 1)
+                termAppCursor = set;
+            else if (p == 7)
+                termAutoWrap = set;
+            else if (p == 25)
+                termCursVisible = set;
+            else if (p == 47 || p == 1047)
+                termSetAltScreen(set);
+            else if (p == 1049)
             {
-                // Foreground color
-                if (param[i] >= 30 && param[i] <= 37)
-                    termFgColor = termColors[param[i] - 30];
-                // Background color
-                else if (param[i] >= 40 && param[i] <= 47)
-                    termBgColor = termColors[param[i] - 40];
+                if (set)
+                    termSaveCursor();
+                termSetAltScreen(set);
+                if (!set)
+                    termRestoreCursor();
             }
+        }
     }
 }
 
-void parseCSI(char *s)
+static void termCSIDispatch(char c)
 {
-    uint slen = strlen(s);
+    uint n = termParam(0, 1);
+    term_cell_t *row = termCells + termCursY * termWidth;
 
-    uint params[25];
-    uint paramNum = 0;
-    char csi = s[slen - 1];
+    if (termPrivate && c != 'h' && c != 'l')
+        return; // The only private sequences understood are the DEC modes
 
-    if (slen > 1)
+    switch (c)
     {
-        char *p = strtok(s, ";");
-        while (p != NULL)
+    case 'A': // Cursor up, stopping at the top margin
+    {
+        int top = termCursY >= termTop ? termTop : 0;
+        int y = (int)termCursY - (int)n;
+        termMoveTo(termCursX, y < top ? top : y);
+        break;
+    }
+
+    case 'B': // Cursor down, stopping at the bottom margin
+    case 'e':
+    {
+        uint bottom = termCursY <= termBottom ? termBottom : termHeight;
+        uint y = termCursY + n;
+        termMoveTo(termCursX, y > bottom ? bottom : y);
+        break;
+    }
+
+    case 'C': // Cursor forward
+    case 'a':
+        termMoveTo(termCursX + n, termCursY);
+        break;
+
+    case 'D': // Cursor back
+        termMoveTo((int)termCursX - (int)n, termCursY);
+        break;
+
+    case 'E': // Next line
+        termMoveTo(0, termCursY + n);
+        break;
+
+    case 'F': // Previous line
+        termMoveTo(0, (int)termCursY - (int)n);
+        break;
+
+    case 'G': // Column
+    case '`':
+        termMoveTo(n - 1, termCursY);
+        break;
+
+    case 'd': // Row
+        termMoveTo(termCursX, n - 1);
+        break;
+
+    case 'H': // Position
+    case 'f':
+        termMoveTo(termParam(1, 1) - 1, n - 1);
+        break;
+
+    case 'J': // Erase in display
+        if (termParam(0, 0) == 0)
+            termErase(termCursX, termCursY, 0, termHeight + 1);
+        else if (termParam(0, 0) == 1)
+            termErase(0, 0, termCursX + 1, termCursY);
+        else
+            term_clear_screen();
+        break;
+
+    case 'K': // Erase in line
+        if (termParam(0, 0) == 0)
+            termErase(termCursX, termCursY, termWidth, termCursY);
+        else if (termParam(0, 0) == 1)
+            termErase(0, termCursY, termCursX + 1, termCursY);
+        else
+            termErase(0, termCursY, termWidth, termCursY);
+        break;
+
+    case 'L': // Insert lines
+    case 'M': // Delete lines
+        if (termCursY >= termTop && termCursY <= termBottom)
         {
-            if (strlen(p))
-                params[paramNum++] = atoi(p);
+            if (c == 'L')
+                termScrollDown(termCursY, termBottom, n);
             else
-                params[paramNum++] = 0;
-            p = strtok(NULL, ";");
+                termScrollUp(termCursY, termBottom, n);
+            termMoveTo(0, termCursY);
+        }
+        break;
+
+    case '@': // Insert characters
+    case 'P': // Delete characters
+    case 'X': // Erase characters
+        if (n > termWidth - termCursX)
+            n = termWidth - termCursX;
+        if (c == '@')
+            memmove(row + termCursX + n, row + termCursX, (termWidth - termCursX - n) * sizeof(term_cell_t));
+        else if (c == 'P')
+        {
+            memmove(row + termCursX, row + termCursX + n, (termWidth - termCursX - n) * sizeof(term_cell_t));
+            termFill(termWidth - n, termCursY, n, termBlank());
+        }
+        if (c != 'P')
+            termFill(termCursX, termCursY, n, termBlank());
+        termRowDirty[termCursY] = true;
+        termWrapPending = false;
+        break;
+
+    case 'S': // Scroll up
+        termScrollUp(termTop, termBottom, n);
+        break;
+
+    case 'T': // Scroll down
+        termScrollDown(termTop, termBottom, n);
+        break;
+
+    case 'm':
+        termSGR();
+        break;
+
+    case 'r': // Scroll region
+    {
+        uint top = termParam(0, 1) - 1;
+        uint bottom = termParam(1, termHeight + 1) - 1;
+        if (bottom > termHeight)
+            bottom = termHeight;
+        if (top < bottom)
+        {
+            termTop = top;
+            termBottom = bottom;
+            termMoveTo(0, 0);
         }
+        break;
     }
 
-    runCSI(csi, params, paramNum);
+    case 's':
+        termSaveCursor();
+        break;
+
+    case 'u':
+        termRestoreCursor();
+        break;
+
+    case 'h':
+    case 'l':
+        termSetMode(c == 'h');
+        break;
+
+    case 'n': // Status report
+        if (termParam(0, 0) == 5)
+            termReply("\x1b[0n");
+        else if (termParam(0, 0) == 6)
+        {
+            char s[16];
+            sprintf(s, "\x1b[%u;%uR", termCursY + 1, termCursX + 1);
+            termReply(s);
+        }
+        break;
+
+    case 'c': // Device attributes, a VT100 with advanced video
+        if (termParam(0, 0) == 0)
+            termReply("\x1b[?1;2c");
+        break;
+    }
 }
 
-void vt100Emu()
+static void termEscDispatch(char c)
 {
-    if (!termCharAvailable())
-        return;
+    if (termInter)
+        return; // Character sets, line sizes and alignment tests aren't supported
+
+    switch (c)
+    {
+    case '7':
+        termSaveCursor();
+        break;
+    case '8':
+        termRestoreCursor();
+        break;
+    case 'D': // Index
+        termLineFeed();
+        break;
+    case 'E': // Next line
+        termCursX = 0;
+        termLineFeed();
+        break;
+    case 'M': // Reverse index
+        termReverseIndex();
+        break;
+    case 'c':
+        termReset();
+        break;
+    }
+}
+
+static void termExecute(uint8_t c)
+{
+    switch (c)
+    {
+    case '\b':
+        if (termCursX > 0)
+            termCursX--;
+        termWrapPending = false;
+        break;
+    case '\t':
+        termMoveTo((termCursX + 8) & ~7, termCursY);
+        break;
+    case '\n':
+    case '\v':
+    case '\f':
+        termLineFeed();
+        break;
+    case '\r':
+        termCursX = 0;
+        termWrapPending = false;
+        break;
+    }
+}
 
-    int c = termGetChar();
+static void termClearSequence()
+{
+    termParamCount = 0;
+    termParams[0] = 0;
+    termPrivate = termInter = 0;
+}
 
-    // Handle escape sequences
+// Feeds one byte through the parser, never waits for the rest of a sequence
+static void termInput(uint8_t c)
+{
+    // These act the same from any state
+    if (c == 0x18 || c == 0x1A) // CAN, SUB
+    {
+        termState = TERM_GROUND;
+        return;
+    }
     if (c == ESC)
     {
-        int next = termGetChar();
+        termState = TERM_ESCAPE;
+        termClearSequence();
+        return;
+    }
+    if (termState == TERM_STRING)
+    {
+        if (c == 0x07) // BEL ends an OSC
+            termState = TERM_GROUND;
+        return;
+    }
+    if (c < 0x20 || c == 0x7F)
+    {
+        if (c != 0x7F)
+            termExecute(c);
+        return;
+    }
 
-        // Handle CSI escape sequences
-        if (next == CSI)
+    switch (termState)
+    {
+    case TERM_GROUND:
+        termPrint(c);
+        break;
+
+    case TERM_ESCAPE:
+    case TERM_ESCAPE_INTER:
+        if (c < 0x30)
         {
+            termInter = c;
+            termState = TERM_ESCAPE_INTER;
+        }
+        else if (termState == TERM_ESCAPE && c == CSI)
+            termState = TERM_CSI_PARAM;
+        else if (termState == TERM_ESCAPE && (c == ']' || c == 'P' || c == 'X' || c == '^' || c == '_'))
+            termState = TERM_STRING;
+        else
+        {
+            termEscDispatch(c);
+            termState = TERM_GROUND;
+        }
+        break;
 
-            char s[100];
-            uint cnt = 0;
-            do
-            {
-                next = termPeekChar();
-                if (!isalpha(next))
-                    termGetChar();
-                s[cnt++] = next;
-
-            } while (isdigit(next) || next == ';');
-            s[cnt] = '\0';
-            termGetChar();
-            parseCSI(s);
+    case TERM_CSI_PARAM:
+        if (c >= '0' && c <= '9')
+        {
+            if (termParamCount == 0)
+                termParamCount = 1;
+            uint p = termParams[termParamCount - 1] * 10 + c - '0';
+            termParams[termParamCount - 1] = p > 9999 ? 9999 : p;
+            break;
         }
+        if (c == ';' || c == ':')
+        {
+            if (termParamCount == 0)
+                termParamCount = 1;
+            if (termParamCount < TERM_MAX_PARAMS)
+                termParams[termParamCount++] = 0;
+            break;
+        }
+        if (c >= '<' && c <= '?')
+        {
+            // Private markers only come first
+            if (termParamCount || termPrivate)
+                termState = TERM_CSI_IGNORE;
+            else
+                termPrivate = c;
+            break;
+        }
+        // fall through
+    case TERM_CSI_INTER:
+        if (c < 0x30)
+        {
+            termInter = c;
+            termState = TERM_CSI_INTER;
+        }
+        else if (c >= 0x40)
+        {
+            if (!termInter)
+                termCSIDispatch(c);
+            termState = TERM_GROUND;
+        }
+        else
+            termState = TERM_CSI_IGNORE;
+        break;
+
+    case TERM_CSI_IGNORE:
+        if (c >= 0x40)
+            termState = TERM_GROUND;
+        break;
     }
+}
 
-    else
-        termPrintChar(c); // Handle regular characters
+void initLCDTerm(void)
+{
+    LCD_setPins(LCD_PIN_DC, LCD_PIN_CS, LCD_PIN_RST, LCD_PIN_SCK, LCD_PIN_TX);
+    LCD_initDisplay(LCD_INITR);
+    LCD_setRotation(LCD_ROTATION);
+    GFX_createFramebuf();
+#if EMULATOR_FB
+    // The guest sees the framebuffer as flat memory, so it can't be a ring
+    fb_attach(GFX_getFramebuffer(), GFX_getWidth(), GFX_getHeight());
+#else
+    GFX_enableHwScroll();
+#endif
+
+    PS2_init(PS2_PIN_DATA, PS2_PIN_CK);
+
+    ringbuf_init(&term_screen_ring, term_screen_buf, sizeof(term_screen_buf));
+
+    termWidth = GFX_getWidth() / fontWidth;
+    termHeight = GFX_getHeight() / fontHeight - 1;
+    termInitPalette();
+
+    uint cells = termWidth * (termHeight + 1);
+    termCells = malloc(3 * cells * sizeof(term_cell_t));
+    termShown = termCells + cells;
+    termSaved = termShown + cells;
+    termRowDirty = calloc(termHeight + 1, sizeof(bool));
+    for (uint i = 0; i < 3 * cells; i++)
+        termCells[i] = TERM_BLANK;
+    termReset();
+
+    GFX_clearScreen();
+    GFX_flush();
+}
+
+// Runs whatever the console has queued for the screen through the parser
+void vt100Emu()
+{
+    uint8_t *p;
+    uint32_t n = ringbuf_span(&term_screen_ring, &p);
+    for (uint32_t i = 0; i < n; i++)
+        termInput(p[i]);
+    ringbuf_release(&term_screen_ring, n);
 }
 
 static uint64_t GetTimeMiliseconds()
@@ -257,79 +801,175 @@ static uint64_t GetTimeMiliseconds()
     return to_ms_since_boot(t);
 }
 
-#define TERM_KEY_UP 'A'
-#define TERM_KEY_DOWN 'B'
-#define TERM_KEY_RIGHT 'C'
-#define TERM_KEY_LEFT 'D'
-
-const char csiStr[] = {ESC, CSI};
-
-void termSendArrow(char a)
+// What the keys without a character send, in PS2_KEY_* order: CSI number ~ when
+// there is a number, otherwise CSI final (or SS3 final)
+static const struct
+{
+    uint8_t num;
+    char final;
+} termKeys[] = {
+    {0, 'A'}, {0, 'B'}, {0, 'C'}, {0, 'D'},                       // Arrows
+    {1, '~'}, {2, '~'}, {3, '~'}, {4, '~'}, {5, '~'}, {6, '~'},   // Home, Insert, Delete, End, PgUp, PgDn
+    {0, 'P'}, {0, 'Q'}, {0, 'R'}, {0, 'S'},                       // F1-F4
+    {15, '~'}, {17, '~'}, {18, '~'}, {19, '~'},                   // F5-F8
+    {20, '~'}, {21, '~'}, {23, '~'}, {24, '~'},                   // F9-F12
+};
+
+static void termSendKey(int key)
 {
-    queue_try_add(&kb_queue, csiStr);
-    queue_try_add(&kb_queue, csiStr + 1);
-    queue_try_add(&kb_queue, &a);
+    uint k = (key & PS2_KEY_MASK) - PS2_KEY_UP;
+    if (k >= sizeof(termKeys) / sizeof(termKeys[0]))
+        return;
+
+    // xterm style modifier parameter
+    uint mod = 1 + (key & PS2_MOD_SHIFT ? 1 : 0) + (key & PS2_MOD_ALT ? 2 : 0) + (key & PS2_MOD_CTRL ? 4 : 0);
+    bool ss3 = termKeys[k].final >= 'P' || (termAppCursor && k < 4);
+    char s[16];
+
+    if (termKeys[k].num && mod > 1)
+        sprintf(s, "\x1b[%u;%u~", termKeys[k].num, mod);
+    else if (termKeys[k].num)
+        sprintf(s, "\x1b[%u~", termKeys[k].num);
+    else if (mod > 1)
+        sprintf(s, "\x1b[1;%u%c", mod, termKeys[k].final);
+    else
+        sprintf(s, "\x1b%c%c", ss3 ? 'O' : CSI, termKeys[k].final);
+    termReply(s);
 }
 
 void handlePs2Keyboard(void)
 {
     while (PS2_keyAvailable())
     {
-        char c = PS2_readKey();
+        int key = PS2_readKey();
+        int c = key & PS2_KEY_MASK;
 
-        switch (c)
+        if (c > 0xFF)
+            termSendKey(key);
+        else if (c == PS2_TAB && (key & PS2_MOD_SHIFT))
+            termReply("\x1b[Z");
+        else
         {
-        case PS2_UPARROW:
-            termSendArrow(TERM_KEY_UP);
-            break;
+            // Alt sends ESC first, characters above ASCII go out as UTF-8
+            char s[4] = {0};
+            int n = 0;
+            if (key & PS2_MOD_ALT)
+                s[n++] = ESC;
+            if (c >= 0x80)
+            {
+                s[n++] = 0xC0 | c >> 6;
+                c = 0x80 | (c & 0x3F);
+            }
+            s[n++] = c;
+            for (int i = 0; i < n; i++)
+                queue_try_add(&kb_queue, &s[i]);
+        }
+    }
+}
 
-        case PS2_DOWNARROW:
-            termSendArrow(TERM_KEY_DOWN);
-            break;
+static void termDrawCell(uint x, uint y, term_cell_t cell)
+{
+    uint8_t flags = cell >> 24;
+    uint16_t fg = termPalette[(cell >> 8) & 0xFF];
+    uint16_t bg = termPalette[(cell >> 16) & 0xFF];
+    if (flags & TERM_FLAG_CURSOR)
+    {
+        uint16_t t = fg;
+        fg = bg;
+        bg = t;
+    }
+    GFX_drawChar(x * fontWidth, y * fontHeight, cell & 0xFF, fg, bg, 1, 1);
+    if (flags & TERM_FLAG_UNDERLINE)
+        GFX_drawFastHLine(x * fontWidth, y * fontHeight + fontHeight - 1, fontWidth, fg);
+}
 
-        case PS2_LEFTARROW:
-            termSendArrow(TERM_KEY_LEFT);
-            break;
+// Draws the cells that changed since they were last drawn, the cursor is drawn
+// as part of its cell
+static void termRender()
+{
+    uint cursor = termCursOn && termCursVisible ? termCursY * termWidth + termCursX : UINT32_MAX;
+    termRowDirty[termCursY] = true;
+    termRowDirty[termShownCursY] = true;
+    termShownCursY = termCursY;
 
-        case PS2_RIGHTARROW:
-            termSendArrow(TERM_KEY_RIGHT);
-            break;
+    for (uint y = 0; y <= termHeight; y++)
+    {
+        if (!termRowDirty[y])
+            continue;
+        termRowDirty[y] = false;
 
-        default:
-            queue_try_add(&kb_queue, &c);
-            break;
+        for (uint i = y * termWidth; i < (y + 1) * termWidth; i++)
+        {
+            term_cell_t cell = termCells[i];
+            if (i == cursor)
+                cell |= (uint32_t)TERM_FLAG_CURSOR << 24;
+            if (cell != termShown[i])
+            {
+                termDrawCell(i - y * termWidth, y, cell);
+                termShown[i] = cell;
+            }
         }
     }
 }
 
-void drawCursor(uint x, uint y, bool en)
+#if EMULATOR_FB
+static bool termFbShown = false;
+
+// Once the guest writes its framebuffer the screen is the guest's: send the
+// rows it touched and throw away the console output. After an emulator reset
+// the terminal takes the screen back and repaints it.
+static bool termShowFb()
 {
-    if (en)
-        GFX_drawLine(x * fontWidth, y * fontHeight + fontHeight, (x + 1) * fontWidth, y * fontHeight + fontHeight, ST77XX_WHITE);
-    else
-        GFX_drawLine(x * fontWidth, y * fontHeight + fontHeight, (x + 1) * fontWidth, y * fontHeight + fontHeight, ST77XX_BLACK);
+    if (!fb_active())
+    {
+        if (termFbShown)
+        {
+            for (uint i = 0; i < termWidth * (termHeight + 1); i++)
+                termShown[i] = UINT32_MAX;
+            termDirtyRows(0, termHeight);
+            termFbShown = false;
+        }
+        return false;
+    }
+
+    if (!termFbShown)
+    {
+        GFX_markDirty(0, fb_height());
+        termFbShown = true;
+    }
+    for (uint32_t y = 0; y < fb_height(); y++)
+        if (fb_take_row(y))
+            GFX_markDirty(y, 1);
+
+    uint8_t *p;
+    uint32_t n;
+    while ((n = ringbuf_span(&term_screen_ring, &p)))
+        ringbuf_release(&term_screen_ring, n);
+    return true;
 }
+#endif
 
 void terminal_task(void)
 {
     static uint prevMillis = 0;
-    static uint px, py;
-    static bool en = false;
+#if EMULATOR_FB
+    if (termShowFb())
+    {
+        handlePs2Keyboard();
+        GFX_Update();
+        return;
+    }
+#endif
     vt100Emu();
     handlePs2Keyboard();
     uint millis = GetTimeMiliseconds();
     if (millis > prevMillis + 150)
     {
-        if ((termCursX != px || termCursY != py) && !en)
-            drawCursor(px, py, false);
-        drawCursor(termCursX, termCursY, en);
-        en = !en;
-
-        GFX_Update();
-        px = termCursX;
-        py = termCursY;
+        termCursOn = !termCursOn;
         prevMillis = millis;
     }
+    termRender();
+    GFX_Update();
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,9 +1,9 @@
 #ifndef _TERMINAL_H
 #define _TERMINAL_H
 
-#include "pico/util/queue.h"
+#include "ringbuf.h"
 
-extern queue_t term_screen_queue;
+extern ringbuf_t term_screen_ring;
 
 void terminal_task(void);
 void initLCDTerm(void);
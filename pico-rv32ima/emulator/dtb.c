@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dtb.h"
+#include "fdt.h"
+
+#include "../config/rv32_config.h"
+#include "plic.h"
+#include "../virtio/virtio.h"
+
+#if EMULATOR_RV32C
+#define DTB_ISA_BASE "rv32imac"
+#else
+#define DTB_ISA_BASE "rv32ima"
+#endif
+#if EMULATOR_ZBA_ZBB
+#define DTB_ISA DTB_ISA_BASE "_zba_zbb"
+#else
+#define DTB_ISA DTB_ISA_BASE
+#endif
+
+// Phandles referenced across nodes
+#define PHANDLE_SYSCON 1
+#define PHANDLE_PLIC 2
+#define PHANDLE_CPU(n) (0x10 + (n))
+#define PHANDLE_INTC(n) (0x20 + (n))
+
+// Interrupt numbers on the hart-local interrupt controller
+#define IRQ_M_SOFT 3
+#define IRQ_M_TIMER 7
+#define IRQ_M_EXT 11
+
+void dtb_default_config(dtb_config_t *cfg)
+{
+    cfg->ram_size = EMULATOR_RAM_MB * 1024 * 1024;
+    cfg->timebase = EMULATOR_TIMEBASE_FREQ;
+    cfg->harts = EMULATOR_HARTS;
+    cfg->virtio_mask = 0;
+    cfg->fb_base = cfg->fb_width = cfg->fb_height = 0;
+    strncpy(cfg->bootargs, EMULATOR_BOOTARGS, DTB_BOOTARGS_LEN - 1);
+    cfg->bootargs[DTB_BOOTARGS_LEN - 1] = '\0';
+}
+
+#ifndef EMULATOR_HOST
+
+// Overrides are plain "key=value" lines, '#' starts a comment
+static void dtb_apply_override(dtb_config_t *cfg, char *key, char *value)
+{
+    if (!strcmp(key, "bootargs"))
+    {
+        strncpy(cfg->bootargs, value, DTB_BOOTARGS_LEN - 1);
+        cfg->bootargs[DTB_BOOTARGS_LEN - 1] = '\0';
+    }
+    else if (!strcmp(key, "timebase"))
+    {
+        // Linux divides by it, so keep the default on 0, negatives or garbage
+        char *end;
+        unsigned long timebase = strtoul(value, &end, 0);
+        if (end != value && !end[strspn(end, " \t")] && !strchr(value, '-') && timebase)
+            cfg->timebase = timebase;
+    }
+}
+
+FRESULT dtb_load_overrides(dtb_config_t *cfg, const char *filename)
+{
+    FIL file;
+    FRESULT fr = f_open(&file, filename, FA_READ);
+    if (fr == FR_NO_FILE || fr == FR_NO_PATH)
+        return FR_OK; // Overrides are optional
+    if (FR_OK != fr)
+        return fr;
+
+    char line[DTB_BOOTARGS_LEN + 16];
+    while (f_gets(line, sizeof(line), &file))
+    {
+        line[strcspn(line, "#\r\n")] = '\0';
+
+        char *value = strchr(line, '=');
+        if (!value)
+            continue;
+        *value++ = '\0';
+
+        dtb_apply_override(cfg, line, value);
+    }
+
+    return f_close(&file);
+}
+
+#endif
+
+static void dtb_add_cpus(fdt_t *f, const dtb_config_t *cfg)
+{
+    char name[16];
+
+    fdt_begin_node(f, "cpus");
+    fdt_prop_u32(f, "#address-cells", 1);
+    fdt_prop_u32(f, "#size-cells", 0);
+    fdt_prop_u32(f, "timebase-frequency", cfg->timebase);
+
+    for (uint32_t hart = 0; hart < cfg->harts; hart++)
+    {
+        snprintf(name, sizeof(name), "cpu@%lx", (unsigned long)hart);
+        fdt_begin_node(f, name);
+        fdt_prop_u32(f, "phandle", PHANDLE_CPU(hart));
+        fdt_prop_string(f, "device_type", "cpu");
+        fdt_prop_u32(f, "reg", hart);
+        fdt_prop_string(f, "status", "okay");
+        fdt_prop_string(f, "compatible", "riscv");
+        fdt_prop_string(f, "riscv,isa", DTB_ISA);
+        fdt_prop_string(f, "mmu-type", "riscv,none");
+
+        fdt_begin_node(f, "interrupt-controller");
+        fdt_prop_u32(f, "#interrupt-cells", 1);
+        fdt_prop_empty(f, "interrupt-controller");
+        fdt_prop_string(f, "compatible", "riscv,cpu-intc");
+        fdt_prop_u32(f, "phandle", PHANDLE_INTC(hart));
+        fdt_end_node(f);
+
+        fdt_end_node(f);
+    }
+
+    fdt_begin_node(f, "cpu-map");
+    fdt_begin_node(f, "cluster0");
+    for (uint32_t hart = 0; hart < cfg->harts; hart++)
+    {
+        snprintf(name, sizeof(name), "core%lu", (unsigned long)hart);
+        fdt_begin_node(f, name);
+        fdt_prop_u32(f, "cpu", PHANDLE_CPU(hart));
+        fdt_end_node(f);
+    }
+    fdt_end_node(f);
+    fdt_end_node(f);
+
+    fdt_end_node(f);
+}
+
+static void dtb_add_soc(fdt_t *f, const dtb_config_t *cfg)
+{
+    fdt_begin_node(f, "soc");
+    fdt_prop_u32(f, "#address-cells", 2);
+    fdt_prop_u32(f, "#size-cells", 2);
+    fdt_prop_string(f, "compatible", "simple-bus");
+    fdt_prop_empty(f, "ranges");
+
+    // 8250 UART (used as earlycon)
+    fdt_begin_node(f, "uart@10000000");
+    fdt_prop_u32(f, "clock-frequency", 0x1000000);
+    fdt_prop_reg(f, 0x10000000, 0x100);
+    fdt_prop_string(f, "compatible", "ns16550a");
+    fdt_prop_u32(f, "interrupt-parent", PHANDLE_PLIC);
+    fdt_prop_u32(f, "interrupts", PLIC_IRQ_UART);
+    fdt_end_node(f);
+
+    // SYSCON based poweroff and reboot
+    fdt_begin_node(f, "poweroff");
+    fdt_prop_u32(f, "value", 0x5555);
+    fdt_prop_u32(f, "offset", 0);
+    fdt_prop_u32(f, "regmap", PHANDLE_SYSCON);
+    fdt_prop_string(f, "compatible", "syscon-poweroff");
+    fdt_end_node(f);
+
+    fdt_begin_node(f, "reboot");
+    fdt_prop_u32(f, "value", 0x7777);
+    fdt_prop_u32(f, "offset", 0);
+    fdt_prop_u32(f, "regmap", PHANDLE_SYSCON);
+    fdt_prop_string(f, "compatible", "syscon-reboot");
+    fdt_end_node(f);
+
+    fdt_begin_node(f, "syscon@11100000");
+    fdt_prop_u32(f, "phandle", PHANDLE_SYSCON);
+    fdt_prop_reg(f, 0x11100000, 0x1000);
+    fdt_prop_string(f, "compatible", "syscon");
+    fdt_end_node(f);
+
+    // CLINT, wired to the software and timer interrupts of every hart
+    uint32_t clint_irqs[4 * cfg->harts];
+    for (uint32_t hart = 0; hart < cfg->harts; hart++)
+    {
+        clint_irqs[hart * 4 + 0] = PHANDLE_INTC(hart);
+        clint_irqs[hart * 4 + 1] = IRQ_M_SOFT;
+        clint_irqs[hart * 4 + 2] = PHANDLE_INTC(hart);
+        clint_irqs[hart * 4 + 3] = IRQ_M_TIMER;
+    }
+
+    static const char clint_compat[] = "sifive,clint0\0riscv,clint0";
+    fdt_begin_node(f, "clint@11000000");
+    fdt_prop_cells(f, "interrupts-extended", clint_irqs, 4 * cfg->harts);
+    fdt_prop_reg(f, 0x11000000, 0x10000);
+    fdt_prop(f, "compatible", clint_compat, sizeof(clint_compat));
+    fdt_end_node(f);
+
+    // PLIC, only the M-mode external interrupt of hart 0 is implemented
+    static const char plic_compat[] = "sifive,plic-1.0.0\0riscv,plic0";
+    const uint32_t plic_irqs[] = {PHANDLE_INTC(0), IRQ_M_EXT};
+    char name[32];
+    snprintf(name, sizeof(name), "plic@%lx", (unsigned long)PLIC_BASE);
+    fdt_begin_node(f, name);
+    fdt_prop_u32(f, "phandle", PHANDLE_PLIC);
+    fdt_prop_u32(f, "riscv,ndev", PLIC_NDEV);
+    fdt_prop_cells(f, "interrupts-extended", plic_irqs, 2);
+    fdt_prop_empty(f, "interrupt-controller");
+    fdt_prop_u32(f, "#interrupt-cells", 1);
+    fdt_prop_u32(f, "#address-cells", 0);
+    fdt_prop_reg(f, PLIC_BASE, PLIC_SIZE);
+    fdt_prop(f, "compatible", plic_compat, sizeof(plic_compat));
+    fdt_end_node(f);
+
+    for (uint32_t slot = 0; slot < VIRTIO_MMIO_SLOTS; slot++)
+    {
+        if (!(cfg->virtio_mask & (1 << slot)))
+            continue;
+
+        snprintf(name, sizeof(name), "virtio_mmio@%lx", (unsigned long)VIRTIO_MMIO_ADDR(slot));
+        fdt_begin_node(f, name);
+        fdt_prop_u32(f, "interrupt-parent", PHANDLE_PLIC);
+        fdt_prop_u32(f, "interrupts", PLIC_IRQ_VIRTIO(slot));
+        fdt_prop_reg(f, VIRTIO_MMIO_ADDR(slot), VIRTIO_MMIO_STRIDE);
+        fdt_prop_string(f, "compatible", "virtio,mmio");
+        fdt_end_node(f);
+    }
+
+    if (cfg->fb_width)
+    {
+        snprintf(name, sizeof(name), "framebuffer@%lx", (unsigned long)cfg->fb_base);
+        fdt_begin_node(f, name);
+        fdt_prop_reg(f, cfg->fb_base, cfg->fb_width * cfg->fb_height * 2);
+        fdt_prop_u32(f, "width", cfg->fb_width);
+        fdt_prop_u32(f, "height", cfg->fb_height);
+        fdt_prop_u32(f, "stride", cfg->fb_width * 2);
+        fdt_prop_string(f, "format", "r5g6b5");
+        fdt_prop_string(f, "compatible", "simple-framebuffer");
+        fdt_end_node(f);
+    }
+
+    fdt_end_node(f);
+}
+
+// Returns the size of the generated blob, or 0 if it did not fit
+uint32_t dtb_build(const dtb_config_t *cfg, uint8_t *buf, uint32_t size)
+{
+    static fdt_t f; // Too big for the core 1 stack
+    fdt_begin(&f, buf, size);
+
+    fdt_begin_node(&f, "");
+    fdt_prop_u32(&f, "#address-cells", 2);
+    fdt_prop_u32(&f, "#size-cells", 2);
+    fdt_prop_string(&f, "compatible", "riscv-minimal-nommu");
+    fdt_prop_string(&f, "model", "riscv-minimal-nommu,qemu");
+
+    fdt_begin_node(&f, "chosen");
+    fdt_prop_string(&f, "bootargs", cfg->bootargs);
+    fdt_end_node(&f);
+
+    fdt_begin_node(&f, "memory@80000000");
+    fdt_prop_string(&f, "device_type", "memory");
+    fdt_prop_reg(&f, 0x80000000, cfg->ram_size);
+    fdt_end_node(&f);
+
+    dtb_add_cpus(&f, cfg);
+    dtb_add_soc(&f, cfg);
+
+    fdt_end_node(&f);
+
+    return fdt_finish(&f);
+}
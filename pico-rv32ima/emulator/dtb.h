@@ -0,0 +1,42 @@
+#ifndef _DTB_H
+#define _DTB_H
+
+#include <stdint.h>
+
+#ifndef EMULATOR_HOST
+#include "ff.h"
+#endif
+
+#define DTB_BOOTARGS_LEN 256
+#define DTB_MAX_SIZE 2048
+
+// Machine description the device tree is generated from
+typedef struct
+{
+    uint32_t ram_size; // Bytes of RAM handed to the guest (excluding the DTB itself)
+    uint32_t timebase; // CLINT timer frequency in Hz
+    uint32_t harts;
+    uint32_t virtio_mask; // virtio-mmio slots with a device behind them
+    uint32_t fb_base, fb_width, fb_height; // simple-framebuffer (r5g6b5), none if fb_width is 0
+    char bootargs[DTB_BOOTARGS_LEN];
+} dtb_config_t;
+
+// CLINT ticks at the given timebase, split so neither conversion overflows
+static inline uint64_t dtb_us_to_ticks(uint64_t us, uint32_t timebase)
+{
+    return us / 1000000 * timebase + us % 1000000 * timebase / 1000000;
+}
+
+// Rounded up, so sleeping this long always reaches the tick
+static inline uint64_t dtb_ticks_to_us(uint64_t ticks, uint32_t timebase)
+{
+    return ticks / timebase * 1000000 + (ticks % timebase * 1000000 + timebase - 1) / timebase;
+}
+
+void dtb_default_config(dtb_config_t *cfg);
+#ifndef EMULATOR_HOST
+FRESULT dtb_load_overrides(dtb_config_t *cfg, const char *filename);
+#endif
+uint32_t dtb_build(const dtb_config_t *cfg, uint8_t *buf, uint32_t size);
+
+#endif
@@ -9,28 +9,45 @@
 
 #include "../psram/psram.h"
 #include "../cache/cache.h"
+#include "../cache/xip.h"
 #include "../emulator/emulator.h"
 
 #include "f_util.h"
 #include "ff.h"
+#include "hw_config.h"
+#include "sd_card.h"
 
-#include "default64mbdtc.h"
+#include "dtb.h"
+#include "plic.h"
+#include "fb.h"
+
+#include "../virtio/virtio.h"
+#include "../virtio/virtio_blk.h"
+#include "../virtio/virtio_console.h"
+
+#include "../trace/trace.h"
 
 #include "../config/rv32_config.h"
 
 static uint32_t HandleException(uint32_t ir, uint32_t retval);
-static uint32_t HandleControlStore(uint32_t addy, uint32_t val);
+static uint32_t HandleControlStore(uint32_t addy, uint32_t val, uint32_t size);
 static uint32_t HandleControlLoad(uint32_t addy);
 static void HandleOtherCSRWrite(uint8_t *image, uint16_t csrno, uint32_t value);
 static uint32_t HandleOtherCSRRead(uint8_t *image, uint16_t csrno);
 static int IsKBHit();
+static bool UpdateInterrupts(void);
 static int ReadKBByte();
 
 static uint64_t GetTimeMicroseconds();
-static void MiniSleep();
+static void MiniSleep(uint64_t timerDelta);
+static uint32_t timebaseHz = EMULATOR_TIMEBASE_FREQ;
 
-FRESULT loadFileIntoRAM(const char *imageFilename, uint32_t addr);
+FRESULT loadFileIntoRAM(const char *imageFilename, uint32_t addr, uint32_t *loaded);
 void loadDataIntoRAM(const unsigned char *d, uint32_t addr, uint32_t size);
+uint32_t loadDTBIntoRAM(void);
+static void initDevices(void);
+static void TraceOpen(void);
+static void TraceDrain(bool all);
 
 #define MINIRV32WARN(x...) console_printf(x);
 #define MINIRV32_DECORATE static
@@ -52,10 +69,12 @@ void loadDataIntoRAM(const unsigned char *d, uint32_t addr, uint32_t size);
             retval = HandleException(ir, retval);     \
     }
 #endif
-#define MINIRV32_HANDLE_MEM_STORE_CONTROL(addy, val) \
-    if (HandleControlStore(addy, val))               \
+// The access width comes from funct3 of the store being executed
+#define MINIRV32_HANDLE_MEM_STORE_CONTROL(addy, val)         \
+    if (HandleControlStore(addy, val, 1 << ((ir >> 12) & 3))) \
         return val;
 #define MINIRV32_HANDLE_MEM_LOAD_CONTROL(addy, rval) rval = HandleControlLoad(addy);
+#define MINIRV32_EXTERNAL_IRQ() UpdateInterrupts()
 #define MINIRV32_OTHERCSR_WRITE(csrno, value) HandleOtherCSRWrite(image, csrno, value);
 #define MINIRV32_OTHERCSR_READ(csrno, rval)      \
     {                                            \
@@ -114,21 +133,62 @@ static int8_t MINIRV32_LOAD1_SIGNED(uint32_t ofs)
     return val;
 }
 
+#if EMULATOR_FAST_RV32M
+#include "rv32m_rp2040.h"
+#endif
+
+#if EMULATOR_RV32C
+#define MINIRV32_RV32C
+#endif
+#if EMULATOR_ZBA_ZBB
+#define MINIRV32_ZBA_ZBB
+#endif
+
+#if EMULATOR_TRACE
+// Log every access the core makes, with the PC of the instruction making it
+#define MINIRV32_STORE4(ofs, val) (trace_access(pc, ofs, 4, TRACE_STORE), MINIRV32_STORE4(ofs, val))
+#define MINIRV32_STORE2(ofs, val) (trace_access(pc, ofs, 2, TRACE_STORE), MINIRV32_STORE2(ofs, val))
+#define MINIRV32_STORE1(ofs, val) (trace_access(pc, ofs, 1, TRACE_STORE), MINIRV32_STORE1(ofs, val))
+#define MINIRV32_LOAD4(ofs) (trace_access(pc, ofs, 4, TRACE_LOAD), MINIRV32_LOAD4(ofs))
+#define MINIRV32_LOAD2(ofs) (trace_access(pc, ofs, 2, TRACE_LOAD), MINIRV32_LOAD2(ofs))
+#define MINIRV32_LOAD2_SIGNED(ofs) (trace_access(pc, ofs, 2, TRACE_LOAD), MINIRV32_LOAD2_SIGNED(ofs))
+#define MINIRV32_LOAD1(ofs) (trace_access(pc, ofs, 1, TRACE_LOAD), MINIRV32_LOAD1(ofs))
+#define MINIRV32_LOAD1_SIGNED(ofs) (trace_access(pc, ofs, 1, TRACE_LOAD), MINIRV32_LOAD1_SIGNED(ofs))
+#endif
+
 #include "mini-rv32ima.h"
 
+#if EMULATOR_TRACE
+#undef MINIRV32_STORE4
+#undef MINIRV32_STORE2
+#undef MINIRV32_STORE1
+#undef MINIRV32_LOAD4
+#undef MINIRV32_LOAD2
+#undef MINIRV32_LOAD2_SIGNED
+#undef MINIRV32_LOAD1
+#undef MINIRV32_LOAD1_SIGNED
+#endif
+
+static uint64_t TimerDelta(struct MiniRV32IMAState *c);
+
 // static void DumpState(struct MiniRV32IMAState *core);
 static void DumpState(struct MiniRV32IMAState *core)
 {
 	unsigned int pc = core->pc;
 	unsigned int *regs = (unsigned int *)core->regs;
 	uint64_t thit, taccessed;
-    thit = taccessed = 0;
+    uint64_t shit, saccessed;
+    uint64_t zfills, zdrops;
     uint64_t writes, reads;
 
-	// cache_get_stat(&thit, &taccessed);
+	cache_get_stat(&thit, &taccessed);
+    cache_get_tier_stat(&shit, &saccessed);
+    cache_get_zero_stat(&zfills, &zdrops);
     RAMGetStat(&reads, &writes);
 
+	console_printf("\x1b[32mSRAM tier: hit: %llu, accessed: %llu\n\r", shit, saccessed);
 	console_printf("\x1b[32mCache: hit: %llu, accessed: %llu\n\r", thit, taccessed);
+	console_printf("\x1b[32mZero pages: fills: %llu, dropped stores: %llu\n\r", zfills, zdrops);
     console_printf("\x1b[32mRAM: read: %llu, write: %llu\n\r", reads, writes);
 	console_printf("\x1b[32mPC: %08x\r\n", pc);
 }
@@ -136,20 +196,22 @@ struct MiniRV32IMAState core;
 
 int rvEmulator()
 {
-    uint32_t dtb_ptr = MINI_RV32_RAM_SIZE - sizeof(default64mbdtb);
-    const uint32_t *dtb = default64mbdtb;
+    // Drop anything cached from a previous run before RAM is reloaded
+    cache_reset();
 
-    FRESULT fr = loadFileIntoRAM(IMAGE_FILENAME, 0);
+    uint32_t imageSize;
+    FRESULT fr = loadFileIntoRAM(IMAGE_FILENAME, 0, &imageSize);
     if (FR_OK != fr)
         console_panic("\r\x1b[31mError loading image: %s (%d)\r\n", FRESULT_str(fr), fr);
     console_printf("\r\x1b[32mImage loaded sucessfuly!\x1b[m\n\n\r");
 
-    uint32_t validram = dtb_ptr;
-    loadDataIntoRAM(default64mbdtb, dtb_ptr, sizeof(default64mbdtb));
+    initDevices();
+    uint32_t dtb_ptr = loadDTBIntoRAM();
+
+    // Everything between the image and the device tree starts out as zero
+    cache_mark_zero(imageSize, dtb_ptr - imageSize);
 
-    // Tell linux on how much ram we have
-    uint32_t dtbRamValue = (validram >> 24) | (((validram >> 16) & 0xff) << 8) | (((validram >> 8) & 0xff) << 16) | ((validram & 0xff) << 24);
-    MINIRV32_STORE4(dtb_ptr + 0x13c, dtbRamValue);
+    TraceOpen();
 
     // Setup the Emulator Core
     core.regs[10] = 0x00;                                                // hart ID
@@ -159,24 +221,33 @@ int rvEmulator()
     core.pc = MINIRV32_RAM_IMAGE_OFFSET;
 
     // Start the Emulator
-    #if !EMULATOR_FIXED_UPDATE
-        uint64_t lastTime = GetTimeMicroseconds() / EMULATOR_TIME_DIV;
+    #if EMULATOR_FIXED_UPDATE
+        uint64_t lastTime = 0;
+    #else
+        uint64_t lastTime = dtb_us_to_ticks(GetTimeMicroseconds(), timebaseHz);
     #endif
 
     while(true) {
         // Check if the H/W trigger is pulled
         if(gpio_get(2) != 1) { console_printf("\x1b[33mH/W Trig Stop!"); DumpState(&core); break; }
+
+        TraceDrain(false);
         
         // If not, continue the emulator
         uint64_t *this_ccount = ((uint64_t *)&core.cyclel);
         uint32_t elapsedUs = 0;
         #if EMULATOR_FIXED_UPDATE
-            elapsedUs = *this_ccount / EMULATOR_TIME_DIV;
+            elapsedUs = dtb_us_to_ticks(*this_ccount, timebaseHz) - lastTime;
+            lastTime += elapsedUs;
         #else
-            elapsedUs = GetTimeMicroseconds() / EMULATOR_TIME_DIV - lastTime;
+            elapsedUs = dtb_us_to_ticks(GetTimeMicroseconds(), timebaseHz) - lastTime;
             lastTime += elapsedUs;
         #endif
 
+        #if EMULATOR_VIRTIO_CONSOLE
+            virtio_console_poll();
+        #endif
+
         int ret = MiniRV32IMAStep(&core, NULL, 0, elapsedUs, EMUALTOR_INSTR_FLIP); // Execute upto 1024 cycles before breaking out.
         switch (ret)
         {
@@ -185,8 +256,17 @@ int rvEmulator()
             break;
         case 1:
             // Return code 1 means WFI (Wait For Intrrupt)
-            MiniSleep();
-            *this_ccount += EMUALTOR_INSTR_FLIP;
+            #if EMULATOR_FIXED_UPDATE
+                // Nothing happens until the next timer match, skip straight to it
+                // (bounded, elapsedUs is only 32 bits wide)
+                if (TimerDelta(&core) < (1 << 30) && !IsKBHit())
+                    *this_ccount += dtb_ticks_to_us(TimerDelta(&core) + 1, timebaseHz);
+                else
+                    *this_ccount += EMUALTOR_INSTR_FLIP;
+            #else
+                MiniSleep(TimerDelta(&core));
+                *this_ccount += EMUALTOR_INSTR_FLIP;
+            #endif
             break;
         case 3:
             // Return code 3 means illegal opcode
@@ -195,13 +275,16 @@ int rvEmulator()
         case 0x7777:
             // 0x7777 is the syscon for REBOOT
             console_printf("\n\x1b[32mREBOOT@0x%08x%08x\n", core.cycleh, core.cyclel);
+            TraceDrain(true);
             return EMU_REBOOT; // syscon code for reboot
         case 0x5555:
             // 0x5555 is the syscon for POWEROFF
             console_printf("\n\x1b[32mPOWEROFF@0x%08x%08x\n", core.cycleh, core.cyclel);
+            TraceDrain(true);
             return EMU_POWEROFF; // syscon code for power-off
         default:
             console_printf("\\x1b[31mUnknown failure (%d)!\n", ret);
+            TraceDrain(true);
             return EMU_UNKNOWN;
             break;
         }
@@ -209,6 +292,7 @@ int rvEmulator()
     
     // Hardware POWEROFF
     console_printf("\nH/W POWEROFF@0x%08x%08x\n", core.cycleh, core.cyclel);
+    TraceDrain(true);
     return EMU_POWEROFF;
 }
 
@@ -290,23 +374,92 @@ static inline uint32_t HandleOtherCSRRead(uint8_t *image, uint16_t csrno)
     return 0;
 }
 
-// MMIO handling (8250 UART)
+// MMIO handling (8250 UART, PLIC, virtio devices, framebuffer)
 
-static uint32_t HandleControlStore(uint32_t addy, uint32_t val)
+#define UART_IER_RDI 0x01  // Receive data interrupt enable
+#define UART_IER_THRI 0x02 // Transmit holding register empty interrupt enable
+#define UART_LCR_DLAB 0x80 // Divisor latch access, offsets 0 and 1 become the divisor
+
+static uint8_t uart_ier, uart_lcr;
+
+static inline virtio_mmio_t *VirtioDevice(uint32_t addy)
 {
-    if (addy == 0x10000000) // UART 8250 / 16550 Data Buffer
+    if (addy < VIRTIO_MMIO_BASE || addy >= VIRTIO_MMIO_ADDR(VIRTIO_MMIO_SLOTS))
+        return NULL;
+    return virtio_devices[(addy - VIRTIO_MMIO_BASE) / VIRTIO_MMIO_STRIDE];
+}
+
+// Sample the device interrupt lines, returns the state of MEIP
+static bool UpdateInterrupts(void)
+{
+    // Transmission is instant, so THRE is always set
+    plic_set_level(PLIC_IRQ_UART, ((uart_ier & UART_IER_RDI) && IsKBHit()) || (uart_ier & UART_IER_THRI));
+
+    for (uint32_t slot = 0; slot < VIRTIO_MMIO_SLOTS; slot++)
+        if (virtio_devices[slot])
+            plic_set_level(PLIC_IRQ_VIRTIO(slot), virtio_irq_pending(virtio_devices[slot]));
+
+    return plic_irq_pending();
+}
+
+static uint32_t HandleControlStore(uint32_t addy, uint32_t val, uint32_t size)
+{
+    virtio_mmio_t *dev;
+
+    if (addy == 0x10000003) // UART Line Control
+        uart_lcr = val;
+    else if ((addy == 0x10000000 || addy == 0x10000001) && (uart_lcr & UART_LCR_DLAB))
+        ; // Baud rate divisor, nothing to do
+    else if (addy == 0x10000000) // UART 8250 / 16550 Data Buffer
         console_putc(val);
+    else if (addy == 0x10000001) // UART Interrupt Enable
+        uart_ier = val & (UART_IER_RDI | UART_IER_THRI);
+    else if (addy >= PLIC_BASE && addy < PLIC_BASE + PLIC_SIZE)
+        plic_store(addy - PLIC_BASE, val);
+    else if ((dev = VirtioDevice(addy)))
+        virtio_mmio_store(dev, addy & (VIRTIO_MMIO_STRIDE - 1), val);
+#if EMULATOR_FB
+    else if (addy - EMULATOR_FB_BASE < fb_size())
+        fb_store(addy - EMULATOR_FB_BASE, val, size);
+#endif
 
     return 0;
 }
 
 static uint32_t HandleControlLoad(uint32_t addy)
 {
+    virtio_mmio_t *dev;
+
+    if (addy >= PLIC_BASE && addy < PLIC_BASE + PLIC_SIZE)
+    {
+        // Let a claim see lines raised since the start of this step
+        UpdateInterrupts();
+        return plic_load(addy - PLIC_BASE);
+    }
+    else if ((dev = VirtioDevice(addy)))
+        return virtio_mmio_load(dev, addy & (VIRTIO_MMIO_STRIDE - 1));
+#if EMULATOR_FB
+    else if (addy - EMULATOR_FB_BASE < fb_size())
+        return fb_load(addy - EMULATOR_FB_BASE);
+#endif
+
     // Emulating a 8250 / 16550 UART
     if (addy == 0x10000005)
         return 0x60 | IsKBHit();
     else if (addy == 0x10000000 && IsKBHit())
         return ReadKBByte();
+    else if (addy == 0x10000001)
+        return uart_ier;
+    else if (addy == 0x10000003)
+        return uart_lcr;
+    else if (addy == 0x10000002) // Interrupt Identification
+    {
+        if ((uart_ier & UART_IER_RDI) && IsKBHit())
+            return 0x04; // Received data available
+        if (uart_ier & UART_IER_THRI)
+            return 0x02; // Transmit holding register empty
+        return 0x01;     // No interrupt pending
+    }
 
     return 0;
 }
@@ -318,16 +471,53 @@ static inline uint64_t GetTimeMicroseconds()
     return to_us_since_boot(t);
 }
 
-static void MiniSleep()
+// Timer ticks until the timer interrupt fires, UINT64_MAX if it isn't armed
+static uint64_t TimerDelta(struct MiniRV32IMAState *c)
+{
+    uint64_t match = ((uint64_t)c->timermatchh << 32) | c->timermatchl;
+    uint64_t now = ((uint64_t)c->timerh << 32) | c->timerl;
+    if (!match)
+        return UINT64_MAX;
+    return match > now ? match - now : 0;
+}
+
+// Sleep until the next timer match, waking early on input or a device interrupt
+static void MiniSleep(uint64_t timerDelta)
 {
     #if EMULATOR_WFI_SLEEP
-        sleep_ms(1);
+        // Cap the sleep so the H/W stop trigger is still noticed
+        uint64_t sleepUs = EMULATOR_WFI_MAX_SLEEP_US;
+        if (timerDelta < dtb_us_to_ticks(sleepUs, timebaseHz))
+            sleepUs = dtb_ticks_to_us(timerDelta + 1, timebaseHz);
+        absolute_time_t deadline = make_timeout_time_us(sleepUs);
+
+        // Console input is added from core 0, which wakes us from WFE
+        while (!IsKBHit() && !UpdateInterrupts())
+            if (best_effort_wfe_or_timeout(deadline))
+                break;
     #endif
 }
 
 // Memory and file loading
 
-FRESULT loadFileIntoRAM(const char *imageFilename, uint32_t addr)
+typedef struct
+{
+    uint32_t addr;
+    uint32_t left;
+} load_stream_t;
+
+// Each chunk goes to PSRAM while the card reads the next one
+static bool loadStreamChunk(void *ctx, const uint8_t *data, uint32_t blocks)
+{
+    load_stream_t *ls = ctx;
+    uint32_t len = blocks * FF_MAX_SS < ls->left ? blocks * FF_MAX_SS : ls->left;
+    accessPSRAM(ls->addr, len, true, (void *)data);
+    ls->addr += len;
+    ls->left -= len;
+    return true;
+}
+
+FRESULT loadFileIntoRAM(const char *imageFilename, uint32_t addr, uint32_t *loaded)
 {
     FIL imageFile;
     FRESULT fr = f_open(&imageFile, imageFilename, FA_READ);
@@ -335,25 +525,53 @@ FRESULT loadFileIntoRAM(const char *imageFilename, uint32_t addr)
         return fr;
 
     FSIZE_t imageSize = f_size(&imageFile);
+    if (loaded)
+        *loaded = imageSize;
+
+#if EMULATOR_XIP_FLASH
+    // The start of the kernel image is mirrored into flash and fetched through XIP until written
+    xip_map(addr == 0 ? imageSize : 0);
+#endif
 
-    uint8_t buf[4096];
-    while (imageSize >= 4096)
+    uint8_t buf[4096] __attribute__((aligned(4)));
+    sd_card_t *sd = sd_get_by_num(0);
+    LBA_t lba;
+    if (imageSize && sd && f_contiguous_lba(&imageFile, &lba))
+    {
+        // Contiguous images stream straight off the card, bypassing FatFs
+        load_stream_t ls = {addr, imageSize};
+        if (sd_read_stream(sd, lba, (imageSize + FF_MAX_SS - 1) / FF_MAX_SS, buf, sizeof(buf) / FF_MAX_SS,
+                           loadStreamChunk, &ls) != 0)
+        {
+            f_close(&imageFile);
+            return FR_DISK_ERR;
+        }
+    }
+    else
     {
-        fr = f_read(&imageFile, buf, 4096, NULL);
-        if (FR_OK != fr)
-            return fr;
-        accessPSRAM(addr, 4096, true, buf);
-        addr += 4096;
-        imageSize -= 4096;
+        uint32_t ofs = 0;
+        while (ofs < imageSize)
+        {
+            UINT len = imageSize - ofs < sizeof(buf) ? imageSize - ofs : sizeof(buf);
+            fr = f_read(&imageFile, buf, len, NULL);
+            if (FR_OK != fr)
+            {
+                f_close(&imageFile);
+                return fr;
+            }
+            accessPSRAM(addr + ofs, len, true, buf);
+            ofs += len;
+        }
     }
 
-    if (imageSize)
+#if EMULATOR_XIP_FLASH
+    // Program the flash mirror from what landed in PSRAM, a sector at a time
+    for (uint32_t ofs = 0; ofs + 4096 <= imageSize && addr + ofs + 4096 <= XIP_FLASH_SIZE; ofs += 4096)
     {
-        fr = f_read(&imageFile, buf, imageSize, NULL);
-        if (FR_OK != fr)
-            return fr;
-        accessPSRAM(addr, imageSize, true, buf);
+        accessPSRAM(addr + ofs, 4096, false, buf);
+        xip_program(addr + ofs, buf, 4096);
     }
+#endif
 
     fr = f_close(&imageFile);
     return fr;
@@ -361,6 +579,128 @@ FRESULT loadFileIntoRAM(const char *imageFilename, uint32_t addr)
 
 void loadDataIntoRAM(const unsigned char *d, uint32_t addr, uint32_t size)
 {
-    while (size--) 
-        accessPSRAM(addr++, 1, true, (void*) d++);
+    accessPSRAM(addr, size, true, (void *)d);
+}
+
+// Memory access tracing
+
+#if EMULATOR_TRACE
+
+static FIL trace_file;
+static bool trace_file_open;
+
+static void TraceOpen(void)
+{
+    FRESULT fr = f_open(&trace_file, TRACE_FILENAME, FA_WRITE | FA_CREATE_ALWAYS);
+    if (FR_OK != fr)
+    {
+        console_printf("\r\x1b[33mNot tracing: %s (%d)\r\n", FRESULT_str(fr), fr);
+        return;
+    }
+    trace_file_open = true;
+    trace_start();
+}
+
+// Write the trace out in whole sectors once enough has built up, or everything
+// (and close the file) when the emulator stops
+static void TraceDrain(bool all)
+{
+    static uint8_t block[512];
+    static uint32_t unsynced;
+
+    if (!trace_file_open || (!all && trace_pending() < TRACE_BUFFER_SIZE / 4))
+        return;
+
+    while (trace_pending() >= (all ? 1 : sizeof(block)))
+    {
+        UINT len = trace_read(block, sizeof(block)), written;
+        FRESULT fr = f_write(&trace_file, block, len, &written);
+        if (FR_OK != fr || written != len)
+        {
+            console_printf("\r\x1b[33mTrace write failed: %s (%d)\r\n", FRESULT_str(fr), fr);
+            all = true;
+            break;
+        }
+
+        // Keep the file usable if the board is reset instead of powered off
+        unsynced += len;
+        if (unsynced >= 256 * 1024)
+        {
+            f_sync(&trace_file);
+            unsynced = 0;
+        }
+    }
+
+    if (all)
+    {
+        trace_stop();
+        f_close(&trace_file);
+        trace_file_open = false;
+        console_printf("\r\nTrace: %llu records, %llu dropped\r\n", trace.records, trace.dropped);
+    }
+}
+
+#else
+
+static void TraceOpen(void) {}
+static void TraceDrain(bool all) {}
+
+#endif
+
+// Attach the emulated devices, must run before the device tree is generated
+static void initDevices(void)
+{
+    plic_reset();
+    uart_ier = uart_lcr = 0;
+    virtio_unregister_all();
+
+#if EMULATOR_VIRTIO_BLK
+    FRESULT fr = virtio_blk_init(VIRTIO_BLK_IMAGE);
+    if (FR_OK != fr)
+        console_printf("\r\x1b[33mNo virtio disk: %s (%d)\r\n", FRESULT_str(fr), fr);
+#endif
+
+#if EMULATOR_VIRTIO_CONSOLE
+    virtio_console_init();
+#endif
+
+#if EMULATOR_FB
+    fb_reset();
+#endif
+}
+
+// Generate the device tree and place it at the top of RAM, returns its offset
+uint32_t loadDTBIntoRAM(void)
+{
+    static uint8_t dtb[DTB_MAX_SIZE];
+    dtb_config_t cfg;
+
+    dtb_default_config(&cfg);
+    for (uint32_t slot = 0; slot < VIRTIO_MMIO_SLOTS; slot++)
+        if (virtio_devices[slot])
+            cfg.virtio_mask |= 1 << slot;
+#if EMULATOR_FB
+    cfg.fb_base = EMULATOR_FB_BASE;
+    cfg.fb_width = fb_width();
+    cfg.fb_height = fb_height();
+#endif
+    FRESULT fr = dtb_load_overrides(&cfg, EMULATOR_DTB_OVERRIDES);
+    if (FR_OK != fr)
+        console_printf("\r\x1b[33mIgnoring DTB overrides: %s (%d)\r\n", FRESULT_str(fr), fr);
+
+    // The blob size doesn't depend on the RAM size, so measure it first to
+    // tell Linux how much RAM is left below it
+    uint32_t size = dtb_build(&cfg, dtb, sizeof(dtb));
+    if (!size)
+        console_panic("\r\x1b[31mDevice tree does not fit in %d bytes!\r\n", DTB_MAX_SIZE);
+
+    uint32_t dtb_ptr = (MINI_RV32_RAM_SIZE - size) & ~7;
+    cfg.ram_size = dtb_ptr;
+    dtb_build(&cfg, dtb, sizeof(dtb));
+
+    // The CLINT ticks at whatever rate the guest was told
+    timebaseHz = cfg.timebase;
+
+    loadDataIntoRAM(dtb, dtb_ptr, size);
+    return dtb_ptr;
 }
@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "fb.h"
+
+static uint16_t *fb_pixels;
+static uint32_t fb_w, fb_h, fb_bytes;
+static volatile uint8_t *fb_dirty; // One flag per row, set by the emulator, cleared by core 0
+static volatile bool fb_written;
+
+// Called by core 0 once the LCD is up, before the emulator starts
+void fb_attach(uint16_t *pixels, uint32_t width, uint32_t height)
+{
+    fb_dirty = calloc(height, 1);
+    if (!pixels || !fb_dirty)
+        return;
+    fb_pixels = pixels;
+    fb_w = width;
+    fb_h = height;
+    fb_bytes = width * height * sizeof(uint16_t);
+}
+
+// The LCD stays with the terminal until the guest draws again
+void fb_reset(void)
+{
+    fb_written = false;
+}
+
+uint32_t fb_width(void)
+{
+    return fb_w;
+}
+
+uint32_t fb_height(void)
+{
+    return fb_h;
+}
+
+uint32_t fb_size(void)
+{
+    return fb_bytes;
+}
+
+bool fb_active(void)
+{
+    return fb_written;
+}
+
+// The core narrows the result to the access width, so the byte at offset goes in the low bits
+uint32_t fb_load(uint32_t offset)
+{
+    uint32_t val = 0;
+    uint32_t len = fb_bytes - offset < 4 ? fb_bytes - offset : 4;
+    memcpy(&val, (uint8_t *)fb_pixels + offset, len);
+    return val;
+}
+
+void fb_store(uint32_t offset, uint32_t val, uint32_t size)
+{
+    if (offset + size > fb_bytes)
+        return;
+    memcpy((uint8_t *)fb_pixels + offset, &val, size);
+
+    uint32_t stride = fb_w * sizeof(uint16_t);
+    fb_dirty[offset / stride] = 1;
+    fb_dirty[(offset + size - 1) / stride] = 1;
+    fb_written = true;
+}
+
+// Core 0: true if row y changed since the last call. The flag is cleared before
+// the row is sent, so a write racing with the transfer flags it again.
+bool fb_take_row(uint32_t y)
+{
+    if (!fb_dirty[y])
+        return false;
+    fb_dirty[y] = 0;
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef _FB_H
+#define _FB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Guest framebuffer (simple-framebuffer, r5g6b5). The pixels are the LCD
+// framebuffer in SRAM, written directly by the emulator core, which flags
+// every row it touches. Core 0 takes the flags and sends those rows to the LCD.
+
+void fb_attach(uint16_t *pixels, uint32_t width, uint32_t height);
+void fb_reset(void);
+
+uint32_t fb_width(void);
+uint32_t fb_height(void);
+uint32_t fb_size(void);
+bool fb_active(void);
+
+uint32_t fb_load(uint32_t offset);
+void fb_store(uint32_t offset, uint32_t val, uint32_t size);
+
+bool fb_take_row(uint32_t y);
+
+#endif
@@ -0,0 +1,181 @@
+#include <string.h>
+
+#include "fdt.h"
+
+#define FDT_MAGIC 0xd00dfeed
+#define FDT_VERSION 17
+#define FDT_LAST_COMP_VERSION 16
+
+#define FDT_BEGIN_NODE 0x1
+#define FDT_END_NODE 0x2
+#define FDT_PROP 0x3
+#define FDT_END 0x9
+
+// Header (40 bytes) followed by an empty memory reservation map (16 bytes)
+#define FDT_HEADER_SIZE 40
+#define FDT_RSVMAP_SIZE 16
+#define FDT_STRUCT_OFFSET (FDT_HEADER_SIZE + FDT_RSVMAP_SIZE)
+
+static inline uint32_t cpu_to_fdt32(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
+static void fdt_put(fdt_t *f, const void *data, uint32_t len)
+{
+    if (f->overflow || f->pos + len > f->size)
+    {
+        f->overflow = true;
+        return;
+    }
+    memcpy(f->buf + f->pos, data, len);
+    f->pos += len;
+}
+
+static void fdt_put_u32(fdt_t *f, uint32_t v)
+{
+    v = cpu_to_fdt32(v);
+    fdt_put(f, &v, 4);
+}
+
+static void fdt_align(fdt_t *f)
+{
+    static const uint8_t zero[4] = {0};
+    fdt_put(f, zero, (4 - (f->pos & 3)) & 3);
+}
+
+static uint32_t fdt_string_offset(fdt_t *f, const char *name)
+{
+    uint32_t len = strlen(name) + 1;
+
+    // Reuse an existing entry if this name was seen before
+    uint32_t ofs = 0;
+    while (ofs < f->strings_len)
+    {
+        if (!strcmp(f->strings + ofs, name))
+            return ofs;
+        ofs += strlen(f->strings + ofs) + 1;
+    }
+
+    if (f->strings_len + len > FDT_MAX_STRINGS)
+    {
+        f->overflow = true;
+        return 0;
+    }
+
+    memcpy(f->strings + f->strings_len, name, len);
+    f->strings_len += len;
+    return ofs;
+}
+
+void fdt_begin(fdt_t *f, uint8_t *buf, uint32_t size)
+{
+    f->buf = buf;
+    f->size = size;
+    f->pos = 0;
+    f->depth = 0;
+    f->overflow = false;
+    f->strings_len = 0;
+
+    if (size < FDT_STRUCT_OFFSET)
+    {
+        f->overflow = true;
+        return;
+    }
+
+    // Header is filled in by fdt_finish, reservation map stays empty
+    memset(buf, 0, FDT_STRUCT_OFFSET);
+    f->pos = FDT_STRUCT_OFFSET;
+}
+
+uint32_t fdt_finish(fdt_t *f)
+{
+    if (f->depth)
+        f->overflow = true;
+
+    fdt_put_u32(f, FDT_END);
+    uint32_t struct_size = f->pos - FDT_STRUCT_OFFSET;
+
+    uint32_t strings_offset = f->pos;
+    fdt_put(f, f->strings, f->strings_len);
+    fdt_align(f);
+
+    if (f->overflow)
+        return 0;
+
+    uint32_t header[10] = {
+        FDT_MAGIC,
+        f->pos,              // totalsize
+        FDT_STRUCT_OFFSET,   // off_dt_struct
+        strings_offset,      // off_dt_strings
+        FDT_HEADER_SIZE,     // off_mem_rsvmap
+        FDT_VERSION,         // version
+        FDT_LAST_COMP_VERSION,
+        0,                   // boot_cpuid_phys
+        f->strings_len,      // size_dt_strings
+        struct_size,         // size_dt_struct
+    };
+
+    for (int i = 0; i < 10; i++)
+        header[i] = cpu_to_fdt32(header[i]);
+    memcpy(f->buf, header, sizeof(header));
+
+    return f->pos;
+}
+
+void fdt_begin_node(fdt_t *f, const char *name)
+{
+    fdt_put_u32(f, FDT_BEGIN_NODE);
+    fdt_put(f, name, strlen(name) + 1);
+    fdt_align(f);
+    f->depth++;
+}
+
+void fdt_end_node(fdt_t *f)
+{
+    fdt_put_u32(f, FDT_END_NODE);
+    if (f->depth)
+        f->depth--;
+    else
+        f->overflow = true;
+}
+
+void fdt_prop(fdt_t *f, const char *name, const void *data, uint32_t len)
+{
+    fdt_put_u32(f, FDT_PROP);
+    fdt_put_u32(f, len);
+    fdt_put_u32(f, fdt_string_offset(f, name));
+    fdt_put(f, data, len);
+    fdt_align(f);
+}
+
+void fdt_prop_empty(fdt_t *f, const char *name)
+{
+    fdt_prop(f, name, NULL, 0);
+}
+
+void fdt_prop_u32(fdt_t *f, const char *name, uint32_t val)
+{
+    fdt_prop_cells(f, name, &val, 1);
+}
+
+void fdt_prop_cells(fdt_t *f, const char *name, const uint32_t *cells, uint32_t count)
+{
+    fdt_put_u32(f, FDT_PROP);
+    fdt_put_u32(f, count * 4);
+    fdt_put_u32(f, fdt_string_offset(f, name));
+    for (uint32_t i = 0; i < count; i++)
+        fdt_put_u32(f, cells[i]);
+}
+
+void fdt_prop_string(fdt_t *f, const char *name, const char *str)
+{
+    fdt_prop(f, name, str, strlen(str) + 1);
+}
+
+// reg property for a bus with #address-cells = <2> and #size-cells = <2>
+void fdt_prop_reg(fdt_t *f, uint64_t addr, uint64_t size)
+{
+    uint32_t cells[4] = {addr >> 32, addr, size >> 32, size};
+    fdt_prop_cells(f, "reg", cells, 4);
+}
@@ -0,0 +1,39 @@
+#ifndef _FDT_H
+#define _FDT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Minimal flattened device tree writer.
+// Nodes and properties are emitted in order into the structure block,
+// property names are deduplicated into a small string table which is
+// appended when the blob is finished.
+
+#define FDT_MAX_STRINGS 512
+
+typedef struct
+{
+    uint8_t *buf;
+    uint32_t size;
+    uint32_t pos;
+    uint32_t depth;
+    bool overflow;
+
+    char strings[FDT_MAX_STRINGS];
+    uint32_t strings_len;
+} fdt_t;
+
+void fdt_begin(fdt_t *f, uint8_t *buf, uint32_t size);
+uint32_t fdt_finish(fdt_t *f);
+
+void fdt_begin_node(fdt_t *f, const char *name);
+void fdt_end_node(fdt_t *f);
+
+void fdt_prop(fdt_t *f, const char *name, const void *data, uint32_t len);
+void fdt_prop_empty(fdt_t *f, const char *name);
+void fdt_prop_u32(fdt_t *f, const char *name, uint32_t val);
+void fdt_prop_cells(fdt_t *f, const char *name, const uint32_t *cells, uint32_t count);
+void fdt_prop_string(fdt_t *f, const char *name, const char *str);
+void fdt_prop_reg(fdt_t *f, uint64_t addr, uint64_t size);
+
+#endif
@@ -111,6 +111,197 @@ MINIRV32_DECORATE int32_t MiniRV32IMAStep( struct MiniRV32IMAState * state, uint
 #define REGSET( x, val ) { state->regs[x] = val; }
 #endif
 
+#ifdef MINIRV32_RV32C
+// Expand a 16-bit RV32C instruction to its 32-bit equivalent, 0 if it's illegal.
+static uint32_t MiniRV32DecompressC( uint32_t c )
+{
+	uint32_t rd = ( c >> 7 ) & 0x1f;          // rd/rs1 (CI, CR)
+	uint32_t rs2 = ( c >> 2 ) & 0x1f;         // rs2 (CR, CSS)
+	uint32_t rdp = ( ( c >> 2 ) & 7 ) + 8;    // rd'/rs2' (CIW, CL, CS)
+	uint32_t rs1p = ( ( c >> 7 ) & 7 ) + 8;   // rs1'/rd' (CL, CS, CA, CB)
+	int32_t imm6 = ( ( c >> 7 ) & 0x20 ) | ( ( c >> 2 ) & 0x1f );
+	if( imm6 & 0x20 ) imm6 |= 0xffffffc0;     // Sign extension.
+
+	#define C_ITYPE( op, f3, rd, rs1, imm ) ( ( (uint32_t)(imm) << 20 ) | ( (rs1) << 15 ) | ( (f3) << 12 ) | ( (rd) << 7 ) | (op) )
+	#define C_RTYPE( op, f3, f7, rd, rs1, rs2 ) ( ( (f7) << 25 ) | ( (rs2) << 20 ) | ( (rs1) << 15 ) | ( (f3) << 12 ) | ( (rd) << 7 ) | (op) )
+	#define C_STYPE( f3, rs1, rs2, imm ) ( ( ( (imm) >> 5 ) << 25 ) | ( (rs2) << 20 ) | ( (rs1) << 15 ) | ( (f3) << 12 ) | ( ( (imm) & 0x1f ) << 7 ) | 0x23 )
+
+	switch( ( ( c >> 11 ) & 0x1c ) | ( c & 3 ) ) // funct3:quadrant
+	{
+		case 0x00: // C.ADDI4SPN
+		{
+			uint32_t imm = ( ( c >> 7 ) & 0x30 ) | ( ( c >> 1 ) & 0x3c0 ) | ( ( c >> 4 ) & 4 ) | ( ( c >> 2 ) & 8 );
+			if( !imm ) return 0; // Also catches the all zero instruction.
+			return C_ITYPE( 0x13, 0, rdp, 2, imm );
+		}
+		case 0x08: // C.LW
+		case 0x18: // C.SW
+		{
+			uint32_t imm = ( ( c >> 7 ) & 0x38 ) | ( ( c >> 4 ) & 4 ) | ( ( c << 1 ) & 0x40 );
+			return ( c & 0x8000 ) ? C_STYPE( 2, rs1p, rdp, imm ) : C_ITYPE( 0x03, 2, rdp, rs1p, imm );
+		}
+		case 0x01: // C.ADDI, C.NOP
+			return C_ITYPE( 0x13, 0, rd, rd, imm6 );
+		case 0x05: // C.JAL
+		case 0x15: // C.J
+		{
+			uint32_t off = ( ( c >> 1 ) & 0x800 ) | ( ( c >> 7 ) & 0x10 ) | ( ( c >> 1 ) & 0x300 ) | ( ( c << 2 ) & 0x400 ) |
+				( ( c >> 1 ) & 0x40 ) | ( ( c << 1 ) & 0x80 ) | ( ( c >> 2 ) & 0xe ) | ( ( c << 3 ) & 0x20 );
+			if( off & 0x800 ) off |= 0xfffff000;
+			return ( ( off & 0x100000 ) << 11 ) | ( ( off & 0x7fe ) << 20 ) | ( ( off & 0x800 ) << 9 ) | ( off & 0xff000 ) |
+				( ( ( c & 0x8000 ) ? 0 : 1 ) << 7 ) | 0x6f;
+		}
+		case 0x09: // C.LI
+			return C_ITYPE( 0x13, 0, rd, 0, imm6 );
+		case 0x0d: // C.ADDI16SP, C.LUI
+			if( rd == 2 )
+			{
+				int32_t imm = ( ( c >> 3 ) & 0x200 ) | ( ( c >> 2 ) & 0x10 ) | ( ( c << 1 ) & 0x40 ) | ( ( c << 4 ) & 0x180 ) | ( ( c << 3 ) & 0x20 );
+				if( !imm ) return 0;
+				if( imm & 0x200 ) imm |= 0xfffffc00;
+				return C_ITYPE( 0x13, 0, 2, 2, imm );
+			}
+			if( !imm6 ) return 0;
+			return ( (uint32_t)imm6 << 12 ) | ( rd << 7 ) | 0x37;
+		case 0x11: // Arithmetic on rs1'
+			switch( ( c >> 10 ) & 3 )
+			{
+				case 0: // C.SRLI
+				case 1: // C.SRAI
+					if( c & 0x1000 ) return 0; // shamt[5] is reserved on RV32
+					return C_ITYPE( 0x13, 5, rs1p, rs1p, ( ( c & 0x400 ) ? 0x400 : 0 ) | imm6 );
+				case 2: // C.ANDI
+					return C_ITYPE( 0x13, 7, rs1p, rs1p, imm6 );
+				default:
+				{
+					static const uint8_t f3[4] = { 0, 4, 6, 7 }; // C.SUB, C.XOR, C.OR, C.AND
+					uint32_t op = ( c >> 5 ) & 3;
+					if( c & 0x1000 ) return 0; // C.SUBW/C.ADDW are RV64 only
+					return C_RTYPE( 0x33, f3[op], op ? 0 : 0x20, rs1p, rs1p, rdp );
+				}
+			}
+		case 0x19: // C.BEQZ
+		case 0x1d: // C.BNEZ
+		{
+			uint32_t off = ( ( c >> 4 ) & 0x100 ) | ( ( c >> 7 ) & 0x18 ) | ( ( c << 1 ) & 0xc0 ) | ( ( c >> 2 ) & 6 ) | ( ( c << 3 ) & 0x20 );
+			if( off & 0x100 ) off |= 0xfffffe00;
+			return ( ( off & 0x1000 ) << 19 ) | ( ( off & 0x7e0 ) << 20 ) | ( rs1p << 15 ) | ( ( ( c >> 13 ) & 1 ) << 12 ) |
+				( ( off & 0x1e ) << 7 ) | ( ( off & 0x800 ) >> 4 ) | 0x63;
+		}
+		case 0x02: // C.SLLI
+			if( c & 0x1000 ) return 0;
+			return C_ITYPE( 0x13, 1, rd, rd, imm6 );
+		case 0x0a: // C.LWSP
+		{
+			uint32_t imm = ( ( c >> 7 ) & 0x20 ) | ( ( c >> 2 ) & 0x1c ) | ( ( c << 4 ) & 0xc0 );
+			if( !rd ) return 0;
+			return C_ITYPE( 0x03, 2, rd, 2, imm );
+		}
+		case 0x12: // C.JR, C.MV, C.EBREAK, C.JALR, C.ADD
+			if( !( c & 0x1000 ) )
+			{
+				if( rs2 ) return C_RTYPE( 0x33, 0, 0, rd, 0, rs2 );   // C.MV
+				if( !rd ) return 0;
+				return C_ITYPE( 0x67, 0, 0, rd, 0 );                  // C.JR
+			}
+			if( rs2 ) return C_RTYPE( 0x33, 0, 0, rd, rd, rs2 );      // C.ADD
+			if( !rd ) return 0x00100073;                              // C.EBREAK
+			return C_ITYPE( 0x67, 0, 1, rd, 0 );                      // C.JALR
+		case 0x1a: // C.SWSP
+		{
+			uint32_t imm = ( ( c >> 7 ) & 0x3c ) | ( ( c >> 1 ) & 0xc0 );
+			return C_STYPE( 2, 2, rs2, imm );
+		}
+	}
+
+	#undef C_ITYPE
+	#undef C_RTYPE
+	#undef C_STYPE
+
+	return 0; // Floating point and reserved encodings.
+}
+#endif
+
+#ifdef MINIRV32_ZBA_ZBB
+// Zba/Zbb instructions sharing the OP and OP-IMM opcodes, returns 0 if ir is not one of them.
+static int MiniRV32Bitmanip( uint32_t ir, uint32_t is_reg, uint32_t rs1, uint32_t rs2, uint32_t * rval )
+{
+	uint32_t funct7 = ir >> 25;
+	uint32_t funct3 = ( ir >> 12 ) & 7;
+
+	if( is_reg )
+	{
+		switch( funct7 )
+		{
+			case 0x10: // SH1ADD, SH2ADD, SH3ADD
+				if( !( funct3 & 1 ) && funct3 ) { *rval = ( rs1 << ( funct3 >> 1 ) ) + rs2; return 1; }
+				break;
+			case 0x20: // Inverted logic, SUB and SRA are left to the base decoder
+				switch( funct3 )
+				{
+					case 4: *rval = ~( rs1 ^ rs2 ); return 1; // XNOR
+					case 6: *rval = rs1 | ~rs2; return 1;     // ORN
+					case 7: *rval = rs1 & ~rs2; return 1;     // ANDN
+				}
+				break;
+			case 0x05: // MIN, MINU, MAX, MAXU
+				switch( funct3 )
+				{
+					case 4: *rval = ( (int32_t)rs1 < (int32_t)rs2 ) ? rs1 : rs2; return 1;
+					case 5: *rval = ( rs1 < rs2 ) ? rs1 : rs2; return 1;
+					case 6: *rval = ( (int32_t)rs1 > (int32_t)rs2 ) ? rs1 : rs2; return 1;
+					case 7: *rval = ( rs1 > rs2 ) ? rs1 : rs2; return 1;
+				}
+				break;
+			case 0x30: // ROL, ROR
+				if( funct3 == 1 ) { *rval = ( rs1 << ( rs2 & 31 ) ) | ( rs1 >> ( ( 32 - rs2 ) & 31 ) ); return 1; }
+				if( funct3 == 5 ) { *rval = ( rs1 >> ( rs2 & 31 ) ) | ( rs1 << ( ( 32 - rs2 ) & 31 ) ); return 1; }
+				break;
+			case 0x04: // ZEXT.H
+				if( funct3 == 4 && !( ( ir >> 20 ) & 0x1f ) ) { *rval = rs1 & 0xffff; return 1; }
+				break;
+		}
+		return 0;
+	}
+
+	uint32_t imm = ir >> 20;
+	if( funct3 == 1 && funct7 == 0x30 )
+	{
+		switch( imm & 0x1f )
+		{
+			case 0: *rval = rs1 ? __builtin_clz( rs1 ) : 32; return 1;   // CLZ
+			case 1: *rval = rs1 ? __builtin_ctz( rs1 ) : 32; return 1;   // CTZ
+			case 2: *rval = __builtin_popcount( rs1 ); return 1;         // CPOP
+			case 4: *rval = (int8_t)rs1; return 1;                       // SEXT.B
+			case 5: *rval = (int16_t)rs1; return 1;                      // SEXT.H
+		}
+	}
+	else if( funct3 == 5 )
+	{
+		if( funct7 == 0x30 ) // RORI
+		{
+			uint32_t shamt = imm & 0x1f;
+			*rval = ( rs1 >> shamt ) | ( rs1 << ( ( 32 - shamt ) & 31 ) );
+			return 1;
+		}
+		if( imm == 0x698 ) // REV8
+		{
+			*rval = ( rs1 >> 24 ) | ( ( rs1 >> 8 ) & 0xff00 ) | ( ( rs1 << 8 ) & 0xff0000 ) | ( rs1 << 24 );
+			return 1;
+		}
+		if( imm == 0x287 ) // ORC.B
+		{
+			uint32_t r = 0;
+			for( int i = 0; i < 32; i += 8 )
+				if( rs1 & ( 0xffu << i ) ) r |= 0xffu << i;
+			*rval = r;
+			return 1;
+		}
+	}
+	return 0;
+}
+#endif
+
 #ifndef MINIRV32_STEPPROTO
 MINIRV32_DECORATE int32_t MiniRV32IMAStep( struct MiniRV32IMAState * state, uint8_t * image, uint32_t vProcAddress, uint32_t elapsedUs, int count )
 #else
@@ -130,6 +321,17 @@ MINIRV32_STEPPROTO
 	else
 		CSR( mip ) &= ~(1<<7);
 
+#ifdef MINIRV32_EXTERNAL_IRQ
+	// External interrupt line (MEIP), driven by the platform interrupt controller.
+	if( MINIRV32_EXTERNAL_IRQ() )
+		CSR( mip ) |= 1<<11;
+	else
+		CSR( mip ) &= ~(1<<11);
+
+	if( CSR( mip ) & CSR( mie ) & (1<<11) )
+		CSR( extraflags ) &= ~4; // Clear WFI
+#endif
+
 	// If WFI, don't run processor.
 	if( CSR( extraflags ) & 4 )
 		return 1;
@@ -139,7 +341,13 @@ MINIRV32_STEPPROTO
 	uint32_t pc = CSR( pc );
 	uint32_t cycle = CSR( cyclel );
 
-	if( ( CSR( mip ) & (1<<7) ) && ( CSR( mie ) & (1<<7) /*mtie*/ ) && ( CSR( mstatus ) & 0x8 /*mie*/) )
+	if( ( CSR( mip ) & (1<<11) ) && ( CSR( mie ) & (1<<11) /*meie*/ ) && ( CSR( mstatus ) & 0x8 /*mie*/) )
+	{
+		// External interrupt, takes priority over the timer.
+		trap = 0x8000000b;
+		pc -= 4;
+	}
+	else if( ( CSR( mip ) & (1<<7) ) && ( CSR( mie ) & (1<<7) /*mtie*/ ) && ( CSR( mstatus ) & 0x8 /*mie*/) )
 	{
 		// Timer interrupt.
 		trap = 0x80000007;
@@ -149,6 +357,7 @@ MINIRV32_STEPPROTO
 	for( int icount = 0; icount < count; icount++ )
 	{
 		uint32_t ir = 0;
+		uint32_t ilen = 4; // Instruction length, 2 for compressed instructions
 		rval = 0;
 		cycle++;
 		uint32_t ofs_pc = pc - MINIRV32_RAM_IMAGE_OFFSET;
@@ -158,14 +367,48 @@ MINIRV32_STEPPROTO
 			trap = 1 + 1;  // Handle access violation on instruction read.
 			break;
 		}
+#ifdef MINIRV32_RV32C
+		else if( ofs_pc & 1 )
+#else
 		else if( ofs_pc & 3 )
+#endif
 		{
 			trap = 1 + 0;  //Handle PC-misaligned access
 			break;
 		}
 		else
 		{
+#ifdef MINIRV32_RV32C
+			if( ofs_pc & 2 )
+			{
+				// Only halfword aligned, so a 32-bit instruction may span two cache lines.
+				ir = MINIRV32_LOAD2( ofs_pc );
+				if( ( ir & 3 ) == 3 )
+				{
+					if( ofs_pc + 2 >= MINI_RV32_RAM_SIZE )
+					{
+						trap = 1 + 1;
+						break;
+					}
+					ir |= (uint32_t)MINIRV32_LOAD2( ofs_pc + 2 ) << 16;
+				}
+			}
+			else
+				ir = MINIRV32_LOAD4( ofs_pc );
+
+			if( ( ir & 3 ) != 3 )
+			{
+				ilen = 2;
+				ir = MiniRV32DecompressC( ir & 0xffff );
+				if( !ir )
+				{
+					trap = 2 + 1; // Illegal compressed instruction.
+					break;
+				}
+			}
+#else
 			ir = MINIRV32_LOAD4( ofs_pc );
+#endif
 			uint32_t rdid = (ir >> 7) & 0x1f;
 
 			switch( ir & 0x7f )
@@ -180,16 +423,16 @@ MINIRV32_STEPPROTO
 				{
 					int32_t reladdy = ((ir & 0x80000000)>>11) | ((ir & 0x7fe00000)>>20) | ((ir & 0x00100000)>>9) | ((ir&0x000ff000));
 					if( reladdy & 0x00100000 ) reladdy |= 0xffe00000; // Sign extension.
-					rval = pc + 4;
-					pc = pc + reladdy - 4;
+					rval = pc + ilen;
+					pc = pc + reladdy - ilen;
 					break;
 				}
 				case 0x67: // JALR (0b1100111)
 				{
 					uint32_t imm = ir >> 20;
 					int32_t imm_se = imm | (( imm & 0x800 )?0xfffff000:0);
-					rval = pc + 4;
-					pc = ( (REG( (ir >> 15) & 0x1f ) + imm_se) & ~1) - 4;
+					rval = pc + ilen;
+					pc = ( (REG( (ir >> 15) & 0x1f ) + imm_se) & ~1) - ilen;
 					break;
 				}
 				case 0x63: // Branch (0b1100011)
@@ -198,7 +441,7 @@ MINIRV32_STEPPROTO
 					if( immm4 & 0x1000 ) immm4 |= 0xffffe000;
 					int32_t rs1 = REG((ir >> 15) & 0x1f);
 					int32_t rs2 = REG((ir >> 20) & 0x1f);
-					immm4 = pc + immm4 - 4;
+					immm4 = pc + immm4 - ilen;
 					rdid = 0;
 					switch( ( ir >> 12 ) & 0x7 )
 					{
@@ -231,7 +474,17 @@ MINIRV32_STEPPROTO
 							else if( rsval == 0x1100bff8 )
 								rval = CSR( timerl );
 							else
+							{
 								MINIRV32_HANDLE_MEM_LOAD_CONTROL( rsval, rval );
+								// Narrow the device register to the access width
+								switch( ( ir >> 12 ) & 0x7 )
+								{
+									case 0: rval = (int8_t)rval; break;
+									case 1: rval = (int16_t)rval; break;
+									case 4: rval = (uint8_t)rval; break;
+									case 5: rval = (uint16_t)rval; break;
+								}
+							}
 						}
 						else
 						{
@@ -275,7 +528,7 @@ MINIRV32_STEPPROTO
 								CSR( timermatchl ) = rs2;
 							else if( addy == 0x11100000 ) //SYSCON (reboot, poweroff, etc.)
 							{
-								SETCSR( pc, pc + 4 );
+								SETCSR( pc, pc + ilen );
 								return rs2; // NOTE: PC will be PC of Syscon.
 							}
 							else
@@ -309,7 +562,7 @@ MINIRV32_STEPPROTO
 					uint32_t is_reg = !!( ir & 0x20 );
 					uint32_t rs2 = is_reg ? REG(imm & 0x1f) : imm;
 
-					if( is_reg && ( ir & 0x02000000 ) )
+					if( is_reg && ( ir & 0xfe000000 ) == 0x02000000 )
 					{
 						switch( (ir>>12)&7 ) //0x02000000 = RV32M
 						{
@@ -321,12 +574,20 @@ MINIRV32_STEPPROTO
 #else
 							CUSTOM_MULH
 #endif
+#ifndef CUSTOM_DIV
 							case 4: if( rs2 == 0 ) rval = -1; else rval = ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) ? rs1 : ((int32_t)rs1 / (int32_t)rs2); break; // DIV
 							case 5: if( rs2 == 0 ) rval = 0xffffffff; else rval = rs1 / rs2; break; // DIVU
 							case 6: if( rs2 == 0 ) rval = rs1; else rval = ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) ? 0 : ((uint32_t)((int32_t)rs1 % (int32_t)rs2)); break; // REM
 							case 7: if( rs2 == 0 ) rval = rs1; else rval = rs1 % rs2; break; // REMU
+#else
+							CUSTOM_DIV
+#endif
 						}
 					}
+#ifdef MINIRV32_ZBA_ZBB
+					else if( MiniRV32Bitmanip( ir, is_reg, rs1, rs2, &rval ) )
+						;
+#endif
 					else
 					{
 						switch( (ir>>12)&7 ) // These could be either op-immediate or op commands.  Be careful.
@@ -370,7 +631,11 @@ MINIRV32_STEPPROTO
 						case 0x342: rval = CSR( mcause ); break;
 						case 0x343: rval = CSR( mtval ); break;
 						case 0xf11: rval = 0xff0ff0ff; break; //mvendorid
+#ifdef MINIRV32_RV32C
+						case 0x301: rval = 0x40401105; break; //misa (XLEN=32, IMAC+X)
+#else
 						case 0x301: rval = 0x40401101; break; //misa (XLEN=32, IMA+X)
+#endif
 						//case 0x3B0: rval = 0; break; //pmpaddr0
 						//case 0x3a0: rval = 0; break; //pmpcfg0
 						//case 0xf12: rval = 0x00000000; break; //marchid
@@ -420,7 +685,7 @@ MINIRV32_STEPPROTO
 						{
 							CSR( mstatus ) |= 8;    //Enable interrupts
 							CSR( extraflags ) |= 4; //Infor environment we want to go to sleep.
-							SETCSR( pc, pc + 4 );
+							SETCSR( pc, pc + ilen );
 							return 1;
 						}
 						else if( ( ( csrno & 0xff ) == 0x02 ) )  // MRET
@@ -432,7 +697,7 @@ MINIRV32_STEPPROTO
 							uint32_t startextraflags = CSR( extraflags );
 							SETCSR( mstatus , (( startmstatus & 0x80) >> 4) | ((startextraflags&3) << 11) | 0x80 );
 							SETCSR( extraflags, (startextraflags & ~3) | ((startmstatus >> 11) & 3) );
-							pc = CSR( mepc ) -4;
+							pc = CSR( mepc ) - ilen;
 						}
 						else
 						{
@@ -509,7 +774,7 @@ MINIRV32_STEPPROTO
 
 		MINIRV32_POSTEXEC( pc, ir, trap );
 
-		pc += 4;
+		pc += ilen;
 	}
 
 	// Handle traps and interrupts.
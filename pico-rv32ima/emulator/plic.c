@@ -0,0 +1,122 @@
+#include <string.h>
+
+#include "plic.h"
+
+// Register offsets (context 0 only)
+#define PLIC_PRIORITY 0x000000
+#define PLIC_PENDING 0x001000
+#define PLIC_ENABLE 0x002000
+#define PLIC_THRESHOLD 0x200000
+#define PLIC_CLAIM 0x200004
+
+#define PLIC_PRIORITY_MASK 7
+
+static uint8_t priority[PLIC_NDEV + 1];
+static uint32_t level;   // Current state of the source lines
+static uint32_t pending; // Latched by the gateway, cleared by a claim
+static uint32_t claimed; // In service until completed
+static uint32_t enable;
+static uint32_t threshold;
+
+void plic_reset(void)
+{
+    memset(priority, 0, sizeof(priority));
+    level = pending = claimed = enable = threshold = 0;
+}
+
+// Sources are level triggered, a line held high is pending again after completion
+void plic_set_level(uint32_t irq, bool high)
+{
+    if (irq == 0 || irq > PLIC_NDEV)
+        return;
+
+    uint32_t bit = 1u << irq;
+    if (high)
+    {
+        level |= bit;
+        if (!(claimed & bit))
+            pending |= bit;
+    }
+    else
+    {
+        level &= ~bit;
+        pending &= ~bit;
+    }
+}
+
+// Highest priority pending and enabled source above the threshold, 0 if none
+static uint32_t plic_best(void)
+{
+    uint32_t candidates = pending & enable;
+    uint32_t best = 0, best_prio = threshold;
+
+    if (!candidates)
+        return 0;
+
+    for (uint32_t irq = 1; irq <= PLIC_NDEV; irq++)
+    {
+        if ((candidates & (1u << irq)) && priority[irq] > best_prio)
+        {
+            best = irq;
+            best_prio = priority[irq];
+        }
+    }
+    return best;
+}
+
+bool plic_irq_pending(void)
+{
+    return plic_best() != 0;
+}
+
+uint32_t plic_load(uint32_t offset)
+{
+    if (offset < PLIC_PENDING)
+    {
+        uint32_t irq = offset / 4;
+        return irq <= PLIC_NDEV ? priority[irq] : 0;
+    }
+    else if (offset == PLIC_PENDING)
+        return pending;
+    else if (offset == PLIC_ENABLE)
+        return enable;
+    else if (offset == PLIC_THRESHOLD)
+        return threshold;
+    else if (offset == PLIC_CLAIM)
+    {
+        uint32_t irq = plic_best();
+        if (irq)
+        {
+            pending &= ~(1u << irq);
+            claimed |= 1u << irq;
+        }
+        return irq;
+    }
+
+    return 0;
+}
+
+void plic_store(uint32_t offset, uint32_t val)
+{
+    if (offset < PLIC_PENDING)
+    {
+        uint32_t irq = offset / 4;
+        if (irq && irq <= PLIC_NDEV)
+            priority[irq] = val & PLIC_PRIORITY_MASK;
+    }
+    else if (offset == PLIC_ENABLE)
+        enable = val & ~1u; // Source 0 doesn't exist
+    else if (offset == PLIC_THRESHOLD)
+        threshold = val & PLIC_PRIORITY_MASK;
+    else if (offset == PLIC_CLAIM)
+    {
+        // Completion: the gateway forwards the line again if it is still high
+        if (val && val <= PLIC_NDEV)
+        {
+            uint32_t bit = 1u << val;
+            claimed &= ~bit;
+            if (level & bit)
+                pending |= bit;
+        }
+    }
+}
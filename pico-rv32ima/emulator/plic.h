@@ -0,0 +1,26 @@
+#ifndef _PLIC_H
+#define _PLIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Platform-level interrupt controller with a single context (hart 0, M-mode)
+
+#define PLIC_BASE 0x10400000
+#define PLIC_SIZE 0x400000
+
+// Sources 1..PLIC_NDEV, 0 means "no interrupt"
+#define PLIC_NDEV 31
+
+// Interrupt sources
+#define PLIC_IRQ_VIRTIO(slot) (1 + (slot))
+#define PLIC_IRQ_UART 10
+
+void plic_reset(void);
+void plic_set_level(uint32_t irq, bool level);
+bool plic_irq_pending(void);
+
+uint32_t plic_load(uint32_t offset);
+void plic_store(uint32_t offset, uint32_t val);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef _RV32M_RP2040_H
+#define _RV32M_RP2040_H
+
+#include <stdint.h>
+
+// RV32M backend for the Cortex-M0+: it has a single cycle 32x32->32 multiplier
+// but no long multiply or divide instructions, so the defaults end up in
+// libgcc's 64-bit multiply and the SDK's divider wrappers.
+
+#ifndef RV32M_HOST_TEST
+#include "hardware/divider.h"
+#endif
+
+// High word of a 32x32 unsigned multiply, from four 16x16 partial products
+static inline uint32_t rv32m_mulhu(uint32_t a, uint32_t b)
+{
+    uint32_t al = a & 0xffff, ah = a >> 16;
+    uint32_t bl = b & 0xffff, bh = b >> 16;
+
+    uint32_t ll = al * bl;
+    uint32_t lh = al * bh;
+    uint32_t hl = ah * bl;
+    uint32_t hh = ah * bh;
+
+    uint32_t mid = (ll >> 16) + (lh & 0xffff) + (hl & 0xffff);
+    return hh + (lh >> 16) + (hl >> 16) + (mid >> 16);
+}
+
+// Signed variants correct the unsigned product for negative operands
+static inline uint32_t rv32m_mulh(uint32_t a, uint32_t b)
+{
+    uint32_t r = rv32m_mulhu(a, b);
+    if ((int32_t)a < 0)
+        r -= b;
+    if ((int32_t)b < 0)
+        r -= a;
+    return r;
+}
+
+static inline uint32_t rv32m_mulhsu(uint32_t a, uint32_t b)
+{
+    uint32_t r = rv32m_mulhu(a, b);
+    if ((int32_t)a < 0)
+        r -= b;
+    return r;
+}
+
+// Division by zero and overflow follow the RISC-V spec, everything else goes
+// to the SIO divider directly. Core 1 interrupt handlers must not divide, as
+// the divider state is not saved around these.
+static inline uint32_t rv32m_div(uint32_t a, uint32_t b)
+{
+    if (b == 0)
+        return 0xffffffff;
+    if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+        return a;
+    return hw_divider_s32_quotient_inlined((int32_t)a, (int32_t)b);
+}
+
+static inline uint32_t rv32m_divu(uint32_t a, uint32_t b)
+{
+    if (b == 0)
+        return 0xffffffff;
+    return hw_divider_u32_quotient_inlined(a, b);
+}
+
+static inline uint32_t rv32m_rem(uint32_t a, uint32_t b)
+{
+    if (b == 0)
+        return a;
+    if ((int32_t)a == INT32_MIN && (int32_t)b == -1)
+        return 0;
+    return hw_divider_s32_remainder_inlined((int32_t)a, (int32_t)b);
+}
+
+static inline uint32_t rv32m_remu(uint32_t a, uint32_t b)
+{
+    if (b == 0)
+        return a;
+    return hw_divider_u32_remainder_inlined(a, b);
+}
+
+// Hooks for mini-rv32ima.h
+#define CUSTOM_MULH                                          \
+    case 1: rval = rv32m_mulh(rs1, rs2); break;   /* MULH */ \
+    case 2: rval = rv32m_mulhsu(rs1, rs2); break; /* MULHSU */ \
+    case 3: rval = rv32m_mulhu(rs1, rs2); break;  /* MULHU */
+
+#define CUSTOM_DIV                                         \
+    case 4: rval = rv32m_div(rs1, rs2); break;  /* DIV */  \
+    case 5: rval = rv32m_divu(rs1, rs2); break; /* DIVU */ \
+    case 6: rval = rv32m_rem(rs1, rs2); break;  /* REM */  \
+    case 7: rval = rv32m_remu(rs1, rs2); break; /* REMU */
+
+#endif
@@ -0,0 +1,514 @@
+// Offline cache simulator: replays a memory access trace recorded with
+// EMULATOR_TRACE (or rv32ima-host -T) against parametric models of the line
+// cache in front of PSRAM and reports miss rates and the predicted PSRAM time.
+//
+//   make cachesim
+//   ./cachesim trace.bin                   the cache.c configuration
+//   ./cachesim -s 2048 -w 4 -l 32 trace.bin
+//   ./cachesim -S trace.bin                sweep of sizes, ways and line sizes
+//
+// Timing model: the emulator spends --gap-ns between accesses. A miss blocks
+// until its line (and any prefetched lines, read in the same burst) arrives
+// from PSRAM. Dirty victims go to the write-back buffer, which drains while
+// PSRAM is otherwise idle, or are written before the fill when there is no
+// buffer. SPI transactions follow psram.c: fast read is 40 + 8 * bytes clocks,
+// write is 32 + 8 * bytes clocks, plus --cs-ns per transaction. The SRAM tier,
+// XIP and zero page tracking in front of the line cache are not modelled.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "../trace/trace.h"
+
+#define LINE_VALID 1
+#define LINE_DIRTY 2
+#define LINE_PREFETCHED 4
+
+typedef struct
+{
+    uint32_t tag;
+    uint8_t flags;
+    uint64_t used;
+} simline_t;
+
+typedef struct
+{
+    uint32_t base;
+    double ready;
+} wbentry_t;
+
+typedef struct
+{
+    // Parameters
+    uint32_t sets, ways, line, prefetch, wb_size;
+
+    simline_t *lines;
+    wbentry_t *wb;
+    uint32_t wb_head, wb_count;
+
+    uint64_t clock;
+    double now, psram_free;
+
+    // Results
+    uint64_t accesses[3], misses[3];
+    uint64_t fills, prefetches, prefetch_used, writebacks, wb_forwards, wb_full;
+    uint64_t bytes_read, bytes_written;
+    double busy_ns, stall_ns;
+} model_t;
+
+static double spi_mhz = 52;
+static double cs_ns = 100;
+static double gap_ns = 50;
+
+static const char *type_names[3] = {"fetch", "load", "store"};
+
+static double read_ns(uint32_t bytes)
+{
+    return (40 + 8.0 * bytes) * 1000 / spi_mhz + cs_ns;
+}
+
+static double write_ns(uint32_t bytes)
+{
+    return (32 + 8.0 * bytes) * 1000 / spi_mhz + cs_ns;
+}
+
+static bool is_pow2(uint32_t v)
+{
+    return v && !(v & (v - 1));
+}
+
+static int model_init(model_t *m, uint32_t sets, uint32_t ways, uint32_t line, uint32_t prefetch, uint32_t wb_size)
+{
+    if (!is_pow2(sets) || !is_pow2(line) || !ways)
+    {
+        fprintf(stderr, "cachesim: sets and line size must be powers of two\n");
+        return 1;
+    }
+
+    memset(m, 0, sizeof(*m));
+    m->sets = sets;
+    m->ways = ways;
+    m->line = line;
+    m->prefetch = prefetch;
+    m->wb_size = wb_size;
+    m->lines = calloc((size_t)sets * ways, sizeof(simline_t));
+    m->wb = calloc(wb_size ? wb_size : 1, sizeof(wbentry_t));
+    if (!m->lines || !m->wb)
+    {
+        fprintf(stderr, "cachesim: out of memory\n");
+        return 1;
+    }
+    return 0;
+}
+
+static void model_free(model_t *m)
+{
+    free(m->lines);
+    free(m->wb);
+}
+
+// Write out the oldest write-back buffer entry
+static void wb_pop(model_t *m)
+{
+    wbentry_t *e = &m->wb[m->wb_head];
+    double start = m->psram_free > e->ready ? m->psram_free : e->ready;
+    double t = write_ns(m->line);
+
+    m->psram_free = start + t;
+    m->busy_ns += t;
+    m->bytes_written += m->line;
+    m->wb_head = (m->wb_head + 1) % m->wb_size;
+    m->wb_count--;
+}
+
+// Let the write-back buffer use PSRAM while it would otherwise be idle
+static void wb_drain(model_t *m, double until)
+{
+    while (m->wb_count && m->psram_free < until && m->wb[m->wb_head].ready < until)
+        wb_pop(m);
+}
+
+// Look for a line in the write-back buffer, taking it back out if asked to
+static bool wb_find(model_t *m, uint32_t base, bool take)
+{
+    for (uint32_t i = 0; i < m->wb_count; i++)
+    {
+        uint32_t slot = (m->wb_head + i) % m->wb_size;
+        if (m->wb[slot].base != base)
+            continue;
+        if (!take)
+            return true;
+
+        // Close the gap, keeping the order of the rest
+        for (uint32_t j = i; j + 1 < m->wb_count; j++)
+            m->wb[(m->wb_head + j) % m->wb_size] = m->wb[(m->wb_head + j + 1) % m->wb_size];
+        m->wb_count--;
+        return true;
+    }
+    return false;
+}
+
+// Write out a dirty victim, returns when the emulator can carry on
+static double evict(model_t *m, uint32_t base, double now)
+{
+    m->writebacks++;
+
+    if (!m->wb_size)
+    {
+        double start = m->psram_free > now ? m->psram_free : now;
+        double t = write_ns(m->line);
+        m->psram_free = start + t;
+        m->busy_ns += t;
+        m->bytes_written += m->line;
+        return m->psram_free;
+    }
+
+    if (m->wb_count == m->wb_size)
+    {
+        // Full, wait for the oldest entry to go out
+        m->wb_full++;
+        wb_pop(m);
+        if (m->psram_free > now)
+            now = m->psram_free;
+    }
+
+    m->wb[(m->wb_head + m->wb_count) % m->wb_size] = (wbentry_t){base, now};
+    m->wb_count++;
+    return now;
+}
+
+static simline_t *find(model_t *m, uint32_t base)
+{
+    uint32_t lineno = base / m->line;
+    simline_t *set = &m->lines[(size_t)(lineno & (m->sets - 1)) * m->ways];
+    uint32_t tag = lineno / m->sets;
+
+    for (uint32_t way = 0; way < m->ways; way++)
+        if ((set[way].flags & LINE_VALID) && set[way].tag == tag)
+            return &set[way];
+    return NULL;
+}
+
+// Pick the LRU way for base and write it back if needed
+static simline_t *replace(model_t *m, uint32_t base, double *now)
+{
+    uint32_t lineno = base / m->line;
+    uint32_t index = lineno & (m->sets - 1);
+    simline_t *set = &m->lines[(size_t)index * m->ways];
+    simline_t *victim = &set[0];
+
+    for (uint32_t way = 0; way < m->ways; way++)
+    {
+        if (!(set[way].flags & LINE_VALID))
+        {
+            victim = &set[way];
+            break;
+        }
+        if (set[way].used < victim->used)
+            victim = &set[way];
+    }
+
+    if ((victim->flags & (LINE_VALID | LINE_DIRTY)) == (LINE_VALID | LINE_DIRTY))
+        *now = evict(m, (victim->tag * m->sets + index) * m->line, *now);
+
+    victim->tag = lineno / m->sets;
+    victim->flags = LINE_VALID;
+    return victim;
+}
+
+static void model_access(model_t *m, uint32_t type, uint32_t addr)
+{
+    uint32_t base = addr & ~(m->line - 1);
+    double now = m->now;
+
+    m->accesses[type]++;
+    wb_drain(m, now);
+
+    simline_t *line = find(m, base);
+    if (line)
+    {
+        if (line->flags & LINE_PREFETCHED)
+        {
+            m->prefetch_used++;
+            line->flags &= ~LINE_PREFETCHED;
+        }
+    }
+    else
+    {
+        m->misses[type]++;
+
+        line = replace(m, base, &now);
+        if (wb_find(m, base, true))
+        {
+            // Still in the write-back buffer, no PSRAM read needed
+            m->wb_forwards++;
+            line->flags |= LINE_DIRTY;
+        }
+        else
+        {
+            // The line and the following ones come in one burst
+            uint32_t burst = 1;
+            for (uint32_t i = 1; i <= m->prefetch; i++)
+            {
+                uint32_t next = base + i * m->line;
+                if (find(m, next) || wb_find(m, next, false))
+                    break;
+                simline_t *pf = replace(m, next, &now);
+                pf->flags |= LINE_PREFETCHED;
+                pf->used = m->clock;
+                burst++;
+                m->prefetches++;
+            }
+
+            double start = m->psram_free > now ? m->psram_free : now;
+            double t = read_ns(burst * m->line);
+            m->psram_free = start + t;
+            m->busy_ns += t;
+            m->bytes_read += burst * m->line;
+            m->fills++;
+            now = m->psram_free;
+        }
+    }
+
+    line->used = ++m->clock;
+    if (type == TRACE_STORE)
+        line->flags |= LINE_DIRTY;
+
+    m->stall_ns += now - m->now;
+    m->now = now + gap_ns;
+}
+
+// Dirty lines left at the end are not counted, the guest never paid for them
+static void model_report(const model_t *m)
+{
+    uint64_t accesses = 0, misses = 0;
+    for (int type = 0; type < 3; type++)
+    {
+        accesses += m->accesses[type];
+        misses += m->misses[type];
+    }
+
+    printf("cache: %u sets x %u ways x %u bytes = %u kB, prefetch %u, write-back buffer %u\n",
+           m->sets, m->ways, m->line, m->sets * m->ways * m->line / 1024, m->prefetch, m->wb_size);
+    for (int type = 0; type < 3; type++)
+        if (m->accesses[type])
+            printf("  %-6s %12llu accesses %12llu misses  %6.3f%%\n", type_names[type],
+                   (unsigned long long)m->accesses[type], (unsigned long long)m->misses[type],
+                   100.0 * m->misses[type] / m->accesses[type]);
+    printf("  total  %12llu accesses %12llu misses  %6.3f%%\n",
+           (unsigned long long)accesses, (unsigned long long)misses, accesses ? 100.0 * misses / accesses : 0);
+    printf("  fills %llu, writebacks %llu, buffer hits %llu, buffer full %llu\n",
+           (unsigned long long)m->fills, (unsigned long long)m->writebacks,
+           (unsigned long long)m->wb_forwards, (unsigned long long)m->wb_full);
+    if (m->prefetch)
+        printf("  prefetched %llu lines, %llu used (%.1f%%)\n", (unsigned long long)m->prefetches,
+               (unsigned long long)m->prefetch_used, m->prefetches ? 100.0 * m->prefetch_used / m->prefetches : 0);
+    printf("  PSRAM: %.1f MB read, %.1f MB written, busy %.3f s\n",
+           m->bytes_read / 1e6, m->bytes_written / 1e6, m->busy_ns / 1e9);
+    printf("  stalled %.3f s of %.3f s (%.1f%%), %.1f ns per access\n",
+           m->stall_ns / 1e9, m->now / 1e9, m->now ? 100.0 * m->stall_ns / m->now : 0,
+           accesses ? m->stall_ns / accesses : 0);
+}
+
+static void model_report_row(const model_t *m)
+{
+    uint64_t accesses = 0, misses = 0;
+    for (int type = 0; type < 3; type++)
+    {
+        accesses += m->accesses[type];
+        misses += m->misses[type];
+    }
+
+    printf("%5u %5u %4u %6u %8.3f%% %10.1f %10.1f %10.3f %8.1f\n",
+           m->sets * m->ways * m->line / 1024, m->ways, m->line, m->sets,
+           accesses ? 100.0 * misses / accesses : 0, m->bytes_read / 1e6, m->bytes_written / 1e6,
+           m->stall_ns / 1e9, accesses ? m->stall_ns / accesses : 0);
+}
+
+static uint32_t get_varint(FILE *f, bool *eof)
+{
+    uint32_t v = 0;
+    for (int shift = 0; shift < 35; shift += 7)
+    {
+        int c = getc(f);
+        if (c == EOF)
+        {
+            *eof = true;
+            return 0;
+        }
+        v |= (uint32_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            break;
+    }
+    return v;
+}
+
+static uint32_t unzigzag(uint32_t v)
+{
+    return (v >> 1) ^ -(v & 1);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [options] <trace>\n"
+            "  -s <sets>      sets (default 4096)\n"
+            "  -w <ways>      ways (default 2)\n"
+            "  -l <bytes>     line size (default 16)\n"
+            "  -p <lines>     next lines prefetched on a miss (default 0)\n"
+            "  -b <lines>     write-back buffer entries (default 0)\n"
+            "  -g <ns>        emulator time between accesses (default %.0f)\n"
+            "  -c <MHz>       PSRAM SPI clock (default %.0f)\n"
+            "  -o <ns>        per transaction overhead (default %.0f)\n"
+            "  -x <types>     skip access types: f(etch), l(oad), s(tore)\n"
+            "  -n <records>   stop after this many records\n"
+            "  -S             sweep cache sizes, ways and line sizes\n",
+            argv0, gap_ns, spi_mhz, cs_ns);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t sets = 4096, ways = 2, line = 16, prefetch = 0, wb_size = 0;
+    uint64_t limit = 0;
+    bool skip[4] = {false, false, false, true};
+    bool sweep = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "s:w:l:p:b:g:c:o:x:n:S")) != -1)
+    {
+        switch (c)
+        {
+        case 's': sets = strtoul(optarg, NULL, 0); break;
+        case 'w': ways = strtoul(optarg, NULL, 0); break;
+        case 'l': line = strtoul(optarg, NULL, 0); break;
+        case 'p': prefetch = strtoul(optarg, NULL, 0); break;
+        case 'b': wb_size = strtoul(optarg, NULL, 0); break;
+        case 'g': gap_ns = atof(optarg); break;
+        case 'c': spi_mhz = atof(optarg); break;
+        case 'o': cs_ns = atof(optarg); break;
+        case 'n': limit = strtoull(optarg, NULL, 0); break;
+        case 'S': sweep = true; break;
+        case 'x':
+            for (const char *p = optarg; *p; p++)
+            {
+                if (*p == 'f')
+                    skip[TRACE_FETCH] = true;
+                else if (*p == 'l')
+                    skip[TRACE_LOAD] = true;
+                else if (*p == 's')
+                    skip[TRACE_STORE] = true;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind + 1 != argc || spi_mhz <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (!f)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    char magic[TRACE_MAGIC_LEN];
+    if (fread(magic, 1, TRACE_MAGIC_LEN, f) != TRACE_MAGIC_LEN || memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN))
+    {
+        fprintf(stderr, "cachesim: %s is not a trace\n", argv[optind]);
+        return 1;
+    }
+
+    // Every model sees the same stream, so a sweep reads the trace once
+    static const uint32_t sweep_kb[] = {32, 64, 128, 256};
+    static const uint32_t sweep_ways[] = {1, 2, 4};
+    static const uint32_t sweep_line[] = {16, 32, 64};
+    model_t *models;
+    int count = 0;
+
+    if (sweep)
+    {
+        models = calloc(4 * 3 * 3, sizeof(model_t));
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 3; j++)
+                for (int k = 0; k < 3; k++)
+                    if (model_init(&models[count++], sweep_kb[i] * 1024 / sweep_ways[j] / sweep_line[k],
+                                   sweep_ways[j], sweep_line[k], prefetch, wb_size))
+                        return 1;
+    }
+    else
+    {
+        models = calloc(1, sizeof(model_t));
+        if (model_init(&models[count++], sets, ways, line, prefetch, wb_size))
+            return 1;
+    }
+
+    uint64_t records = 0, marks = 0;
+    uint32_t addr = 0, pc = 0;
+    bool eof = false;
+
+    while (!limit || records < limit)
+    {
+        int header = getc(f);
+        if (header == EOF)
+            break;
+
+        uint32_t type = header & 3;
+        if (type == TRACE_MARK)
+        {
+            addr = pc = 0;
+            marks++;
+            continue;
+        }
+
+        uint32_t size = 1u << ((header >> 2) & 3);
+        addr += unzigzag(get_varint(f, &eof));
+        if (!(header & TRACE_SAME_PC))
+            pc += unzigzag(get_varint(f, &eof));
+        if (eof)
+        {
+            fprintf(stderr, "cachesim: trace ends in the middle of a record\n");
+            break;
+        }
+        records++;
+
+        if (skip[type])
+            continue;
+
+        for (int i = 0; i < count; i++)
+        {
+            model_access(&models[i], type, addr);
+            // Unaligned accesses that straddle two lines touch both
+            if (((addr & (models[i].line - 1)) + size) > models[i].line)
+                model_access(&models[i], type, addr + size - 1);
+        }
+    }
+    fclose(f);
+
+    printf("%llu records", (unsigned long long)records);
+    if (marks)
+        printf(", %llu gaps from a full trace buffer", (unsigned long long)marks);
+    printf("\nPSRAM at %.0f MHz, %.0f ns per transaction, %.0f ns between accesses\n\n", spi_mhz, cs_ns, gap_ns);
+
+    if (sweep)
+        printf("   kB  ways line   sets    misses    MB read MB written    stall s  ns/acc\n");
+    for (int i = 0; i < count; i++)
+    {
+        if (sweep)
+            model_report_row(&models[i]);
+        else
+            model_report(&models[i]);
+        model_free(&models[i]);
+    }
+    free(models);
+    return 0;
+}
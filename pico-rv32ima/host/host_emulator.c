@@ -0,0 +1,474 @@
+// Host-native build of the emulator, for benchmarking and debugging guest
+// images without the Pico. RAM is a flat buffer, the console is stdio and the
+// device tree comes from the same generator as the firmware.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "../config/rv32_config.h"
+#include "../emulator/dtb.h"
+#include "../emulator/plic.h"
+#include "../trace/trace.h"
+
+static uint32_t ram_amt = EMULATOR_RAM_MB * 1024 * 1024;
+static uint8_t *ram_image;
+
+static uint32_t HandleControlStore(uint32_t addy, uint32_t val);
+static uint32_t HandleControlLoad(uint32_t addy);
+static void HandleOtherCSRWrite(uint8_t *image, uint16_t csrno, uint32_t value);
+static uint32_t HandleOtherCSRRead(uint8_t *image, uint16_t csrno);
+static bool UpdateInterrupts(void);
+static int IsKBHit(void);
+static int ReadKBByte(void);
+
+#define MINIRV32WARN(x...) fprintf(stderr, x);
+#define MINIRV32_DECORATE static
+#define MINI_RV32_RAM_SIZE ram_amt
+#define MINIRV32_IMPLEMENTATION
+#define MINIRV32_POSTEXEC(pc, ir, retval)             \
+    {                                                 \
+        if (retval > 0 && fail_on_fault)              \
+        {                                             \
+            fprintf(stderr, "FAULT %d at %08x\n", retval - 1, pc); \
+            return 3;                                 \
+        }                                             \
+    }
+#define MINIRV32_HANDLE_MEM_STORE_CONTROL(addy, val) \
+    if (HandleControlStore(addy, val))               \
+        return val;
+#define MINIRV32_HANDLE_MEM_LOAD_CONTROL(addy, rval) rval = HandleControlLoad(addy);
+#define MINIRV32_EXTERNAL_IRQ() UpdateInterrupts()
+#define MINIRV32_OTHERCSR_WRITE(csrno, value) HandleOtherCSRWrite(image, csrno, value);
+#define MINIRV32_OTHERCSR_READ(csrno, rval)      \
+    {                                            \
+        rval = HandleOtherCSRRead(image, csrno); \
+    }
+
+#if EMULATOR_RV32C
+#define MINIRV32_RV32C
+#endif
+#if EMULATOR_ZBA_ZBB
+#define MINIRV32_ZBA_ZBB
+#endif
+
+static bool fail_on_fault;
+
+// Flat RAM, every access goes past the trace recorder (which returns at once unless -T was given)
+#define MINIRV32_CUSTOM_MEMORY_BUS
+
+static inline void MINIRV32_STORE4(uint32_t ofs, uint32_t val) { memcpy(ram_image + ofs, &val, 4); }
+static inline void MINIRV32_STORE2(uint32_t ofs, uint16_t val) { memcpy(ram_image + ofs, &val, 2); }
+static inline void MINIRV32_STORE1(uint32_t ofs, uint8_t val) { ram_image[ofs] = val; }
+static inline uint32_t MINIRV32_LOAD4(uint32_t ofs) { uint32_t v; memcpy(&v, ram_image + ofs, 4); return v; }
+static inline uint16_t MINIRV32_LOAD2(uint32_t ofs) { uint16_t v; memcpy(&v, ram_image + ofs, 2); return v; }
+static inline int16_t MINIRV32_LOAD2_SIGNED(uint32_t ofs) { int16_t v; memcpy(&v, ram_image + ofs, 2); return v; }
+static inline uint8_t MINIRV32_LOAD1(uint32_t ofs) { return ram_image[ofs]; }
+static inline int8_t MINIRV32_LOAD1_SIGNED(uint32_t ofs) { return ram_image[ofs]; }
+
+#define MINIRV32_STORE4(ofs, val) (trace_access(pc, ofs, 4, TRACE_STORE), MINIRV32_STORE4(ofs, val))
+#define MINIRV32_STORE2(ofs, val) (trace_access(pc, ofs, 2, TRACE_STORE), MINIRV32_STORE2(ofs, val))
+#define MINIRV32_STORE1(ofs, val) (trace_access(pc, ofs, 1, TRACE_STORE), MINIRV32_STORE1(ofs, val))
+#define MINIRV32_LOAD4(ofs) (trace_access(pc, ofs, 4, TRACE_LOAD), MINIRV32_LOAD4(ofs))
+#define MINIRV32_LOAD2(ofs) (trace_access(pc, ofs, 2, TRACE_LOAD), MINIRV32_LOAD2(ofs))
+#define MINIRV32_LOAD2_SIGNED(ofs) (trace_access(pc, ofs, 2, TRACE_LOAD), MINIRV32_LOAD2_SIGNED(ofs))
+#define MINIRV32_LOAD1(ofs) (trace_access(pc, ofs, 1, TRACE_LOAD), MINIRV32_LOAD1(ofs))
+#define MINIRV32_LOAD1_SIGNED(ofs) (trace_access(pc, ofs, 1, TRACE_LOAD), MINIRV32_LOAD1_SIGNED(ofs))
+
+#include "../emulator/mini-rv32ima.h"
+
+static struct MiniRV32IMAState core;
+
+// Options
+static const char *image_file = "../../linux/Image";
+static const char *bootargs = NULL;
+static bool fixed_update;
+static uint32_t timebase_hz = EMULATOR_TIMEBASE_FREQ;
+static double time_limit;
+static FILE *trace_out;
+
+//////////////////////////////////////////////////////////////////////////
+// Console
+//////////////////////////////////////////////////////////////////////////
+
+static struct termios saved_termios;
+static bool raw_console;
+
+static void ResetConsole(void)
+{
+    if (raw_console)
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+}
+
+// Raw, unechoed input when attached to a terminal so the guest line discipline works
+static void SetupConsole(void)
+{
+    setvbuf(stdout, NULL, _IONBF, 0);
+    if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &saved_termios))
+        return;
+
+    struct termios t = saved_termios;
+    t.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &t);
+    raw_console = true;
+    atexit(ResetConsole);
+}
+
+static int kb_byte = -1;
+static bool kb_eof;
+
+static int IsKBHit(void)
+{
+    if (kb_byte >= 0)
+        return 1;
+    if (kb_eof)
+        return 0;
+
+    struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+    if (poll(&pfd, 1, 0) <= 0)
+        return 0;
+
+    unsigned char c;
+    if (read(STDIN_FILENO, &c, 1) != 1)
+    {
+        kb_eof = true; // stdin closed (e.g. /dev/null when benchmarking)
+        return 0;
+    }
+    kb_byte = c == '\n' ? '\r' : c;
+    return 1;
+}
+
+static int ReadKBByte(void)
+{
+    if (!IsKBHit())
+        return -1;
+    int c = kb_byte;
+    kb_byte = -1;
+    return c;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Devices (8250 UART, PLIC, HVC console)
+//////////////////////////////////////////////////////////////////////////
+
+#define UART_IER_RDI 0x01
+#define UART_IER_THRI 0x02
+#define UART_LCR_DLAB 0x80
+
+static uint8_t uart_ier, uart_lcr;
+
+static bool UpdateInterrupts(void)
+{
+    plic_set_level(PLIC_IRQ_UART, ((uart_ier & UART_IER_RDI) && IsKBHit()) || (uart_ier & UART_IER_THRI));
+    return plic_irq_pending();
+}
+
+static uint32_t HandleControlStore(uint32_t addy, uint32_t val)
+{
+    if (addy == 0x10000003)
+        uart_lcr = val;
+    else if ((addy == 0x10000000 || addy == 0x10000001) && (uart_lcr & UART_LCR_DLAB))
+        ;
+    else if (addy == 0x10000000)
+        putchar(val);
+    else if (addy == 0x10000001)
+        uart_ier = val & (UART_IER_RDI | UART_IER_THRI);
+    else if (addy >= PLIC_BASE && addy < PLIC_BASE + PLIC_SIZE)
+        plic_store(addy - PLIC_BASE, val);
+
+    return 0;
+}
+
+static uint32_t HandleControlLoad(uint32_t addy)
+{
+    if (addy >= PLIC_BASE && addy < PLIC_BASE + PLIC_SIZE)
+    {
+        UpdateInterrupts();
+        return plic_load(addy - PLIC_BASE);
+    }
+
+    if (addy == 0x10000005)
+        return 0x60 | IsKBHit();
+    else if (addy == 0x10000000 && IsKBHit())
+        return ReadKBByte();
+    else if (addy == 0x10000001)
+        return uart_ier;
+    else if (addy == 0x10000003)
+        return uart_lcr;
+    else if (addy == 0x10000002)
+    {
+        if ((uart_ier & UART_IER_RDI) && IsKBHit())
+            return 0x04;
+        if (uart_ier & UART_IER_THRI)
+            return 0x02;
+        return 0x01;
+    }
+
+    return 0;
+}
+
+static void HandleOtherCSRWrite(uint8_t *image, uint16_t csrno, uint32_t value)
+{
+    if (csrno == 0x136)
+        printf("%d", value);
+    else if (csrno == 0x137)
+        printf("%08x", value);
+    else if (csrno == 0x138)
+    {
+        uint32_t ptr = value - MINIRV32_RAM_IMAGE_OFFSET;
+        while (ptr < ram_amt && image[ptr])
+            putchar(image[ptr++]);
+    }
+    else if (csrno == 0x139)
+        putchar(value);
+}
+
+static uint32_t HandleOtherCSRRead(uint8_t *image, uint16_t csrno)
+{
+    if (csrno == 0x140)
+        return IsKBHit() ? ReadKBByte() : -1;
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Timing
+//////////////////////////////////////////////////////////////////////////
+
+static uint64_t GetTimeMicroseconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t TimerDelta(struct MiniRV32IMAState *c)
+{
+    uint64_t match = ((uint64_t)c->timermatchh << 32) | c->timermatchl;
+    uint64_t now = ((uint64_t)c->timerh << 32) | c->timerl;
+    if (!match)
+        return UINT64_MAX;
+    return match > now ? match - now : 0;
+}
+
+// Sleep until the timer fires or input arrives
+static void MiniSleep(uint64_t timerDelta)
+{
+    uint64_t sleepUs = EMULATOR_WFI_MAX_SLEEP_US;
+    if (timerDelta < dtb_us_to_ticks(sleepUs, timebase_hz))
+        sleepUs = dtb_ticks_to_us(timerDelta, timebase_hz);
+    if (IsKBHit())
+        return;
+
+    if (kb_eof)
+        usleep(sleepUs);
+    else
+    {
+        struct pollfd pfd = {.fd = STDIN_FILENO, .events = POLLIN};
+        poll(&pfd, 1, (sleepUs + 999) / 1000);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Setup
+//////////////////////////////////////////////////////////////////////////
+
+static uint32_t LoadImage(const char *filename)
+{
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+    {
+        perror(filename);
+        exit(1);
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (size <= 0 || size > ram_amt - DTB_MAX_SIZE)
+    {
+        fprintf(stderr, "%s: image doesn't fit in %u bytes of RAM\n", filename, ram_amt);
+        exit(1);
+    }
+    if (fread(ram_image, size, 1, f) != 1)
+    {
+        perror(filename);
+        exit(1);
+    }
+    fclose(f);
+    return size;
+}
+
+// Same placement as the firmware, at the top of RAM
+static uint32_t LoadDTB(void)
+{
+    static uint8_t dtb[DTB_MAX_SIZE];
+    dtb_config_t cfg;
+
+    dtb_default_config(&cfg);
+    cfg.ram_size = ram_amt;
+    if (bootargs)
+    {
+        strncpy(cfg.bootargs, bootargs, DTB_BOOTARGS_LEN - 1);
+        cfg.bootargs[DTB_BOOTARGS_LEN - 1] = '\0';
+    }
+
+    uint32_t size = dtb_build(&cfg, dtb, sizeof(dtb));
+    if (!size)
+    {
+        fprintf(stderr, "Device tree does not fit in %d bytes\n", DTB_MAX_SIZE);
+        exit(1);
+    }
+
+    uint32_t dtb_ptr = (ram_amt - size) & ~7;
+    cfg.ram_size = dtb_ptr;
+    dtb_build(&cfg, dtb, sizeof(dtb));
+    memcpy(ram_image + dtb_ptr, dtb, size);
+    timebase_hz = cfg.timebase;
+    return dtb_ptr;
+}
+
+static void DrainTrace(void)
+{
+    uint8_t buf[4096];
+    uint32_t len;
+    while ((len = trace_read(buf, sizeof(buf))))
+        fwrite(buf, 1, len, trace_out);
+}
+
+static void Usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -i <file>   kernel image (default %s)\n"
+            "  -m <MB>     guest RAM size (default %d)\n"
+            "  -b <args>   kernel command line\n"
+            "  -f          tie the guest clock to the instruction count (reproducible runs)\n"
+            "  -t <sec>    give up after this much host time\n"
+            "  -e          stop on the first guest fault\n"
+            "  -T <file>   record a memory access trace (see ../trace/trace.h)\n",
+            argv0, image_file, EMULATOR_RAM_MB);
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "i:m:b:ft:eT:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'i': image_file = optarg; break;
+        case 'm': ram_amt = strtoul(optarg, NULL, 0) * 1024 * 1024; break;
+        case 'b': bootargs = optarg; break;
+        case 'f': fixed_update = true; break;
+        case 't': time_limit = atof(optarg); break;
+        case 'e': fail_on_fault = true; break;
+        case 'T':
+            if (!(trace_out = fopen(optarg, "wb")))
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default: Usage(argv[0]);
+        }
+    }
+
+    ram_image = calloc(ram_amt, 1);
+    if (!ram_image)
+    {
+        fprintf(stderr, "Can't allocate %u bytes of RAM\n", ram_amt);
+        return 1;
+    }
+
+    SetupConsole();
+    LoadImage(image_file);
+    plic_reset();
+    uint32_t dtb_ptr = LoadDTB();
+
+    core.regs[10] = 0x00;
+    core.regs[11] = dtb_ptr + MINIRV32_RAM_IMAGE_OFFSET;
+    core.extraflags |= 3;
+    core.pc = MINIRV32_RAM_IMAGE_OFFSET;
+
+    if (trace_out)
+        trace_start();
+
+    uint64_t start = GetTimeMicroseconds();
+    uint64_t lastTime = fixed_update ? 0 : dtb_us_to_ticks(start, timebase_hz);
+    int exit_code = 0;
+
+    for (;;)
+    {
+        uint64_t *this_ccount = (uint64_t *)&core.cyclel;
+        uint64_t now = GetTimeMicroseconds();
+        uint32_t elapsedUs;
+
+        if (time_limit > 0 && now - start > time_limit * 1e6)
+        {
+            fprintf(stderr, "\nTimed out after %.0f s\n", time_limit);
+            exit_code = 2;
+            break;
+        }
+
+        if (fixed_update)
+            elapsedUs = dtb_us_to_ticks(*this_ccount, timebase_hz) - lastTime;
+        else
+            elapsedUs = dtb_us_to_ticks(now, timebase_hz) - lastTime;
+        lastTime += elapsedUs;
+
+        int ret = MiniRV32IMAStep(&core, ram_image, 0, elapsedUs, EMUALTOR_INSTR_FLIP);
+        if (trace_out)
+            DrainTrace();
+        if (ret == 0)
+            continue;
+        else if (ret == 1)
+        {
+            if (fixed_update)
+            {
+                if (TimerDelta(&core) < (1 << 30) && !IsKBHit())
+                    *this_ccount += dtb_ticks_to_us(TimerDelta(&core) + 1, timebase_hz);
+                else
+                    *this_ccount += EMUALTOR_INSTR_FLIP;
+            }
+            else
+            {
+                MiniSleep(TimerDelta(&core));
+                *this_ccount += EMUALTOR_INSTR_FLIP;
+            }
+        }
+        else if (ret == 0x5555)
+            break;
+        else if (ret == 0x7777)
+        {
+            fprintf(stderr, "\nGuest requested a reboot\n");
+            break;
+        }
+        else
+        {
+            fprintf(stderr, "\nEmulator stopped (%d) at pc %08x\n", ret, core.pc);
+            exit_code = 1;
+            break;
+        }
+    }
+
+    if (trace_out)
+    {
+        trace_stop();
+        DrainTrace();
+        fclose(trace_out);
+        fprintf(stderr, "\ntrace: %llu records, %llu dropped\n",
+                (unsigned long long)trace.records, (unsigned long long)trace.dropped);
+    }
+
+    fprintf(stderr, "\nhost: cycles=%llu wall_us=%llu\n",
+            (unsigned long long)(((uint64_t)core.cycleh << 32) | core.cyclel),
+            (unsigned long long)(GetTimeMicroseconds() - start));
+    return exit_code;
+}
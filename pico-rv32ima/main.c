@@ -10,6 +10,7 @@
 #include "hw_config.h"
 
 #include "psram/psram.h"
+#include "cache/xip.h"
 #include "emulator/emulator.h"
 #include "console/console.h"
 #include "console/terminal.h"
@@ -94,11 +95,23 @@ void core1_entry()
 
     console_printf("\x1b[32mPSRAM init OK!\n\r");
     console_printf("\x1b[32mPSRAM Baud: %d\n\r", r);
+#if PSRAM_HARDWARE_SPI && PSRAM_CALIBRATE
+    psram_calibration_t cal;
+    psramGetCalibration(&cal);
+    console_printf("\x1b[32mPSRAM calibrated: %d kHz, %s read (%s)\n\r", cal.baud / 1000,
+                   cal.fast_read ? "fast" : "plain", cal.cached ? "from flash" : "measured");
+#endif
+
+#if EMULATOR_XIP_FLASH
+    xip_init();
+#endif
 
     sd_card_t *pSD0 = sd_get_by_num(0);
     FRESULT fr = f_mount(&pSD0->fatfs, pSD0->pcName, 1);
     if (FR_OK != fr)
         console_panic("SD mount error: %s (%d)\n\r", FRESULT_str(fr), fr);
+    console_printf("\x1b[32mSD clock: %d kHz%s%s\n\r", pSD0->clock_hz / 1000,
+                   SD_USE_SDIO ? " (SDIO)" : "", pSD0->high_speed ? " (high speed)" : "");
 
     gpio_init(2);
 	gpio_set_dir(2, GPIO_IN);
@@ -1,4 +1,6 @@
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 
 #include "../config/rv32_config.h"
 #include "psram.h"
@@ -7,6 +9,7 @@ uint64_t reads, writes;
 
 #if PSRAM_HARDWARE_SPI
 #include "hardware/spi.h"
+#include "hardware/clocks.h"
 #endif
 
 #define PSRAM_CMD_RES_EN 0x66
@@ -14,9 +17,23 @@ uint64_t reads, writes;
 #define PSRAM_CMD_READ_ID 0x9F
 #define PSRAM_CMD_READ 0x03
 #define PSRAM_CMD_READ_FAST 0x0B
+#define PSRAM_READ_MAX_HZ (33 * 1000 * 1000) // Plain READ has no wait cycles, it's only specified up to here
 #define PSRAM_CMD_WRITE 0x02
 #define PSRAM_KGD 0x5D
 
+#if PSRAM_FOUR_CHIPS
+#define PSRAM_CHIPS 4
+#elif PSRAM_THREE_CHIPS
+#define PSRAM_CHIPS 3
+#elif PSRAM_TWO_CHIPS
+#define PSRAM_CHIPS 2
+#else
+#define PSRAM_CHIPS 1
+#endif
+
+// Command used for reads, plain read has no dummy byte but only works at lower clocks
+static uint8_t readCmd = PSRAM_CMD_READ_FAST;
+
 #define selectPsramChip(c) gpio_put(c, false)
 #define deSelectPsramChip(c) gpio_put(c, true)
 
@@ -93,6 +110,234 @@ void psramReadID(uint chip, uint8_t *dst)
     deSelectPsramChip(chip);
 }
 
+#if PSRAM_HARDWARE_SPI && PSRAM_CALIBRATE
+
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+
+// Calibration: SPI clocks from PSRAM_CALIBRATE_MAX_MHZ down to PSRAM_SPI_SPEED are
+// tried fastest first, each with the plain read command (8 clocks shorter) and
+// then fast read. The first one to pass the pattern test on every chip is used.
+
+#ifndef PSRAM_CALIBRATE_FLASH_OFFSET
+#if EMULATOR_XIP_FLASH
+#define PSRAM_CALIBRATE_FLASH_OFFSET (XIP_FLASH_OFFSET - FLASH_SECTOR_SIZE)
+#else
+#define PSRAM_CALIBRATE_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#endif
+#endif
+
+#if PSRAM_CALIBRATE_FLASH_OFFSET % FLASH_SECTOR_SIZE
+#error "PSRAM calibration sector must be sector aligned"
+#endif
+#if EMULATOR_XIP_FLASH && PSRAM_CALIBRATE_FLASH_OFFSET + FLASH_SECTOR_SIZE > XIP_FLASH_OFFSET && PSRAM_CALIBRATE_FLASH_OFFSET < XIP_FLASH_OFFSET + XIP_FLASH_SIZE
+#error "PSRAM calibration sector overlaps the XIP partition"
+#endif
+
+#define CAL_MAGIC 0x4c414350 // "PCAL"
+#define CAL_BLOCK_SIZE 512   // Stays within a 1kB PSRAM page
+#define CAL_BLOCKS 4         // Per chip, spread over the address range
+#define CAL_LINE 16          // Cache line sized reads as well as whole blocks
+
+#if CAL_BLOCK_SIZE < FLASH_PAGE_SIZE
+#error "The calibration buffer also holds the flash page"
+#endif
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t clk_peri; // The result only holds for this peripheral clock
+    uint32_t max_mhz, min_mhz, chips;
+    uint32_t postdiv;
+    uint32_t read_cmd;
+    uint32_t check;
+} psram_cal_t;
+
+static uint8_t calBuf[CAL_BLOCK_SIZE], calExpect[CAL_BLOCK_SIZE];
+static psram_calibration_t calibration;
+
+static uint32_t calCheck(const psram_cal_t *cal)
+{
+    const uint32_t *w = (const uint32_t *)cal;
+    uint32_t check = 0x9e3779b9;
+    for (uint i = 0; i < offsetof(psram_cal_t, check) / 4; i++)
+        check = (check ^ w[i]) * 0x01000193;
+    return check;
+}
+
+// Fill with the pattern for this pass, different at every address
+static void calPattern(uint8_t *buf, uint32_t addr, uint pass)
+{
+    uint32_t x = addr * 2654435761u ^ (pass + 1) * 0x85ebca6b;
+    for (uint i = 0; i < CAL_BLOCK_SIZE; i++)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        switch (pass % 4)
+        {
+        case 0: buf[i] = x; break;                           // Random
+        case 1: buf[i] = (i & 1) ? 0x55 : 0xaa; break;       // A data line toggle every clock
+        case 2: buf[i] = ((i >> 2) & 1) ? 0xff : 0x00; break; // Long runs
+        default: buf[i] = (1 << (i & 7)) ^ (addr >> 9); break; // Walking ones
+        }
+    }
+}
+
+static uint32_t calBlockAddr(uint chip, uint block, uint pass)
+{
+    uint32_t span = PSRAM_CHIP_SIZE / CAL_BLOCKS;
+    return chip * PSRAM_CHIP_SIZE + block * span + (pass * 4096 + block * CAL_BLOCK_SIZE) % span;
+}
+
+// Write every block on every chip before reading any back, so address faults show up too
+static bool calTest(uint passes)
+{
+    for (uint pass = 0; pass < passes; pass++)
+    {
+        for (uint chip = 0; chip < PSRAM_CHIPS; chip++)
+            for (uint block = 0; block < CAL_BLOCKS; block++)
+            {
+                uint32_t addr = calBlockAddr(chip, block, pass);
+                calPattern(calExpect, addr, pass);
+                accessPSRAM(addr, CAL_BLOCK_SIZE, true, calExpect);
+            }
+
+        for (uint chip = 0; chip < PSRAM_CHIPS; chip++)
+            for (uint block = 0; block < CAL_BLOCKS; block++)
+            {
+                uint32_t addr = calBlockAddr(chip, block, pass);
+                calPattern(calExpect, addr, pass);
+
+                accessPSRAM(addr, CAL_BLOCK_SIZE, false, calBuf);
+                if (memcmp(calBuf, calExpect, CAL_BLOCK_SIZE))
+                    return false;
+
+                memset(calBuf, 0, CAL_BLOCK_SIZE);
+                for (uint i = 0; i < CAL_BLOCK_SIZE; i += CAL_LINE)
+                    accessPSRAM(addr + i, CAL_LINE, false, calBuf + i);
+                if (memcmp(calBuf, calExpect, CAL_BLOCK_SIZE))
+                    return false;
+            }
+    }
+    return true;
+}
+
+// Plain READ past its spec can pass at boot and fail once the chip warms up
+static bool calCmdAllowed(uint postdiv, uint8_t cmd)
+{
+    return cmd == PSRAM_CMD_READ_FAST || clock_get_hz(clk_peri) / (2 * postdiv) <= PSRAM_READ_MAX_HZ;
+}
+
+static uint calApply(uint postdiv, uint8_t cmd)
+{
+    readCmd = cmd;
+    // Prescale is 2 for every clock in the range, so this lands on clk_peri / (2 * postdiv)
+    return spi_set_baudrate(PSRAM_SPI_INST, clock_get_hz(clk_peri) / (2 * postdiv));
+}
+
+static void calFill(psram_cal_t *cal)
+{
+    memset(cal, 0, sizeof(*cal));
+    cal->magic = CAL_MAGIC;
+    cal->clk_peri = clock_get_hz(clk_peri);
+    cal->max_mhz = PSRAM_CALIBRATE_MAX_MHZ;
+    cal->min_mhz = PSRAM_SPI_SPEED;
+    cal->chips = PSRAM_CHIPS;
+}
+
+#if PSRAM_CALIBRATE_CACHE
+extern char __flash_binary_end;
+
+static bool calFlashUsable(void)
+{
+    return XIP_BASE + PSRAM_CALIBRATE_FLASH_OFFSET >= (uintptr_t)&__flash_binary_end;
+}
+
+static const psram_cal_t *calLoad(void)
+{
+    const psram_cal_t *stored = (const psram_cal_t *)(XIP_NOCACHE_NOALLOC_BASE + PSRAM_CALIBRATE_FLASH_OFFSET);
+    psram_cal_t want;
+
+    calFill(&want);
+    if (!calFlashUsable() || stored->check != calCheck(stored) ||
+        memcmp(stored, &want, offsetof(psram_cal_t, postdiv)))
+        return NULL;
+    return stored;
+}
+
+// Runs before xip_init(), which puts the flash clock back after boot2 resets it
+static void calStore(const psram_cal_t *cal)
+{
+    if (!calFlashUsable())
+        return;
+
+    memset(calBuf, 0xff, FLASH_PAGE_SIZE);
+    memcpy(calBuf, cal, sizeof(*cal));
+
+    uint32_t ints = save_and_disable_interrupts();
+    flash_range_erase(PSRAM_CALIBRATE_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(PSRAM_CALIBRATE_FLASH_OFFSET, calBuf, FLASH_PAGE_SIZE);
+    restore_interrupts(ints);
+}
+#endif
+
+// Returns the SPI clock in Hz, 0 if nothing down to PSRAM_SPI_SPEED works
+static uint psramCalibrate(void)
+{
+    uint32_t clk = clock_get_hz(clk_peri);
+    uint fastest = (clk + 2 * 1000 * 1000 * PSRAM_CALIBRATE_MAX_MHZ - 1) / (2 * 1000 * 1000 * PSRAM_CALIBRATE_MAX_MHZ);
+    uint slowest = (clk + 2 * 1000 * 1000 * PSRAM_SPI_SPEED - 1) / (2 * 1000 * 1000 * PSRAM_SPI_SPEED);
+
+    if (fastest < 1)
+        fastest = 1;
+    if (slowest < fastest)
+        slowest = fastest;
+
+#if PSRAM_CALIBRATE_CACHE
+    const psram_cal_t *stored = calLoad();
+    if (stored && calCmdAllowed(stored->postdiv, stored->read_cmd))
+    {
+        uint baud = calApply(stored->postdiv, stored->read_cmd);
+        if (calTest(1))
+        {
+            calibration = (psram_calibration_t){baud, stored->read_cmd == PSRAM_CMD_READ_FAST, true, 0};
+            return baud;
+        }
+    }
+#endif
+
+    static const uint8_t cmds[] = {PSRAM_CMD_READ, PSRAM_CMD_READ_FAST};
+    uint tried = 0;
+
+    for (uint postdiv = fastest; postdiv <= slowest; postdiv++)
+        for (uint i = 0; i < sizeof(cmds); i++)
+        {
+            if (!calCmdAllowed(postdiv, cmds[i]))
+                continue;
+            uint baud = calApply(postdiv, cmds[i]);
+            tried++;
+            if (!calTest(PSRAM_CALIBRATE_PASSES))
+                continue;
+
+            calibration = (psram_calibration_t){baud, cmds[i] == PSRAM_CMD_READ_FAST, false, tried};
+#if PSRAM_CALIBRATE_CACHE
+            psram_cal_t cal;
+            calFill(&cal);
+            cal.postdiv = postdiv;
+            cal.read_cmd = cmds[i];
+            cal.check = calCheck(&cal);
+            calStore(&cal);
+#endif
+            return baud;
+        }
+
+    calApply(slowest, PSRAM_CMD_READ_FAST);
+    return 0;
+}
+
+#endif
+
 int initPSRAM()
 {
     gpio_init(PSRAM_SPI_PIN_S1);
@@ -185,11 +430,18 @@ int initPSRAM()
 #endif
 #endif
 
+#if PSRAM_HARDWARE_SPI && PSRAM_CALIBRATE
+    baud = psramCalibrate();
+    reads = writes = 0;
+    if (!baud)
+        return -5;
+    return baud / 1000 / 1000;
+#elif PSRAM_HARDWARE_SPI
     reads = writes = 0;
-#if PSRAM_HARDWARE_SPI
     baud = spi_set_baudrate(PSRAM_SPI_INST, 1000 * 1000 * PSRAM_SPI_SPEED);
     return baud / 1000 / 1000;
 #else
+    reads = writes = 0;
     return 1;
 #endif
 }
@@ -206,8 +458,9 @@ void accessPSRAM(uint32_t addr, size_t size, bool write, void *bufP)
         cmdAddr[0] = PSRAM_CMD_WRITE;
     else
     {
-        cmdAddr[0] = PSRAM_CMD_READ_FAST;
-        cmdSize++;
+        cmdAddr[0] = readCmd;
+        if (readCmd == PSRAM_CMD_READ_FAST)
+            cmdSize++;
     }
 
 #if PSRAM_TWO_CHIPS || PSRAM_THREE_CHIPS || PSRAM_FOUR_CHIPS
@@ -247,6 +500,15 @@ void accessPSRAM(uint32_t addr, size_t size, bool write, void *bufP)
     deSelectPsramChip(ramchip);
 }
 
+void psramGetCalibration(psram_calibration_t *cal)
+{
+#if PSRAM_HARDWARE_SPI && PSRAM_CALIBRATE
+    *cal = calibration;
+#else
+    memset(cal, 0, sizeof(*cal));
+#endif
+}
+
 void RAMGetStat(uint64_t* preads, uint64_t* pwrites) {
     *(preads) = reads;
     *(pwrites) = writes;
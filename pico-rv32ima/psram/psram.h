@@ -4,9 +4,19 @@
 #include "pico/stdlib.h"
 #include "../config/rv32_config.h"
 
+// Result of the boot time calibration (PSRAM_CALIBRATE)
+typedef struct
+{
+    uint baud;       // SPI clock in Hz
+    bool fast_read;  // Fast read (with a dummy byte) rather than plain read
+    bool cached;     // Taken from flash, only checked this boot
+    uint tried;      // Settings tried before this one passed
+} psram_calibration_t;
+
 void accessPSRAM(uint32_t addr, size_t size, bool write, void *bufP);
 int initPSRAM();
 void RAMGetStat(uint64_t* reads, uint64_t* writes);
+void psramGetCalibration(psram_calibration_t *cal);
 
 // PSRAM bypass
 // #define cache_write(ofs, buf, size) accessPSRAM(ofs, size, true, buf)
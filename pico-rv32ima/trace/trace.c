@@ -0,0 +1,31 @@
+#include <string.h>
+
+#include "trace.h"
+
+trace_t trace;
+
+void trace_start(void)
+{
+    memset(&trace, 0, sizeof(trace));
+    memcpy(trace.buf, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    trace.head = TRACE_MAGIC_LEN;
+    trace.active = true;
+}
+
+void trace_stop(void)
+{
+    trace.active = false;
+}
+
+// Take up to len bytes out of the buffer, for writing to a file
+uint32_t trace_read(uint8_t *dst, uint32_t len)
+{
+    uint32_t pending = trace_pending();
+    if (len > pending)
+        len = pending;
+
+    for (uint32_t i = 0; i < len; i++)
+        dst[i] = trace.buf[(trace.tail + i) & (TRACE_BUFFER_SIZE - 1)];
+    trace.tail += len;
+    return len;
+}
@@ -0,0 +1,114 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Guest memory access trace.
+//
+// The stream starts with TRACE_MAGIC, followed by one record per access:
+//   header  bits 0-1: type, bits 2-3: log2(size), bit 4: same PC as the last record
+//   zigzag varint of (addr - previous addr)
+//   zigzag varint of (pc - previous pc), unless bit 4 is set
+// Addresses are RAM offsets, PCs are guest addresses. A TRACE_MARK record
+// (header only) resets both predictors to 0, it follows any records lost to
+// a full buffer.
+
+#define TRACE_MAGIC "RVTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+#define TRACE_FETCH 0
+#define TRACE_LOAD 1
+#define TRACE_STORE 2
+#define TRACE_MARK 3
+
+#define TRACE_SAME_PC 0x10
+
+#ifndef TRACE_BUFFER_SIZE
+#define TRACE_BUFFER_SIZE 16384 // Power of two
+#endif
+
+// Longest encoded record
+#define TRACE_RECORD_MAX 11
+
+typedef struct
+{
+    uint8_t buf[TRACE_BUFFER_SIZE];
+    uint32_t head, tail; // Free running, head is written by the recorder
+    uint32_t last_addr, last_pc;
+    bool active, lost;
+    uint64_t records, dropped;
+} trace_t;
+
+extern trace_t trace;
+
+void trace_start(void);
+void trace_stop(void);
+uint32_t trace_read(uint8_t *dst, uint32_t len);
+
+static inline uint32_t trace_pending(void)
+{
+    return trace.head - trace.tail;
+}
+
+static inline uint32_t trace_put_varint(uint8_t *p, uint32_t v)
+{
+    uint32_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = v | 0x80;
+        v >>= 7;
+    }
+    p[n++] = v;
+    return n;
+}
+
+static inline uint32_t trace_zigzag(uint32_t delta)
+{
+    return (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+}
+
+// Record one access, instruction fetches are told apart from loads by their address
+static inline void trace_access(uint32_t pc, uint32_t addr, uint32_t size, uint32_t type)
+{
+    if (!trace.active)
+        return;
+
+    if (type == TRACE_LOAD && addr - (pc - 0x80000000) < 4)
+        type = TRACE_FETCH;
+
+    if (TRACE_BUFFER_SIZE - trace_pending() < TRACE_RECORD_MAX + 1)
+    {
+        trace.lost = true;
+        trace.dropped++;
+        return;
+    }
+
+    uint8_t rec[TRACE_RECORD_MAX + 1];
+    uint32_t n = 0;
+
+    if (trace.lost)
+    {
+        rec[n++] = TRACE_MARK;
+        trace.last_addr = trace.last_pc = 0;
+        trace.lost = false;
+    }
+
+    uint32_t header = n++;
+    rec[header] = type | ((size == 1 ? 0 : size == 2 ? 1 : 2) << 2);
+    n += trace_put_varint(rec + n, trace_zigzag(addr - trace.last_addr));
+    if (pc == trace.last_pc)
+        rec[header] |= TRACE_SAME_PC;
+    else
+        n += trace_put_varint(rec + n, trace_zigzag(pc - trace.last_pc));
+
+    trace.last_addr = addr;
+    trace.last_pc = pc;
+    trace.records++;
+
+    for (uint32_t i = 0; i < n; i++)
+        trace.buf[(trace.head + i) & (TRACE_BUFFER_SIZE - 1)] = rec[i];
+    trace.head += n;
+}
+
+#endif
@@ -0,0 +1,265 @@
+#include <string.h>
+
+#include "virtio.h"
+#include "../cache/cache.h"
+#include "../config/rv32_config.h"
+
+#define VIRTIO_MAGIC 0x74726976 // "virt"
+#define VIRTIO_VERSION 2
+#define VIRTIO_VENDOR 0x32335652 // "RV32"
+
+// Register offsets
+#define VIRTIO_MMIO_MAGIC_VALUE 0x000
+#define VIRTIO_MMIO_VERSION 0x004
+#define VIRTIO_MMIO_DEVICE_ID 0x008
+#define VIRTIO_MMIO_VENDOR_ID 0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL 0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX 0x034
+#define VIRTIO_MMIO_QUEUE_NUM 0x038
+#define VIRTIO_MMIO_QUEUE_READY 0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK 0x064
+#define VIRTIO_MMIO_STATUS 0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW 0x080
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW 0x0a0
+#define VIRTIO_MMIO_CONFIG_GENERATION 0x0fc
+#define VIRTIO_MMIO_CONFIG 0x100
+
+#define GUEST_RAM_BASE 0x80000000
+#define GUEST_RAM_SIZE (EMULATOR_RAM_MB * 1024 * 1024)
+
+virtio_mmio_t *virtio_devices[VIRTIO_MMIO_SLOTS];
+
+static void virtio_mmio_reset(virtio_mmio_t *dev)
+{
+    dev->driver_features = 0;
+    dev->device_features_sel = 0;
+    dev->driver_features_sel = 0;
+    dev->queue_sel = 0;
+    dev->interrupt_status = 0;
+    dev->status = 0;
+    memset(dev->queues, 0, sizeof(dev->queues));
+
+    if (dev->reset)
+        dev->reset(dev);
+}
+
+void virtio_mmio_init(virtio_mmio_t *dev, uint32_t device_id, uint32_t num_queues, uint64_t features)
+{
+    dev->device_id = device_id;
+    dev->num_queues = num_queues;
+    dev->device_features = features | (1ULL << VIRTIO_F_VERSION_1);
+    virtio_mmio_reset(dev);
+}
+
+void virtio_register(virtio_mmio_t *dev, uint32_t slot)
+{
+    if (slot < VIRTIO_MMIO_SLOTS)
+        virtio_devices[slot] = dev;
+}
+
+void virtio_unregister_all(void)
+{
+    memset(virtio_devices, 0, sizeof(virtio_devices));
+}
+
+static virtio_queue_t *virtio_selected_queue(virtio_mmio_t *dev)
+{
+    if (dev->queue_sel < dev->num_queues)
+        return &dev->queues[dev->queue_sel];
+    return NULL;
+}
+
+uint32_t virtio_mmio_load(virtio_mmio_t *dev, uint32_t offset)
+{
+    virtio_queue_t *q = virtio_selected_queue(dev);
+
+    if (offset >= VIRTIO_MMIO_CONFIG)
+    {
+        // Config space may be accessed with any width, hand back the right lanes
+        uint32_t val = dev->config_read ? dev->config_read(dev, (offset - VIRTIO_MMIO_CONFIG) & ~3) : 0;
+        return val >> ((offset & 3) * 8);
+    }
+
+    switch (offset)
+    {
+    case VIRTIO_MMIO_MAGIC_VALUE:
+        return VIRTIO_MAGIC;
+    case VIRTIO_MMIO_VERSION:
+        return VIRTIO_VERSION;
+    case VIRTIO_MMIO_DEVICE_ID:
+        return dev->device_id;
+    case VIRTIO_MMIO_VENDOR_ID:
+        return VIRTIO_VENDOR;
+    case VIRTIO_MMIO_DEVICE_FEATURES:
+        return dev->device_features_sel ? dev->device_features >> 32 : (uint32_t)dev->device_features;
+    case VIRTIO_MMIO_QUEUE_NUM_MAX:
+        return q ? VIRTIO_QUEUE_SIZE : 0;
+    case VIRTIO_MMIO_QUEUE_READY:
+        return q ? q->ready : 0;
+    case VIRTIO_MMIO_INTERRUPT_STATUS:
+        return dev->interrupt_status;
+    case VIRTIO_MMIO_STATUS:
+        return dev->status;
+    case VIRTIO_MMIO_CONFIG_GENERATION:
+        return 0;
+    }
+
+    return 0;
+}
+
+void virtio_mmio_store(virtio_mmio_t *dev, uint32_t offset, uint32_t val)
+{
+    virtio_queue_t *q = virtio_selected_queue(dev);
+
+    switch (offset)
+    {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL:
+        dev->device_features_sel = val;
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+        if (dev->driver_features_sel)
+            dev->driver_features = (dev->driver_features & 0xffffffff) | ((uint64_t)val << 32);
+        else
+            dev->driver_features = (dev->driver_features & ~0xffffffffULL) | val;
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL:
+        dev->driver_features_sel = val;
+        break;
+    case VIRTIO_MMIO_QUEUE_SEL:
+        dev->queue_sel = val;
+        break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+        if (q && val && val <= VIRTIO_QUEUE_SIZE)
+            q->num = val;
+        break;
+    case VIRTIO_MMIO_QUEUE_READY:
+        if (q)
+            q->ready = val & 1;
+        break;
+    case VIRTIO_MMIO_QUEUE_NOTIFY:
+        if (val < dev->num_queues && dev->queues[val].ready && dev->notify)
+            dev->notify(dev, val);
+        break;
+    case VIRTIO_MMIO_INTERRUPT_ACK:
+        dev->interrupt_status &= ~val;
+        break;
+    case VIRTIO_MMIO_STATUS:
+        if (val == 0)
+            virtio_mmio_reset(dev);
+        else
+            dev->status = val;
+        break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW:
+        if (q)
+            q->desc = val;
+        break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_LOW:
+        if (q)
+            q->avail = val;
+        break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_LOW:
+        if (q)
+            q->used = val;
+        break;
+    }
+}
+
+bool virtio_mem_read(uint32_t addr, void *buf, uint32_t len)
+{
+    addr -= GUEST_RAM_BASE;
+    if (addr >= GUEST_RAM_SIZE || len > GUEST_RAM_SIZE - addr)
+        return false;
+    cache_dma_read(addr, buf, len);
+    return true;
+}
+
+bool virtio_mem_write(uint32_t addr, const void *buf, uint32_t len)
+{
+    addr -= GUEST_RAM_BASE;
+    if (addr >= GUEST_RAM_SIZE || len > GUEST_RAM_SIZE - addr)
+        return false;
+    cache_dma_write(addr, buf, len);
+    return true;
+}
+
+// Grab every chain the driver made available since the last batch
+uint16_t virtq_begin_batch(virtio_queue_t *q, virtq_batch_t *b)
+{
+    b->count = 0;
+    b->used_count = 0;
+
+    if (!q->ready || !q->num)
+        return 0;
+
+    uint16_t avail_idx;
+    if (!virtio_mem_read(q->avail + 2, &avail_idx, 2))
+        return 0;
+
+    uint16_t pending = avail_idx - q->last_avail;
+    if (pending > q->num)
+        pending = q->num;
+
+    // The pending entries are at most two contiguous runs of the ring
+    uint16_t start = q->last_avail % q->num;
+    uint16_t first = pending < q->num - start ? pending : q->num - start;
+    virtio_mem_read(q->avail + 4 + start * 2, b->heads, first * 2);
+    if (pending > first)
+        virtio_mem_read(q->avail + 4, b->heads + first, (pending - first) * 2);
+
+    q->last_avail += pending;
+    b->count = pending;
+    return pending;
+}
+
+// Take a single available chain, for devices that only consume buffers on demand
+bool virtq_pop(virtio_queue_t *q, uint16_t *head)
+{
+    uint16_t avail_idx;
+    if (!q->ready || !q->num || !virtio_mem_read(q->avail + 2, &avail_idx, 2) || avail_idx == q->last_avail)
+        return false;
+
+    if (!virtio_mem_read(q->avail + 4 + (q->last_avail % q->num) * 2, head, 2))
+        return false;
+
+    q->last_avail++;
+    return true;
+}
+
+bool virtq_read_desc(virtio_queue_t *q, uint16_t idx, virtq_desc_t *d)
+{
+    if (idx >= q->num)
+        return false;
+    return virtio_mem_read(q->desc + idx * sizeof(virtq_desc_t), d, sizeof(virtq_desc_t));
+}
+
+void virtq_complete(virtq_batch_t *b, uint16_t head, uint32_t len)
+{
+    b->used[b->used_count].id = head;
+    b->used[b->used_count].len = len;
+    b->used_count++;
+}
+
+// Publish all completions with a single index update and interrupt
+void virtq_end_batch(virtio_mmio_t *dev, virtio_queue_t *q, virtq_batch_t *b)
+{
+    if (!b->used_count)
+        return;
+
+    uint16_t start = q->used_idx % q->num;
+    uint16_t first = b->used_count < q->num - start ? b->used_count : q->num - start;
+    virtio_mem_write(q->used + 4 + start * sizeof(virtq_used_elem_t), b->used, first * sizeof(virtq_used_elem_t));
+    if (b->used_count > first)
+        virtio_mem_write(q->used + 4, b->used + first, (b->used_count - first) * sizeof(virtq_used_elem_t));
+
+    q->used_idx += b->used_count;
+    virtio_mem_write(q->used + 2, &q->used_idx, 2);
+
+    dev->interrupt_status |= VIRTIO_INT_USED_RING;
+}
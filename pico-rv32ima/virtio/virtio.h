@@ -0,0 +1,114 @@
+#ifndef _VIRTIO_H
+#define _VIRTIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// virtio-mmio (version 2) transport
+
+// Devices live in 4K slots starting at VIRTIO_MMIO_BASE
+#define VIRTIO_MMIO_BASE 0x10001000
+#define VIRTIO_MMIO_STRIDE 0x1000
+#define VIRTIO_MMIO_SLOTS 4
+#define VIRTIO_MMIO_ADDR(slot) (VIRTIO_MMIO_BASE + (slot) * VIRTIO_MMIO_STRIDE)
+
+#define VIRTIO_BLK_SLOT 0
+#define VIRTIO_CONSOLE_SLOT 1
+
+#define VIRTIO_ID_BLOCK 2
+#define VIRTIO_ID_CONSOLE 3
+
+#define VIRTIO_F_VERSION_1 32
+
+#define VIRTIO_QUEUE_MAX 2
+#define VIRTIO_QUEUE_SIZE 16
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+
+#define VIRTIO_STATUS_DRIVER_OK 4
+
+#define VIRTIO_INT_USED_RING 1
+#define VIRTIO_INT_CONFIG 2
+
+typedef struct
+{
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem_t;
+
+typedef struct
+{
+    uint32_t num;
+    bool ready;
+    uint32_t desc;  // Guest physical addresses of the three rings
+    uint32_t avail;
+    uint32_t used;
+    uint16_t last_avail;
+    uint16_t used_idx;
+} virtio_queue_t;
+
+// Chains taken from the available ring in one go, completed in one go
+typedef struct
+{
+    uint16_t heads[VIRTIO_QUEUE_SIZE];
+    uint16_t count;
+    virtq_used_elem_t used[VIRTIO_QUEUE_SIZE];
+    uint16_t used_count;
+} virtq_batch_t;
+
+typedef struct virtio_mmio virtio_mmio_t;
+
+struct virtio_mmio
+{
+    uint32_t device_id;
+    uint32_t num_queues;
+    uint64_t device_features;
+    uint64_t driver_features;
+    uint32_t device_features_sel;
+    uint32_t driver_features_sel;
+    uint32_t queue_sel;
+    virtio_queue_t queues[VIRTIO_QUEUE_MAX];
+    uint32_t interrupt_status;
+    uint32_t status;
+
+    // Device specific hooks
+    void (*notify)(virtio_mmio_t *dev, uint32_t queue);
+    uint32_t (*config_read)(virtio_mmio_t *dev, uint32_t offset);
+    void (*reset)(virtio_mmio_t *dev);
+};
+
+extern virtio_mmio_t *virtio_devices[VIRTIO_MMIO_SLOTS];
+
+void virtio_mmio_init(virtio_mmio_t *dev, uint32_t device_id, uint32_t num_queues, uint64_t features);
+void virtio_register(virtio_mmio_t *dev, uint32_t slot);
+void virtio_unregister_all(void);
+
+uint32_t virtio_mmio_load(virtio_mmio_t *dev, uint32_t offset);
+void virtio_mmio_store(virtio_mmio_t *dev, uint32_t offset, uint32_t val);
+
+static inline bool virtio_irq_pending(virtio_mmio_t *dev)
+{
+    return dev->interrupt_status != 0;
+}
+
+// Guest memory access (guest physical addresses)
+bool virtio_mem_read(uint32_t addr, void *buf, uint32_t len);
+bool virtio_mem_write(uint32_t addr, const void *buf, uint32_t len);
+
+// Virtqueue processing
+uint16_t virtq_begin_batch(virtio_queue_t *q, virtq_batch_t *b);
+bool virtq_pop(virtio_queue_t *q, uint16_t *head);
+bool virtq_read_desc(virtio_queue_t *q, uint16_t idx, virtq_desc_t *d);
+void virtq_complete(virtq_batch_t *b, uint16_t head, uint32_t len);
+void virtq_end_batch(virtio_mmio_t *dev, virtio_queue_t *q, virtq_batch_t *b);
+
+#endif
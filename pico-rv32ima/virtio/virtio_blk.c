@@ -0,0 +1,265 @@
+#include <string.h>
+
+#include "virtio_blk.h"
+#include "f_util.h"
+#include "hw_config.h"
+#include "sd_card.h"
+
+#include "../config/rv32_config.h"
+
+#define VIRTIO_BLK_F_SEG_MAX 2
+#define VIRTIO_BLK_F_RO 5
+#define VIRTIO_BLK_F_FLUSH 9
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_T_GET_ID 8
+
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+#define VIRTIO_BLK_ID_BYTES 20
+
+#define SECTOR_SIZE 512
+#define BOUNCE_SECTORS 8 // Streamed reads use it in halves
+
+typedef struct
+{
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_req_t;
+
+virtio_mmio_t virtio_blk;
+
+static FIL image;
+static bool image_open;
+static bool image_ro;
+static uint64_t capacity; // In 512 byte sectors
+
+// When the image is one contiguous run of clusters requests skip FatFS
+// and go straight to the card
+static sd_card_t *raw_sd;
+static LBA_t raw_base;
+
+static uint8_t bounce[BOUNCE_SECTORS * SECTOR_SIZE] __attribute__((aligned(4)));
+
+static bool virtio_blk_map_raw(void)
+{
+    if (!f_contiguous_lba(&image, &raw_base))
+        return false;
+    raw_sd = sd_get_by_num(0);
+    return raw_sd != NULL;
+}
+
+static bool virtio_blk_io(uint64_t sector, uint8_t *buf, uint32_t count, bool write)
+{
+    if (sector + count > capacity)
+        return false;
+
+    if (raw_sd)
+    {
+        if (write)
+            return raw_sd->write_blocks(raw_sd, buf, raw_base + sector, count) == 0;
+        return raw_sd->read_blocks(raw_sd, buf, raw_base + sector, count) == 0;
+    }
+
+    UINT done;
+    if (FR_OK != f_lseek(&image, sector * SECTOR_SIZE))
+        return false;
+    if (write)
+        return f_write(&image, buf, count * SECTOR_SIZE, &done) == FR_OK && done == count * SECTOR_SIZE;
+    return f_read(&image, buf, count * SECTOR_SIZE, &done) == FR_OK && done == count * SECTOR_SIZE;
+}
+
+// Hands each streamed chunk to the guest while the card reads the next one
+static bool virtio_blk_stream_chunk(void *ctx, const uint8_t *data, uint32_t blocks)
+{
+    uint32_t *addr = ctx;
+    if (!virtio_mem_write(*addr, data, blocks * SECTOR_SIZE))
+        return false;
+    *addr += blocks * SECTOR_SIZE;
+    return true;
+}
+
+// Move one data descriptor between the guest and the image through the bounce buffer
+static bool virtio_blk_transfer(const virtq_desc_t *d, uint64_t *sector, bool write)
+{
+    // The device only writes into buffers the guest marked device-writable
+    if (d->len % SECTOR_SIZE || !(d->flags & VIRTQ_DESC_F_WRITE) == !write)
+        return false;
+
+    uint32_t addr = d->addr;
+    uint32_t left = d->len / SECTOR_SIZE;
+
+    if (raw_sd && !write)
+    {
+        if (*sector + left > capacity ||
+            sd_read_stream(raw_sd, raw_base + *sector, left, bounce, BOUNCE_SECTORS, virtio_blk_stream_chunk, &addr) != 0 ||
+            addr != d->addr + d->len)
+            return false;
+        *sector += left;
+        return true;
+    }
+
+    while (left)
+    {
+        uint32_t n = left < BOUNCE_SECTORS ? left : BOUNCE_SECTORS;
+        if (write)
+        {
+            if (!virtio_mem_read(addr, bounce, n * SECTOR_SIZE) || !virtio_blk_io(*sector, bounce, n, true))
+                return false;
+        }
+        else
+        {
+            if (!virtio_blk_io(*sector, bounce, n, false) || !virtio_mem_write(addr, bounce, n * SECTOR_SIZE))
+                return false;
+        }
+        addr += n * SECTOR_SIZE;
+        *sector += n;
+        left -= n;
+    }
+    return true;
+}
+
+// Returns the number of bytes written into guest buffers
+static uint32_t virtio_blk_request(virtio_queue_t *q, uint16_t head)
+{
+    virtq_desc_t chain[VIRTIO_QUEUE_SIZE];
+    uint32_t n = 0;
+
+    // Linux puts header, data and status in separate descriptors
+    uint16_t idx = head;
+    do
+    {
+        if (n == VIRTIO_QUEUE_SIZE || !virtq_read_desc(q, idx, &chain[n]))
+            return 0;
+        idx = chain[n].next;
+    } while (chain[n++].flags & VIRTQ_DESC_F_NEXT);
+
+    virtq_desc_t *status = &chain[n - 1];
+    virtio_blk_req_t req;
+    if (n < 2 || chain[0].len < sizeof(req) || !(status->flags & VIRTQ_DESC_F_WRITE) ||
+        !virtio_mem_read(chain[0].addr, &req, sizeof(req)))
+        return 0;
+
+    uint8_t result = VIRTIO_BLK_S_OK;
+    uint32_t written = 0;
+    uint64_t sector = req.sector;
+
+    switch (req.type)
+    {
+    case VIRTIO_BLK_T_IN:
+    case VIRTIO_BLK_T_OUT:
+    {
+        bool write = req.type == VIRTIO_BLK_T_OUT;
+        if (write && image_ro)
+        {
+            result = VIRTIO_BLK_S_IOERR;
+            break;
+        }
+        for (uint32_t i = 1; i < n - 1; i++)
+        {
+            if (!virtio_blk_transfer(&chain[i], &sector, write))
+            {
+                result = VIRTIO_BLK_S_IOERR;
+                break;
+            }
+            if (!write)
+                written += chain[i].len;
+        }
+        break;
+    }
+    case VIRTIO_BLK_T_FLUSH:
+        if (!raw_sd && !image_ro && FR_OK != f_sync(&image))
+            result = VIRTIO_BLK_S_IOERR;
+        break;
+    case VIRTIO_BLK_T_GET_ID:
+    {
+        char id[VIRTIO_BLK_ID_BYTES] = "pico-rv32ima";
+        if (n > 2 && !(chain[1].flags & VIRTQ_DESC_F_WRITE))
+            result = VIRTIO_BLK_S_IOERR;
+        else if (n > 2)
+        {
+            uint32_t len = chain[1].len < sizeof(id) ? chain[1].len : sizeof(id);
+            virtio_mem_write(chain[1].addr, id, len);
+            written += len;
+        }
+        break;
+    }
+    default:
+        result = VIRTIO_BLK_S_UNSUPP;
+        break;
+    }
+
+    virtio_mem_write(status->addr, &result, 1);
+    return written + 1;
+}
+
+static void virtio_blk_notify(virtio_mmio_t *dev, uint32_t queue)
+{
+    static virtq_batch_t batch; // Too big for the core 1 stack
+    virtio_queue_t *q = &dev->queues[queue];
+
+    while (virtq_begin_batch(q, &batch))
+    {
+        for (uint16_t i = 0; i < batch.count; i++)
+            virtq_complete(&batch, batch.heads[i], virtio_blk_request(q, batch.heads[i]));
+        virtq_end_batch(dev, q, &batch);
+    }
+}
+
+static uint32_t virtio_blk_config_read(virtio_mmio_t *dev, uint32_t offset)
+{
+    switch (offset)
+    {
+    case 0x00:
+        return (uint32_t)capacity;
+    case 0x04:
+        return capacity >> 32;
+    case 0x0c:
+        return VIRTIO_QUEUE_SIZE - 2; // seg_max, leaves room for header and status
+    }
+    return 0;
+}
+
+void virtio_blk_close(void)
+{
+    if (image_open)
+        f_close(&image);
+    image_open = false;
+    raw_sd = NULL;
+}
+
+FRESULT virtio_blk_init(const char *filename)
+{
+    virtio_blk_close();
+
+    image_ro = false;
+    FRESULT fr = f_open(&image, filename, FA_READ | FA_WRITE);
+    if (FR_DENIED == fr || FR_WRITE_PROTECTED == fr)
+    {
+        image_ro = true;
+        fr = f_open(&image, filename, FA_READ);
+    }
+    if (FR_OK != fr)
+        return fr;
+
+    image_open = true;
+    capacity = f_size(&image) / SECTOR_SIZE;
+    virtio_blk_map_raw();
+
+    uint64_t features = (1ULL << VIRTIO_BLK_F_SEG_MAX) | (1ULL << VIRTIO_BLK_F_FLUSH);
+    if (image_ro)
+        features |= 1ULL << VIRTIO_BLK_F_RO;
+
+    virtio_blk.notify = virtio_blk_notify;
+    virtio_blk.config_read = virtio_blk_config_read;
+    virtio_blk.reset = NULL;
+    virtio_mmio_init(&virtio_blk, VIRTIO_ID_BLOCK, 1, features);
+    virtio_register(&virtio_blk, VIRTIO_BLK_SLOT);
+
+    return FR_OK;
+}
@@ -0,0 +1,14 @@
+#ifndef _VIRTIO_BLK_H
+#define _VIRTIO_BLK_H
+
+#include "ff.h"
+
+#include "virtio.h"
+
+// virtio-blk device backed by a disk image on the SD card
+FRESULT virtio_blk_init(const char *filename);
+void virtio_blk_close(void);
+
+extern virtio_mmio_t virtio_blk;
+
+#endif
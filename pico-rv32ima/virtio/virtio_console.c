@@ -0,0 +1,99 @@
+#include "pico/stdlib.h"
+#include "pico/util/queue.h"
+
+#include "virtio_console.h"
+#include "../console/console.h"
+
+#define VIRTIO_CONSOLE_RX 0
+#define VIRTIO_CONSOLE_TX 1
+
+#define CHUNK_SIZE 64
+
+virtio_mmio_t virtio_console;
+
+// Hand a whole transmit buffer to the console in one go
+static void virtio_console_tx(virtio_queue_t *q, uint16_t head)
+{
+    static char buf[CHUNK_SIZE];
+    virtq_desc_t d;
+    uint16_t idx = head;
+
+    for (uint32_t n = 0; n < VIRTIO_QUEUE_SIZE && virtq_read_desc(q, idx, &d); n++)
+    {
+        if (!(d.flags & VIRTQ_DESC_F_WRITE))
+        {
+            uint32_t addr = d.addr;
+            uint32_t left = d.len;
+            while (left)
+            {
+                uint32_t chunk = left < CHUNK_SIZE ? left : CHUNK_SIZE;
+                if (!virtio_mem_read(addr, buf, chunk))
+                    return;
+                console_write(buf, chunk);
+                addr += chunk;
+                left -= chunk;
+            }
+        }
+
+        if (!(d.flags & VIRTQ_DESC_F_NEXT))
+            break;
+        idx = d.next;
+    }
+}
+
+static void virtio_console_notify(virtio_mmio_t *dev, uint32_t queue)
+{
+    static virtq_batch_t batch;
+    virtio_queue_t *q = &dev->queues[queue];
+
+    // Receive buffers are only consumed when input arrives
+    if (queue != VIRTIO_CONSOLE_TX)
+        return;
+
+    while (virtq_begin_batch(q, &batch))
+    {
+        for (uint16_t i = 0; i < batch.count; i++)
+        {
+            virtio_console_tx(q, batch.heads[i]);
+            virtq_complete(&batch, batch.heads[i], 0);
+        }
+        virtq_end_batch(dev, q, &batch);
+    }
+}
+
+// Move pending keyboard input into a guest receive buffer
+void virtio_console_poll(void)
+{
+    static virtq_batch_t batch;
+    virtio_queue_t *q = &virtio_console.queues[VIRTIO_CONSOLE_RX];
+
+    if (queue_is_empty(&kb_queue) || !(virtio_console.status & VIRTIO_STATUS_DRIVER_OK))
+        return;
+
+    uint16_t head;
+    virtq_desc_t d;
+    if (!virtq_pop(q, &head))
+        return;
+
+    char buf[IO_QUEUE_LEN];
+    uint32_t len = 0;
+    if (virtq_read_desc(q, head, &d) && (d.flags & VIRTQ_DESC_F_WRITE))
+    {
+        while (len < d.len && len < sizeof(buf) && queue_try_remove(&kb_queue, &buf[len]))
+            len++;
+        virtio_mem_write(d.addr, buf, len);
+    }
+
+    batch.used_count = 0;
+    virtq_complete(&batch, head, len);
+    virtq_end_batch(&virtio_console, q, &batch);
+}
+
+void virtio_console_init(void)
+{
+    virtio_console.notify = virtio_console_notify;
+    virtio_console.config_read = NULL;
+    virtio_console.reset = NULL;
+    virtio_mmio_init(&virtio_console, VIRTIO_ID_CONSOLE, 2, 0);
+    virtio_register(&virtio_console, VIRTIO_CONSOLE_SLOT);
+}
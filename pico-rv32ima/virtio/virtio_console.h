@@ -0,0 +1,12 @@
+#ifndef _VIRTIO_CONSOLE_H
+#define _VIRTIO_CONSOLE_H
+
+#include "virtio.h"
+
+// virtio-console device (a single hvc port) on top of the console queues
+void virtio_console_init(void);
+void virtio_console_poll(void);
+
+extern virtio_mmio_t virtio_console;
+
+#endif